@@ -25,6 +25,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #version 120
 
 varying float depthfrag;
+varying vec2 kinectCoord; // Kinect image-space position for the relief shading
 
 uniform sampler2DRect tex0; // Sampler for the depth image-space elevation texture automatically set by binding
 
@@ -57,6 +58,7 @@ void main()
     /* Transform elevation to height color map texture coordinate: */
     float elevation = dot(basePlaneEq,vertexCcx);///vertexCc.w;
     depthfrag = elevation*heightColorMapTransformation.x+heightColorMapTransformation.y;
+    kinectCoord = texcoord;
     
     /* Transform vertex to proj coordinates: */
     vec4 screenPos = kinectProjMatrix * vertexCcx;
@@ -27,17 +27,28 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 out vec4 outputColor;
 
 in float depthfrag;
+in vec2 kinectCoord;
 
 uniform sampler2DRect heightColorMapSampler;
 uniform sampler2DRect pixelCornerElevationSampler; // Sampler for the half pixel texture
 uniform float contourLineFactor;
 uniform int drawContourLines;
+uniform sampler2DRect hillshadeSampler; // 8 bit relief shading, 0.5 on flat ground
+uniform int drawHillshade;
+uniform float hillshadeStrength;
 
 void main()
 {
     vec2 depthPos = vec2(depthfrag, 0.5);//depthvalue*texsize, 0.5);
     vec4 color =  texture(heightColorMapSampler, depthPos);	//colormap converted depth
 
+    if (drawHillshade == 1)
+    {
+        /* Darken slopes facing away from the lights and brighten the lit ones: */
+        float shade = 2.0*texture(hillshadeSampler, kinectCoord).r;
+        color.rgb = clamp(color.rgb*mix(1.0, shade, hillshadeStrength), 0.0, 1.0);
+    }
+
     if (drawContourLines == 1)
     {
         // Contour line computation
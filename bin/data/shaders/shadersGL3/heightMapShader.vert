@@ -39,6 +39,7 @@ in vec2 texcoord;
 
 // this is something send to the fragment shader
 out float depthfrag;
+out vec2 kinectCoord; // Kinect image-space position for the relief shading
 
 uniform sampler2DRect tex0; // Sampler for the depth image-space elevation texture automatically set by binding
 
@@ -70,6 +71,7 @@ void main()
     /* Transform elevation to height color map texture coordinate: */
     float elevation = dot(basePlaneEq,vertexCcx);///vertexCc.w;
     depthfrag = elevation*heightColorMapTransformation.x+heightColorMapTransformation.y;
+    kinectCoord = texcoord;
     
     /* Transform vertex to proj coordinates: */
     vec4 screenPos = kinectProjMatrix * vertexCcx;
@@ -709,7 +709,7 @@ bool CBoidGameController::setRandomVehicleLocation(ofRectangle area, bool liveIn
 		count++;
 		float x = ofRandom(area.getLeft(), area.getRight());
 		float y = ofRandom(area.getTop(), area.getBottom());
-		bool insideWater = kinectProjector->elevationAtKinectCoord(x, y) < 0;
+		bool insideWater = kinectProjector->getElevationRaster().sample(x, y) < 0;
 		if ((insideWater && liveInWater) || (!insideWater && !liveInWater)) {
 			location = ofVec2f(x, y);
 			okwater = true;
@@ -48,7 +48,7 @@ void Vehicle::updateBeachDetection(){
     int i = 1;
     while (i < 10 && !beach)
     {
-        bool overwater = kinectProjector->elevationAtKinectCoord(futureLocation.x, futureLocation.y) > 0;
+        bool overwater = kinectProjector->getElevationRaster().sample(futureLocation.x, futureLocation.y) > 0;
         if ((overwater && liveInWater) || (!overwater && !liveInWater))
         {
             beach = true;
@@ -0,0 +1,237 @@
+/***********************************************************************
+CalibrationWorker - Chessboard detection for the automatic calibration in a background thread.
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "CalibrationWorker.h"
+
+using namespace cv;
+
+CalibrationWorker::CalibrationWorker()
+{
+}
+
+CalibrationWorker::~CalibrationWorker()
+{
+	stop();
+}
+
+void CalibrationWorker::start()
+{
+	startThread(true);
+}
+
+void CalibrationWorker::stop()
+{
+	jobs.close();
+	results.close();
+	waitForThread(true);
+}
+
+void CalibrationWorker::analyse(CalibrationJob& job)
+{
+	jobs.send(std::move(job));
+}
+
+// Stretch the intensities found inside the ROI to the full 0-255 range
+void CalibrationWorker::normalizeContrast(ofPixels& image, const ofRectangle& ROI)
+{
+	unsigned char *imgD = image.getData();
+	int width = image.getWidth();
+	unsigned char minV = 255;
+	unsigned char maxV = 0;
+
+	for (int y = ROI.getMinY(); y < ROI.getMaxY(); y++)
+	{
+		for (int x = ROI.getMinX(); x < ROI.getMaxX(); x++)
+		{
+			unsigned char val = imgD[y * width + x];
+			if (val > maxV)
+				maxV = val;
+			if (val < minV)
+				minV = val;
+		}
+	}
+	ofLogVerbose("CalibrationWorker") << "normalizeContrast(): min " << (int)minV << " max " << (int)maxV;
+	if (maxV <= minV)
+		return;
+
+	double scale = 255.0 / (maxV - minV);
+	size_t size = image.size();
+	for (size_t i = 0; i < size; i++)
+	{
+		double newVal = (imgD[i] - minV) * scale;
+		imgD[i] = (unsigned char)ofClamp(newVal, 0, 255);
+	}
+}
+
+// Fill a found chessboard and its white border so the next search finds another board
+void CalibrationWorker::maskBoard(Mat& image, const std::vector<cv::Point2f>& corners, cv::Size patternSize)
+{
+	int cols = patternSize.width;
+	int rows = patternSize.height;
+	cv::Point2f c0 = corners[0];
+	cv::Point2f c1 = corners[cols - 1];
+	cv::Point2f c2 = corners[cols * rows - 1];
+	cv::Point2f c3 = corners[cols * (rows - 1)];
+	cv::Point2f u = (c1 - c0) * (1.5f / (cols - 1)); // One and a half square along the rows
+	cv::Point2f v = (c3 - c0) * (1.5f / (rows - 1));
+
+	cv::Point quad[4] = { c0 - u - v, c1 + u - v, c2 + u + v, c3 - u + v };
+	fillConvexPoly(image, quad, 4, Scalar(255));
+}
+
+std::vector<int> CalibrationWorker::identifyBoards(const std::vector<std::vector<cv::Point2f> >& found,
+	const std::vector<std::vector<ofVec2f> >& projectorCorners, cv::Size patternSize)
+{
+	int nFound = found.size();
+	int nBoards = projectorCorners.size();
+	std::vector<int> ids(nFound, -1);
+	if (nBoards <= 1)
+	{
+		// Only one projected board: no identification needed
+		if (nFound == 1)
+			ids[0] = 0;
+		return ids;
+	}
+	// A single board fits any projected board equally well
+	if (nFound < 2)
+		return ids;
+
+	// Mean size of a square in the kinect image
+	double square = 0;
+	for (auto & corners : found)
+		square += cv::norm(corners[patternSize.width - 1] - corners[0]) / (patternSize.width - 1);
+	square /= nFound;
+
+	// Try all assignments of the found boards to the projected boards
+	double bestError = std::numeric_limits<double>::max();
+	double secondError = bestError;
+	std::vector<int> assignment(nFound, -1);
+	std::vector<bool> used(nBoards, false);
+	std::function<void(int)> search = [&](int f) {
+		if (f == nFound)
+		{
+			std::vector<cv::Point2f> src, dst;
+			for (int i = 0; i < nFound; i++)
+			{
+				for (auto & p : projectorCorners[assignment[i]])
+					src.push_back(cv::Point2f(p.x, p.y));
+				dst.insert(dst.end(), found[i].begin(), found[i].end());
+			}
+			Mat H = findHomography(src, dst, 0);
+			if (H.empty())
+				return;
+			std::vector<cv::Point2f> projected;
+			perspectiveTransform(src, projected, H);
+			double error = 0;
+			for (size_t i = 0; i < dst.size(); i++)
+				error += cv::norm(projected[i] - dst[i]);
+			error /= dst.size();
+			if (error < bestError)
+			{
+				secondError = bestError;
+				bestError = error;
+				ids = assignment;
+			}
+			else if (error < secondError)
+			{
+				secondError = error;
+			}
+			return;
+		}
+		for (int b = 0; b < nBoards; b++)
+		{
+			if (used[b])
+				continue;
+			used[b] = true;
+			assignment[f] = b;
+			search(f + 1);
+			used[b] = false;
+		}
+	};
+	search(0);
+
+	ofLogVerbose("CalibrationWorker") << "identifyBoards(): " << nFound << " boards, best error " << bestError << " second " << secondError << " square " << square;
+	// The assignment must fit well and clearly better than any other
+	if (bestError > 0.3 * square || secondError < 2 * bestError)
+		std::fill(ids.begin(), ids.end(), -1);
+	return ids;
+}
+
+void CalibrationWorker::threadedFunction()
+{
+	CalibrationJob job;
+	while (jobs.receive(job))
+	{
+		CalibrationResult result;
+		result.generation = job.generation;
+		result.found = false;
+		int nBoards = std::max<int>(1, job.projectorCorners.size());
+		result.boards.resize(nBoards);
+
+		normalizeContrast(job.grayImage, job.ROI);
+		if (!job.debugName.empty())
+			ofSaveImage(job.grayImage, job.debugDir + "ChessboardImage_" + job.debugName + ".png");
+
+		Mat cvGrayImage = ofxCv::toCv(job.grayImage);
+		cv::Rect tempROI((int)job.ROI.x, (int)job.ROI.y, (int)job.ROI.width, (int)job.ROI.height);
+		Mat cvGrayROI = cvGrayImage(tempROI);
+
+		std::vector<std::vector<cv::Point2f> > found;
+		for (int b = 0; b < nBoards; b++)
+		{
+			std::vector<cv::Point2f> corners;
+			bool foundChessboard = findChessboardCorners(cvGrayROI, job.patternSize, corners, 0);
+			if (!foundChessboard)
+				foundChessboard = findChessboardCorners(cvGrayROI, job.patternSize, corners, CALIB_CB_ADAPTIVE_THRESH + CALIB_CB_FAST_CHECK);
+			if (!foundChessboard)
+				break;
+
+			for (auto & p : corners)
+			{
+				p.x += tempROI.x;
+				p.y += tempROI.y;
+			}
+			// Rasmus: changed search size to 2 from 11 - since this caused false findings
+			cornerSubPix(cvGrayImage, corners, cv::Size(2, 2), cv::Size(-1, -1),
+						 TermCriteria(CV_TERMCRIT_EPS + CV_TERMCRIT_ITER, 30, 0.1));
+			if (b + 1 < nBoards)
+				maskBoard(cvGrayImage, corners, job.patternSize);
+			found.push_back(corners);
+		}
+
+		std::vector<int> ids = identifyBoards(found, job.projectorCorners, job.patternSize);
+		for (size_t i = 0; i < found.size(); i++)
+		{
+			if (ids[i] < 0)
+				continue;
+			result.boards[ids[i]] = found[i];
+			result.found = true;
+		}
+
+		if (!job.debugName.empty() && job.colorImage.isAllocated() && !found.empty())
+		{
+			Mat cvRgbImage = ofxCv::toCv(job.colorImage);
+			for (auto & corners : found)
+				drawChessboardCorners(cvRgbImage, job.patternSize, Mat(corners), true);
+			ofSaveImage(job.colorImage, job.debugDir + "FoundChessboard_" + job.debugName + ".png");
+		}
+		results.send(std::move(result));
+	}
+}
@@ -0,0 +1,68 @@
+/***********************************************************************
+CalibrationWorker - Chessboard detection for the automatic calibration in a background thread.
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#pragma once
+#include "ofMain.h"
+#include "ofxCv.h"
+
+// A chessboard image to analyse. generation identifies the projected chessboards
+// the image was taken from so results for boards that have moved can be dropped
+struct CalibrationJob {
+	int generation;
+	std::vector<std::vector<ofVec2f> > projectorCorners; // Projected inner corners of each board
+	ofPixels grayImage;   // Temporally filtered kinect color image
+	ofPixels colorImage;  // Only needed when dumping debug files
+	ofRectangle ROI;      // Kinect ROI where the chessboard is searched
+	cv::Size patternSize;
+	std::string debugDir;
+	std::string debugName; // Suffix of the debug files, empty if no debug files should be written
+};
+
+struct CalibrationResult {
+	int generation;
+	bool found; // At least one board was found and identified
+	std::vector<std::vector<cv::Point2f> > boards; // Corners of each projected board in kinect image coordinates, empty if not found
+};
+
+// Contrast stretching, chessboard corner search and sub pixel refinement.
+// When several boards are projected they are found one after the other, masking
+// each found board before searching again. The found boards are then identified
+// by the assignment to the projected boards that is best explained by a single homography
+class CalibrationWorker: public ofThread {
+public:
+	CalibrationWorker();
+	~CalibrationWorker();
+
+	void start();
+	void stop();
+
+	void analyse(CalibrationJob& job);
+
+	ofThreadChannel<CalibrationResult> results;
+
+private:
+	void threadedFunction() override;
+	void normalizeContrast(ofPixels& image, const ofRectangle& ROI);
+	void maskBoard(cv::Mat& image, const std::vector<cv::Point2f>& corners, cv::Size patternSize);
+	std::vector<int> identifyBoards(const std::vector<std::vector<cv::Point2f> >& found,
+		const std::vector<std::vector<ofVec2f> >& projectorCorners, cv::Size patternSize);
+
+	ofThreadChannel<CalibrationJob> jobs;
+};
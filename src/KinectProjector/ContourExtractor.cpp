@@ -0,0 +1,309 @@
+/***********************************************************************
+ContourExtractor - Contour line polylines of the elevation raster
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "ContourExtractor.h"
+#include <unordered_map>
+
+// Key of a grid edge and a level. Horizontal edges go from pixel (x, y) to (x + 1, y),
+// vertical edges from (x, y) to (x, y + 1)
+static inline uint64_t edgeKey(int x, int y, bool vertical, int width, int level)
+{
+	uint64_t edge = (static_cast<uint64_t>(y) * width + x) * 2 + (vertical ? 1 : 0);
+	return (edge << 20) | static_cast<uint32_t>(level + (1 << 19));
+}
+
+ContourExtractor::ContourExtractor()
+: width(0),
+height(0),
+distance(10),
+majorEvery(5),
+minX(0),
+maxX(0),
+minY(0),
+maxY(0),
+tilesX(0),
+tilesY(0),
+lastRasterUpdate(0),
+fullUpdate(true)
+{
+	sharedLines = std::make_shared<std::vector<ContourLine> >();
+}
+
+void ContourExtractor::setup(int swidth, int sheight)
+{
+	width = swidth;
+	height = sheight;
+	fullUpdate = true;
+}
+
+void ContourExtractor::setLevels(float sdistance, int smajorEvery)
+{
+	if (sdistance <= 0)
+		return;
+	smajorEvery = std::max(smajorEvery, 1);
+	if (sdistance != distance || smajorEvery != majorEvery)
+		fullUpdate = true;
+	distance = sdistance;
+	majorEvery = smajorEvery;
+}
+
+std::shared_ptr<const std::vector<ContourLine> > ContourExtractor::getSharedLines() const
+{
+	std::lock_guard<std::mutex> lock(sharedMutex);
+	return sharedLines;
+}
+
+int ContourExtractor::update(const ElevationRaster& raster, const ofRectangle& ROI)
+{
+	if (raster.getWidth() != width || raster.getHeight() != height || !raster.isReady())
+		return 0;
+
+	int rx0 = ofClamp(static_cast<int>(ROI.getMinX()), 0, width);
+	int rx1 = ofClamp(static_cast<int>(ROI.getMaxX()), 0, width);
+	int ry0 = ofClamp(static_cast<int>(ROI.getMinY()), 0, height);
+	int ry1 = ofClamp(static_cast<int>(ROI.getMaxY()), 0, height);
+	if (rx0 != minX || rx1 != maxX || ry0 != minY || ry1 != maxY || raster.getTilesX() != tilesX || raster.getTilesY() != tilesY)
+	{
+		minX = rx0;
+		maxX = rx1;
+		minY = ry0;
+		maxY = ry1;
+		tilesX = raster.getTilesX();
+		tilesY = raster.getTilesY();
+		fullUpdate = true;
+	}
+	if (fullUpdate)
+		tileSegments.assign(tilesX * tilesY, std::vector<Segment>());
+
+	// The cells of a tile read the first row and column of the next tiles, so a changed
+	// tile is traced again together with its left, upper and upper left neighbours
+	std::vector<unsigned char> trace(tilesX * tilesY, fullUpdate ? 1 : 0);
+	if (!fullUpdate)
+	{
+		for (int ty = 0; ty < tilesY; ty++)
+		{
+			for (int tx = 0; tx < tilesX; tx++)
+			{
+				if (raster.getTileUpdate(tx, ty) <= lastRasterUpdate)
+					continue;
+				for (int dy = -1; dy <= 0; dy++)
+					for (int dx = -1; dx <= 0; dx++)
+						if (tx + dx >= 0 && ty + dy >= 0)
+							trace[(ty + dy) * tilesX + tx + dx] = 1;
+			}
+		}
+	}
+
+	int tileSize = raster.getTileSize();
+	int traced = 0;
+	for (int ty = 0; ty < tilesY; ty++)
+	{
+		for (int tx = 0; tx < tilesX; tx++)
+		{
+			if (!trace[ty * tilesX + tx])
+				continue;
+			std::vector<Segment>& segments = tileSegments[ty * tilesX + tx];
+			segments.clear();
+			traceTile(raster.getData(), tx, ty, tileSize, segments);
+			traced++;
+		}
+	}
+	lastRasterUpdate = raster.getUpdateCount();
+	fullUpdate = false;
+
+	if (traced > 0)
+		stitch();
+	return traced;
+}
+
+// Marching squares on the cells whose upper left pixel is in the tile
+void ContourExtractor::traceTile(const float* elevation, int tx, int ty, int tileSize, std::vector<Segment>& segments) const
+{
+	int x0 = std::max(tx * tileSize, minX);
+	int x1 = std::min((tx + 1) * tileSize, maxX - 1);
+	int y0 = std::max(ty * tileSize, minY);
+	int y1 = std::min((ty + 1) * tileSize, maxY - 1);
+	float invDistance = 1.0f / distance;
+
+	for (int y = y0; y < y1; y++)
+	{
+		const float* row = elevation + y * width;
+		const float* next = row + width;
+		for (int x = x0; x < x1; x++)
+		{
+			// Corners clockwise from the upper left
+			float v[4] = { row[x], row[x + 1], next[x + 1], next[x] };
+			float lo = std::min(std::min(v[0], v[1]), std::min(v[2], v[3]));
+			float hi = std::max(std::max(v[0], v[1]), std::max(v[2], v[3]));
+
+			// Levels with lo <= level < hi separate the corners
+			for (int level = static_cast<int>(std::ceil(lo * invDistance)); level * distance < hi; level++)
+			{
+				float l = level * distance;
+				int above = (v[0] > l ? 1 : 0) | (v[1] > l ? 2 : 0) | (v[2] > l ? 4 : 0) | (v[3] > l ? 8 : 0);
+				if (above == 0 || above == 15)
+					continue;
+
+				// Crossing point and key of the edges top, right, bottom, left
+				ofVec2f p[4];
+				uint64_t k[4];
+				bool crossed[4];
+				const int ex[4] = { 0, 1, 0, 0 };
+				const int ey[4] = { 0, 0, 1, 0 };
+				for (int e = 0; e < 4; e++)
+				{
+					int c0 = (e == 2) ? 3 : e;      // Bottom edge goes from corner 3 to 2
+					int c1 = (e == 2) ? 2 : (e + 1) % 4;
+					if (e == 3)
+					{
+						c0 = 0;
+						c1 = 3;
+					}
+					crossed[e] = ((above >> c0) & 1) != ((above >> c1) & 1);
+					if (!crossed[e])
+						continue;
+					float t = (l - v[c0]) / (v[c1] - v[c0]);
+					bool vertical = (e == 1 || e == 3);
+					p[e] = vertical ? ofVec2f(x + ex[e], y + t) : ofVec2f(x + t, y + ey[e]);
+					k[e] = edgeKey(x + ex[e], y + ey[e], vertical, width, level);
+				}
+
+				int pairs[2][2];
+				int numPairs = 1;
+				if (above == 5 || above == 10)
+				{
+					// Saddle: the centre decides which diagonal is connected
+					bool centreAbove = (v[0] + v[1] + v[2] + v[3]) * 0.25f > l;
+					numPairs = 2;
+					if (centreAbove == ((above & 1) != 0))
+					{
+						pairs[0][0] = 0; pairs[0][1] = 1;
+						pairs[1][0] = 2; pairs[1][1] = 3;
+					}
+					else
+					{
+						pairs[0][0] = 3; pairs[0][1] = 0;
+						pairs[1][0] = 1; pairs[1][1] = 2;
+					}
+				}
+				else
+				{
+					int n = 0;
+					for (int e = 0; e < 4; e++)
+						if (crossed[e])
+							pairs[0][n++] = e;
+				}
+
+				for (int i = 0; i < numPairs; i++)
+				{
+					Segment s;
+					s.level = level;
+					s.edgeA = k[pairs[i][0]];
+					s.edgeB = k[pairs[i][1]];
+					s.a = p[pairs[i][0]];
+					s.b = p[pairs[i][1]];
+					segments.push_back(s);
+				}
+			}
+		}
+	}
+}
+
+// Join the segments of all tiles sharing an edge into polylines
+void ContourExtractor::stitch()
+{
+	std::vector<const Segment*> all;
+	for (const auto& segments : tileSegments)
+		for (const auto& s : segments)
+			all.push_back(&s);
+
+	// Every edge is crossed by at most two segments, the ones of the two cells sharing it
+	std::unordered_map<uint64_t, std::pair<int, int> > byEdge;
+	byEdge.reserve(all.size() * 2);
+	for (int i = 0; i < (int)all.size(); i++)
+	{
+		for (uint64_t key : { all[i]->edgeA, all[i]->edgeB })
+		{
+			auto it = byEdge.find(key);
+			if (it == byEdge.end())
+				byEdge.emplace(key, std::make_pair(i, -1));
+			else
+				it->second.second = i;
+		}
+	}
+	auto other = [&byEdge](uint64_t key, int segment) {
+		const std::pair<int, int>& p = byEdge[key];
+		return p.first == segment ? p.second : p.first;
+	};
+
+	lines.clear();
+	std::vector<unsigned char> used(all.size(), 0);
+	std::deque<ofVec2f> points;
+	for (int start = 0; start < (int)all.size(); start++)
+	{
+		if (used[start])
+			continue;
+		used[start] = 1;
+		points.assign({ all[start]->a, all[start]->b });
+		bool closed = false;
+
+		// Follow the line forwards from edge B, then backwards from edge A
+		for (int direction = 0; direction < 2 && !closed; direction++)
+		{
+			int current = start;
+			uint64_t key = direction == 0 ? all[start]->edgeB : all[start]->edgeA;
+			while (true)
+			{
+				int next = other(key, current);
+				if (next < 0)
+					break;
+				if (next == start)
+				{
+					closed = true;
+					break;
+				}
+				if (used[next])
+					break;
+				used[next] = 1;
+				const Segment* s = all[next];
+				bool forward = s->edgeA == key;
+				const ofVec2f& p = forward ? s->b : s->a;
+				if (direction == 0)
+					points.push_back(p);
+				else
+					points.push_front(p);
+				key = forward ? s->edgeB : s->edgeA;
+				current = next;
+			}
+		}
+
+		ContourLine line;
+		line.level = all[start]->level * distance;
+		line.major = all[start]->level % majorEvery == 0;
+		line.closed = closed;
+		if (closed)
+			points.pop_back(); // The last point is the first one again
+		line.points.assign(points.begin(), points.end());
+		lines.push_back(std::move(line));
+	}
+
+	std::lock_guard<std::mutex> lock(sharedMutex);
+	sharedLines = std::make_shared<std::vector<ContourLine> >(lines);
+}
@@ -0,0 +1,82 @@
+/***********************************************************************
+ContourExtractor - Contour line polylines of the elevation raster
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#pragma once
+#include "ofMain.h"
+#include "ElevationRaster.h"
+
+struct ContourLine {
+	float level;   // Elevation of the line in mm
+	bool major;
+	bool closed;   // The last point connects to the first one
+	std::vector<ofVec2f> points; // Kinect pixel coordinates
+};
+
+// Marching squares over the elevation raster at every multiple of the line distance.
+// Every majorEvery-th level, counted from the sea level, is a major level.
+// Segments are kept per raster tile and only the tiles changed since the last update,
+// and the tiles whose border cells read their pixels, are traced again. The segments are
+// then joined into polylines through the grid edges they cross, which also joins them
+// across tile borders. Only the kinect ROI is traced
+class ContourExtractor {
+public:
+	ContourExtractor();
+
+	void setup(int width, int height);
+	void setLevels(float distance, int majorEvery = 5);
+
+	// Trace the changed tiles and rebuild the lines. Returns the number of traced tiles
+	int update(const ElevationRaster& raster, const ofRectangle& ROI);
+
+	// Lines of the last update, to be used from the thread calling update()
+	const std::vector<ContourLine>& getLines() const {
+		return lines;
+	}
+	// Lines of the last update, can be called from any thread
+	std::shared_ptr<const std::vector<ContourLine> > getSharedLines() const;
+
+	float getDistance() const {
+		return distance;
+	}
+
+private:
+	struct Segment {
+		int level; // Level index: elevation = level * distance
+		uint64_t edgeA, edgeB; // Grid edges of the end points
+		ofVec2f a, b;
+	};
+
+	void traceTile(const float* elevation, int tx, int ty, int tileSize, std::vector<Segment>& segments) const;
+	void stitch();
+
+	int width, height;
+	float distance;
+	int majorEvery;
+
+	int minX, maxX, minY, maxY; // ROI used for the current segments
+	int tilesX, tilesY;
+	std::vector<std::vector<Segment> > tileSegments;
+	uint64_t lastRasterUpdate;
+	bool fullUpdate;
+
+	std::vector<ContourLine> lines;
+	mutable std::mutex sharedMutex;
+	std::shared_ptr<const std::vector<ContourLine> > sharedLines;
+};
@@ -0,0 +1,226 @@
+/***********************************************************************
+DebugSnapshotWriter - Writes debug snapshots of the frames as .npz files in a background thread
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "DebugSnapshotWriter.h"
+#include "FilterSnapshot.h"
+#include "KinectRayTable.h"
+
+namespace {
+	void put16(std::string& s, uint16_t v)
+	{
+		s += char(v & 0xff);
+		s += char(v >> 8);
+	}
+
+	void put32(std::string& s, uint32_t v)
+	{
+		put16(s, v & 0xffff);
+		put16(s, v >> 16);
+	}
+}
+
+void NpzFile::addArray(const std::string& name, const std::string& descr, const std::vector<size_t>& shape,
+	const void* data, size_t size)
+{
+	std::string dict = "{'descr': '" + descr + "', 'fortran_order': False, 'shape': (";
+	for (size_t dim : shape)
+		dict += ofToString(dim) + ", ";
+	dict += "), }";
+	// Magic, version and header length take 10 bytes, the header is padded so the data is 64 byte aligned
+	size_t headerLen = dict.size() + 1;
+	headerLen += (64 - (10 + headerLen) % 64) % 64;
+	dict.append(headerLen - dict.size() - 1, ' ');
+	dict += '\n';
+
+	Entry entry;
+	entry.name = name + ".npy";
+	entry.data.reserve(10 + headerLen + size);
+	entry.data += "\x93NUMPY";
+	entry.data += char(1);
+	entry.data += char(0);
+	put16(entry.data, headerLen);
+	entry.data += dict;
+	entry.data.append(static_cast<const char*>(data), size);
+	entry.crc = FilterSnapshot::crc32(reinterpret_cast<const unsigned char*>(entry.data.data()), entry.data.size());
+	entry.offset = 0;
+	entries.push_back(std::move(entry));
+}
+
+// Stored (uncompressed) zip entries, the arrays are a few MB so there is no need for zip64
+bool NpzFile::save(const std::string& path)
+{
+	std::time_t now = std::time(nullptr);
+	std::tm* t = std::localtime(&now);
+	uint16_t dosTime = (t->tm_hour << 11) | (t->tm_min << 5) | (t->tm_sec / 2);
+	uint16_t dosDate = ((t->tm_year - 80) << 9) | ((t->tm_mon + 1) << 5) | t->tm_mday;
+
+	std::ofstream file(path.c_str(), std::ios::binary);
+	if (!file)
+		return false;
+
+	uint32_t offset = 0;
+	std::string central;
+	for (auto& entry : entries)
+	{
+		entry.offset = offset;
+		uint32_t size = entry.data.size();
+
+		std::string local;
+		put32(local, 0x04034b50);
+		put16(local, 20);     // Version needed
+		put16(local, 0);      // Flags
+		put16(local, 0);      // Stored
+		put16(local, dosTime);
+		put16(local, dosDate);
+		put32(local, entry.crc);
+		put32(local, size);   // Compressed size
+		put32(local, size);
+		put16(local, entry.name.size());
+		put16(local, 0);      // Extra field length
+		local += entry.name;
+		file.write(local.data(), local.size());
+		file.write(entry.data.data(), size);
+		offset += local.size() + size;
+
+		put32(central, 0x02014b50);
+		put16(central, 20);   // Version made by
+		put16(central, 20);
+		put16(central, 0);
+		put16(central, 0);
+		put16(central, dosTime);
+		put16(central, dosDate);
+		put32(central, entry.crc);
+		put32(central, size);
+		put32(central, size);
+		put16(central, entry.name.size());
+		put16(central, 0);    // Extra field length
+		put16(central, 0);    // Comment length
+		put16(central, 0);    // Disk number
+		put16(central, 0);    // Internal attributes
+		put32(central, 0);    // External attributes
+		put32(central, entry.offset);
+		central += entry.name;
+	}
+
+	std::string end;
+	put32(end, 0x06054b50);
+	put16(end, 0);
+	put16(end, 0);
+	put16(end, entries.size());
+	put16(end, entries.size());
+	put32(end, central.size());
+	put32(end, offset);
+	put16(end, 0);            // Comment length
+	file.write(central.data(), central.size());
+	file.write(end.data(), end.size());
+	return file.good();
+}
+
+DebugSnapshotWriter::DebugSnapshotWriter()
+{
+}
+
+DebugSnapshotWriter::~DebugSnapshotWriter()
+{
+	stop();
+}
+
+void DebugSnapshotWriter::start()
+{
+	startThread(true);
+}
+
+void DebugSnapshotWriter::stop()
+{
+	snapshots.close();
+	waitForThread(true);
+}
+
+void DebugSnapshotWriter::write(std::shared_ptr<DebugSnapshot> snapshot)
+{
+	snapshots.send(std::move(snapshot));
+}
+
+void DebugSnapshotWriter::threadedFunction()
+{
+	std::shared_ptr<DebugSnapshot> snapshot;
+	while (snapshots.receive(snapshot))
+	{
+		uint64_t start = ofGetElapsedTimeMillis();
+		bool ok = writeSnapshot(*snapshot);
+		ofLogVerbose("DebugSnapshotWriter") << "threadedFunction(): " << snapshot->path << (ok ? " written in " : " could not be written after ")
+			<< ofGetElapsedTimeMillis() - start << " ms";
+		snapshot.reset();
+	}
+}
+
+bool DebugSnapshotWriter::writeSnapshot(const DebugSnapshot& snapshot)
+{
+	size_t w = snapshot.filteredDepth.getWidth();
+	size_t h = snapshot.filteredDepth.getHeight();
+	size_t n = w * h;
+	if (n == 0)
+		return false;
+
+	NpzFile npz;
+	if (snapshot.rawDepth.getWidth() == w && snapshot.rawDepth.getHeight() == h)
+		npz.addArray("raw_depth", "<u2", { h, w }, snapshot.rawDepth.getData(), n * sizeof(uint16_t));
+	npz.addArray("filtered_depth", "<f4", { h, w }, snapshot.filteredDepth.getData(), n * sizeof(float));
+
+	// World coordinates interleaved as x, y, z
+	KinectRayTable rayTable;
+	rayTable.setup(w, h, snapshot.kinectWorldMatrix);
+	std::vector<float> world(n * 3);
+	std::vector<float> wx(w), wy(w), wz(w);
+	for (size_t y = 0; y < h; y++)
+	{
+		rayTable.toWorld(0, y, w, snapshot.filteredDepth.getData() + y * w, wx.data(), wy.data(), wz.data());
+		float* row = world.data() + y * w * 3;
+		for (size_t x = 0; x < w; x++)
+		{
+			row[3 * x] = wx[x];
+			row[3 * x + 1] = wy[x];
+			row[3 * x + 2] = wz[x];
+		}
+	}
+	npz.addArray("world", "<f4", { h, w, 3 }, world.data(), world.size() * sizeof(float));
+
+	if (snapshot.elevation.size() == n)
+	{
+		npz.addArray("elevation", "<f4", { h, w }, snapshot.elevation.data(), n * sizeof(float));
+
+		// Land mask: elevation above the base plane
+		std::vector<unsigned char> mask(n);
+		for (size_t i = 0; i < n; i++)
+			mask[i] = snapshot.elevation[i] > 0;
+		npz.addArray("mask", "|u1", { h, w }, mask.data(), n);
+	}
+
+	if (snapshot.color.getWidth() == w && snapshot.color.getHeight() == h)
+	{
+		size_t channels = snapshot.color.getNumChannels();
+		if (channels == 1)
+			npz.addArray("color", "|u1", { h, w }, snapshot.color.getData(), n);
+		else
+			npz.addArray("color", "|u1", { h, w, channels }, snapshot.color.getData(), n * channels);
+	}
+
+	return npz.save(snapshot.path);
+}
@@ -0,0 +1,68 @@
+/***********************************************************************
+DebugSnapshotWriter - Writes debug snapshots of the frames as .npz files in a background thread
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#pragma once
+#include "ofMain.h"
+
+// Copies of the frames taken when the snapshot is requested. Everything derived from
+// them (world coordinates, mask) is computed by the writer thread
+struct DebugSnapshot {
+	std::string path;
+	ofShortPixels rawDepth;      // Last raw kinect frame, filled in by the grabber thread
+	ofFloatPixels filteredDepth;
+	std::vector<float> elevation; // Elevation above the base plane of each pixel
+	ofPixels color;
+	ofMatrix4x4 kinectWorldMatrix;
+};
+
+// An uncompressed zip of .npy arrays, readable with numpy.load()
+class NpzFile {
+public:
+	void addArray(const std::string& name, const std::string& descr, const std::vector<size_t>& shape,
+		const void* data, size_t size);
+	bool save(const std::string& path);
+
+private:
+	struct Entry {
+		std::string name;
+		std::string data; // .npy header and array bytes
+		uint32_t crc;
+		uint32_t offset;
+	};
+	std::vector<Entry> entries;
+};
+
+class DebugSnapshotWriter: public ofThread {
+public:
+	DebugSnapshotWriter();
+	~DebugSnapshotWriter();
+
+	void start();
+	void stop();
+
+	// Can be called from any thread
+	void write(std::shared_ptr<DebugSnapshot> snapshot);
+
+private:
+	void threadedFunction() override;
+	bool writeSnapshot(const DebugSnapshot& snapshot);
+
+	ofThreadChannel<std::shared_ptr<DebugSnapshot> > snapshots;
+};
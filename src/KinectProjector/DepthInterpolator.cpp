@@ -0,0 +1,132 @@
+/***********************************************************************
+DepthInterpolator - Blending of the two latest filtered depth frames
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "DepthInterpolator.h"
+#include "SimdUtils.h"
+
+// Largest |a[i] - b[i]|
+static float maxAbsDifference(const float* a, const float* b, int n)
+{
+	float result = 0;
+	int i = 0;
+#ifdef MAGICSAND_USE_SSE2
+	__m128 signMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	__m128 m = _mm_setzero_ps();
+	for (; i + 4 <= n; i += 4)
+		m = _mm_max_ps(m, _mm_and_ps(_mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)), signMask));
+	float lanes[4];
+	_mm_storeu_ps(lanes, m);
+	result = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+#endif
+	for (; i < n; i++)
+		result = std::max(result, std::abs(a[i] - b[i]));
+	return result;
+}
+
+// out[i] = a[i] + (b[i] - a[i]) * alpha
+static void blend(const float* a, const float* b, int n, float alpha, float* out)
+{
+	int i = 0;
+#ifdef MAGICSAND_USE_SSE2
+	__m128 w = _mm_set1_ps(alpha);
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 va = _mm_loadu_ps(a + i);
+		_mm_storeu_ps(out + i, _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(b + i), va), w)));
+	}
+#endif
+	for (; i < n; i++)
+		out[i] = a[i] + (b[i] - a[i]) * alpha;
+}
+
+DepthInterpolator::DepthInterpolator()
+: width(0),
+height(0),
+previousTime(0),
+latestTime(0),
+maxGap(100000),
+frames(0),
+maxDifference(0),
+blendedAlpha(1),
+referenceAlpha(1),
+referenceDistance(0),
+hasBlend(false)
+{
+}
+
+void DepthInterpolator::setup(int swidth, int sheight)
+{
+	width = swidth;
+	height = sheight;
+	previous.allocate(width, height, 1);
+	latest.allocate(width, height, 1);
+	blended.allocate(width, height, 1);
+	frames = 0;
+	hasBlend = false;
+}
+
+void DepthInterpolator::addFrame(const ofFloatPixels& frame, uint64_t captureTime)
+{
+	if (frame.getWidth() != width || frame.getHeight() != height)
+		return;
+
+	// The current blend is (1 - referenceAlpha) * maxDifference away from the latest frame,
+	// which is the blend of the new frame pair at alpha 0
+	if (hasBlend)
+	{
+		referenceDistance += (1 - referenceAlpha) * maxDifference;
+		referenceAlpha = 0;
+	}
+
+	std::swap(previous, latest);
+	previousTime = latestTime;
+	latest = frame;
+	latestTime = captureTime;
+	frames = std::min(frames + 1, 2);
+	maxDifference = frames == 2 ? maxAbsDifference(previous.getData(), latest.getData(), width * height) : 0;
+}
+
+bool DepthInterpolator::interpolate(uint64_t time, float minChange)
+{
+	if (frames == 0)
+		return false;
+
+	float alpha = 1;
+	if (frames == 2 && latestTime > previousTime && latestTime - previousTime <= maxGap)
+	{
+		if (time <= previousTime)
+			alpha = 0;
+		else if (time < latestTime)
+			alpha = static_cast<float>(time - previousTime) / (latestTime - previousTime);
+	}
+
+	if (hasBlend && referenceDistance + std::abs(alpha - referenceAlpha) * maxDifference < minChange)
+		return false;
+
+	if (frames == 2)
+		blend(previous.getData(), latest.getData(), width * height, alpha, blended.getData());
+	else
+		blended = latest;
+	blendedAlpha = alpha;
+	referenceAlpha = alpha;
+	referenceDistance = 0;
+	hasBlend = true;
+	return true;
+}
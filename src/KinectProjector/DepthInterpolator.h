@@ -0,0 +1,64 @@
+/***********************************************************************
+DepthInterpolator - Blending of the two latest filtered depth frames
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#pragma once
+#include "ofMain.h"
+
+// Linear interpolation between the two latest filtered depth frames at a capture time.
+// A new blend is only computed when it can differ from the last one by at least a given
+// depth somewhere, which is bounded from the largest depth change between the frames,
+// so static scenes are never blended (nor uploaded) twice
+class DepthInterpolator {
+public:
+	DepthInterpolator();
+
+	void setup(int width, int height);
+	// Frames further apart than maxGap (us) are not blended, the latest one is shown
+	void setMaxGap(uint64_t smaxGap) {
+		maxGap = smaxGap;
+	}
+
+	void addFrame(const ofFloatPixels& frame, uint64_t captureTime);
+	bool isReady() const {
+		return frames == 2;
+	}
+
+	// Blend the frames for capture time. Returns false when the blend would differ from
+	// the current one by less than minChange everywhere, the current one is then kept
+	bool interpolate(uint64_t time, float minChange);
+
+	const ofFloatPixels& getPixels() const {
+		return blended;
+	}
+	float getAlpha() const {
+		return blendedAlpha;
+	}
+
+private:
+	int width, height;
+	ofFloatPixels previous, latest, blended;
+	uint64_t previousTime, latestTime, maxGap;
+	int frames;              // Number of frames received, up to 2
+	float maxDifference;     // Largest depth change between previous and latest
+	float blendedAlpha;      // Weight of latest in the current blend
+	float referenceAlpha;    // Blend of the current frames the current blend is compared to
+	float referenceDistance; // Largest difference between the current blend and the reference blend
+	bool hasBlend;
+};
@@ -0,0 +1,161 @@
+/***********************************************************************
+ElevationRaster - Elevation above the base plane of every kinect pixel,
+computed once per depth frame and shared by all consumers.
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "ElevationRaster.h"
+#include <cstring>
+
+ElevationRaster::ElevationRaster()
+: width(0),
+height(0),
+tileSize(16),
+tilesX(0),
+tilesY(0),
+updateCount(0),
+lastChange(0),
+lastRaysVersion(0)
+{
+}
+
+void ElevationRaster::setup(int swidth, int sheight, int stileSize)
+{
+	width = swidth;
+	height = sheight;
+	tileSize = stileSize;
+	tilesX = (width + tileSize - 1) / tileSize;
+	tilesY = (height + tileSize - 1) / tileSize;
+
+	elevation.assign(width * height, 0);
+	dirty.assign(tilesX * tilesY, 1);
+	tileUpdate.assign(tilesX * tilesY, 0);
+	updateCount = 0;
+	lastChange = 0;
+	lastRaysVersion = 0;
+}
+
+int ElevationRaster::markChangedTiles(const float* previousDepth, const float* depth)
+{
+	int changed = 0;
+	for (int ty = 0; ty < tilesY; ty++)
+	{
+		int y0 = ty * tileSize;
+		int y1 = std::min(y0 + tileSize, height);
+		for (int tx = 0; tx < tilesX; tx++)
+		{
+			unsigned char& d = dirty[ty * tilesX + tx];
+			if (d)
+				continue;
+
+			int x0 = tx * tileSize;
+			size_t rowBytes = std::min(tileSize, width - x0) * sizeof(float);
+			for (int y = y0; y < y1; y++)
+			{
+				int idx = y * width + x0;
+				if (memcmp(previousDepth + idx, depth + idx, rowBytes) != 0)
+				{
+					d = 1;
+					changed++;
+					break;
+				}
+			}
+		}
+	}
+	return changed;
+}
+
+void ElevationRaster::markAllDirty()
+{
+	std::fill(dirty.begin(), dirty.end(), 1);
+}
+
+int ElevationRaster::update(const float* depth, const KinectRayTable& rays, const ofVec4f& basePlaneEq)
+{
+	if (!rays.isReady() || rays.getWidth() != width || rays.getHeight() != height)
+		return 0;
+
+	// A new base plane or new rays change the entire raster
+	if (rays.getVersion() != lastRaysVersion || basePlaneEq.x != lastPlaneEq.x || basePlaneEq.y != lastPlaneEq.y
+		|| basePlaneEq.z != lastPlaneEq.z || basePlaneEq.w != lastPlaneEq.w)
+	{
+		markAllDirty();
+		lastRaysVersion = rays.getVersion();
+		lastPlaneEq = basePlaneEq;
+	}
+
+	updateCount++;
+	int updated = 0;
+	for (int ty = 0; ty < tilesY; ty++)
+	{
+		int y0 = ty * tileSize;
+		int y1 = std::min(y0 + tileSize, height);
+		for (int tx = 0; tx < tilesX; tx++)
+		{
+			int t = ty * tilesX + tx;
+			if (!dirty[t])
+				continue;
+
+			int x0 = tx * tileSize;
+			int n = std::min(tileSize, width - x0);
+			for (int y = y0; y < y1; y++)
+			{
+				int idx = y * width + x0;
+				rays.toElevation(x0, y, n, depth + idx, basePlaneEq, &elevation[idx]);
+			}
+			dirty[t] = 0;
+			tileUpdate[t] = updateCount;
+			updated++;
+		}
+	}
+	if (updated > 0)
+		lastChange = updateCount;
+	return updated;
+}
+
+float ElevationRaster::getElevation(int x, int y) const
+{
+	x = ofClamp(x, 0, width - 1);
+	y = ofClamp(y, 0, height - 1);
+	return elevation[y * width + x];
+}
+
+float ElevationRaster::sample(float x, float y) const
+{
+	x = ofClamp(x, 0, width - 1);
+	y = ofClamp(y, 0, height - 1);
+	int x0 = static_cast<int>(x);
+	int y0 = static_cast<int>(y);
+	int x1 = std::min(x0 + 1, width - 1);
+	int y1 = std::min(y0 + 1, height - 1);
+	float fx = x - x0;
+	float fy = y - y0;
+
+	const float* row0 = &elevation[y0 * width];
+	const float* row1 = &elevation[y1 * width];
+	float top = row0[x0] + fx * (row0[x1] - row0[x0]);
+	float bottom = row1[x0] + fx * (row1[x1] - row1[x0]);
+	return top + fy * (bottom - top);
+}
+
+ofRectangle ElevationRaster::getTileRect(int tx, int ty) const
+{
+	int x0 = tx * tileSize;
+	int y0 = ty * tileSize;
+	return ofRectangle(x0, y0, std::min(tileSize, width - x0), std::min(tileSize, height - y0));
+}
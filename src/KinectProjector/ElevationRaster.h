@@ -0,0 +1,102 @@
+/***********************************************************************
+ElevationRaster - Elevation above the base plane of every kinect pixel,
+computed once per depth frame and shared by all consumers.
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#pragma once
+#include "ofMain.h"
+#include "KinectRayTable.h"
+
+// The raster is divided into square tiles. Only tiles where the depth changed
+// (or all tiles when the base plane or the rays changed) are recomputed.
+// Every tile remembers the update in which it was last changed so consumers
+// can do their own incremental updates.
+class ElevationRaster {
+public:
+	ElevationRaster();
+
+	void setup(int width, int height, int tileSize = 16);
+
+	// Compare two depth frames and mark the tiles that differ. Returns the number of newly dirty tiles
+	int markChangedTiles(const float* previousDepth, const float* depth);
+	void markAllDirty();
+
+	// Recompute the dirty tiles from the depth frame. Returns the number of recomputed tiles
+	int update(const float* depth, const KinectRayTable& rays, const ofVec4f& basePlaneEq);
+
+	bool isReady() const {
+		return updateCount > 0;
+	}
+	int getWidth() const {
+		return width;
+	}
+	int getHeight() const {
+		return height;
+	}
+	int getTileSize() const {
+		return tileSize;
+	}
+	int getTilesX() const {
+		return tilesX;
+	}
+	int getTilesY() const {
+		return tilesY;
+	}
+	const float* getData() const {
+		return elevation.data();
+	}
+
+	// Elevation of the pixel (x, y). Coordinates are clamped to the raster
+	float getElevation(int x, int y) const;
+
+	// Bilinear interpolation of the elevation at a kinect (sub)pixel position
+	float sample(float x, float y) const;
+
+	// Number of updates done since setup
+	uint64_t getUpdateCount() const {
+		return updateCount;
+	}
+
+	// Last update in which any tile was recomputed
+	uint64_t getLastChange() const {
+		return lastChange;
+	}
+
+	// Update number in which tile (tx, ty) was last recomputed
+	uint64_t getTileUpdate(int tx, int ty) const {
+		return tileUpdate[ty * tilesX + tx];
+	}
+
+	// Pixel rectangle covered by tile (tx, ty)
+	ofRectangle getTileRect(int tx, int ty) const;
+
+private:
+	int width, height;
+	int tileSize, tilesX, tilesY;
+
+	std::vector<float> elevation;
+	std::vector<unsigned char> dirty;
+	std::vector<uint64_t> tileUpdate;
+	uint64_t updateCount;
+	uint64_t lastChange;
+
+	// Parameters used for the current raster
+	ofVec4f lastPlaneEq;
+	unsigned int lastRaysVersion;
+};
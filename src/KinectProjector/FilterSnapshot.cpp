@@ -0,0 +1,127 @@
+/***********************************************************************
+FilterSnapshot - Binary snapshot of the frame filter state for a warm start.
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "FilterSnapshot.h"
+#include <array>
+
+static_assert(sizeof(FilterSnapshotHeader) == 72, "The snapshot header layout must not depend on the compiler");
+
+const uint32_t FilterSnapshot::currentVersion;
+
+FilterSnapshot::FilterSnapshot()
+{
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "MSFS", 4);
+	header.version = currentVersion;
+	header.headerSize = sizeof(FilterSnapshotHeader);
+}
+
+void FilterSnapshot::allocate(int width, int height)
+{
+	header.width = width;
+	header.height = height;
+	header.payloadSize = 2 * width * height * sizeof(float);
+	depth.assign(width * height, 0);
+	variance.assign(width * height, 0);
+}
+
+uint32_t FilterSnapshot::crc32(const unsigned char* data, size_t size, uint32_t crc)
+{
+	// Built on the first call, the initialisation of a local static is thread safe
+	static const std::array<uint32_t, 256> table = [] {
+		std::array<uint32_t, 256> t;
+		for (uint32_t i = 0; i < 256; i++)
+		{
+			uint32_t c = i;
+			for (int k = 0; k < 8; k++)
+				c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			t[i] = c;
+		}
+		return t;
+	}();
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++)
+		crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+bool FilterSnapshot::save(const std::string& path)
+{
+	size_t bytes = depth.size() * sizeof(float);
+	header.payloadSize = 2 * bytes;
+	header.checksum = crc32(reinterpret_cast<const unsigned char*>(depth.data()), bytes);
+	header.checksum = crc32(reinterpret_cast<const unsigned char*>(variance.data()), bytes, header.checksum);
+
+	std::string tmpPath = path + ".tmp";
+	std::ofstream out(tmpPath, std::ios::binary);
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	out.write(reinterpret_cast<const char*>(depth.data()), bytes);
+	out.write(reinterpret_cast<const char*>(variance.data()), bytes);
+	out.close();
+	if (!out)
+	{
+		ofLogVerbose("FilterSnapshot") << "save(): Could not write " << tmpPath;
+		return false;
+	}
+	return ofFile::moveFromTo(tmpPath, path, false, true);
+}
+
+bool FilterSnapshot::load(const std::string& path)
+{
+	std::ifstream in(path, std::ios::binary);
+	if (!in)
+		return false;
+	in.read(reinterpret_cast<char*>(&header), sizeof(header));
+	if (!in || memcmp(header.magic, "MSFS", 4) != 0 || header.version != currentVersion || header.headerSize != sizeof(FilterSnapshotHeader))
+	{
+		ofLogVerbose("FilterSnapshot") << "load(): " << path << " is not a filter snapshot of version " << currentVersion;
+		return false;
+	}
+	size_t pixels = static_cast<size_t>(header.width) * header.height;
+	if (header.payloadSize != 2 * pixels * sizeof(float))
+	{
+		ofLogVerbose("FilterSnapshot") << "load(): Wrong payload size in " << path;
+		return false;
+	}
+	const int32_t* roi = header.roi;
+	if (roi[0] < 0 || roi[1] < 0 || roi[0] > roi[2] || roi[1] > roi[3]
+		|| static_cast<uint32_t>(roi[2]) > header.width || static_cast<uint32_t>(roi[3]) > header.height)
+	{
+		ofLogVerbose("FilterSnapshot") << "load(): ROI outside of the frame in " << path;
+		return false;
+	}
+	depth.resize(pixels);
+	variance.resize(pixels);
+	in.read(reinterpret_cast<char*>(depth.data()), pixels * sizeof(float));
+	in.read(reinterpret_cast<char*>(variance.data()), pixels * sizeof(float));
+	if (!in)
+	{
+		ofLogVerbose("FilterSnapshot") << "load(): " << path << " is truncated";
+		return false;
+	}
+	uint32_t checksum = crc32(reinterpret_cast<const unsigned char*>(depth.data()), pixels * sizeof(float));
+	checksum = crc32(reinterpret_cast<const unsigned char*>(variance.data()), pixels * sizeof(float), checksum);
+	if (checksum != header.checksum)
+	{
+		ofLogVerbose("FilterSnapshot") << "load(): Checksum mismatch in " << path;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,55 @@
+/***********************************************************************
+FilterSnapshot - Binary snapshot of the frame filter state for a warm start.
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#pragma once
+#include "ofMain.h"
+
+// Fixed size header, followed by the depth and variance arrays of width x height floats.
+// Everything is naturally aligned so the file can be memory mapped
+struct FilterSnapshotHeader {
+	char magic[4];           // "MSFS"
+	uint32_t version;
+	uint32_t headerSize;
+	uint32_t width, height;
+	int32_t roi[4];          // minX, minY, maxX, maxY of the filtered area
+	float basePlaneEq[4];    // Base plane the surface was acquired with
+	uint32_t payloadSize;    // Bytes after the header
+	uint64_t time;           // Seconds since epoch
+	uint32_t checksum;       // CRC32 of the payload
+	uint32_t reserved;
+};
+
+// Stable depth surface and per pixel statistics of the kinect frame filter
+class FilterSnapshot {
+public:
+	static const uint32_t currentVersion = 1;
+
+	FilterSnapshot();
+	void allocate(int width, int height);
+
+	bool save(const std::string& path); // Written to a temporary file first so a crash never leaves a broken snapshot
+	bool load(const std::string& path); // Fails on a wrong magic, version, size, ROI or checksum
+
+	static uint32_t crc32(const unsigned char* data, size_t size, uint32_t crc = 0);
+
+	FilterSnapshotHeader header;
+	std::vector<float> depth;    // Stable depth of each pixel
+	std::vector<float> variance; // Variance of the depth samples of each pixel
+};
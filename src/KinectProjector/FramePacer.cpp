@@ -0,0 +1,77 @@
+/***********************************************************************
+FramePacer - Projector refresh and depth frame timing
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "FramePacer.h"
+
+// Weight of a new sample in the moving averages
+static const float smoothing = 0.05f;
+// Intervals longer than this many periods are pauses (dropped frames, stalls) and not averaged
+static const float maxPeriods = 4;
+
+FramePacer::FramePacer()
+: lastDisplay(0),
+lastCapture(0),
+hasDisplay(false),
+hasCapture(false),
+displayPeriod(1e6f / 60),
+depthPeriod(1e6f / 30),
+latency(0)
+{
+}
+
+void FramePacer::displayed(uint64_t time)
+{
+	if (hasDisplay && time > lastDisplay)
+	{
+		float interval = time - lastDisplay;
+		if (interval < maxPeriods * displayPeriod)
+			displayPeriod += smoothing * (interval - displayPeriod);
+	}
+	lastDisplay = time;
+	hasDisplay = true;
+}
+
+void FramePacer::depthFrameReceived(uint64_t captureTime, uint64_t receiveTime)
+{
+	if (hasCapture && captureTime > lastCapture)
+	{
+		float interval = captureTime - lastCapture;
+		if (interval < maxPeriods * depthPeriod)
+			depthPeriod += smoothing * (interval - depthPeriod);
+	}
+	if (receiveTime >= captureTime)
+		latency += smoothing * (static_cast<float>(receiveTime - captureTime) - latency);
+	lastCapture = captureTime;
+	hasCapture = true;
+}
+
+uint64_t FramePacer::predictNextDisplay(uint64_t now) const
+{
+	if (!hasDisplay || now < lastDisplay)
+		return now;
+	uint64_t periods = static_cast<uint64_t>((now - lastDisplay) / displayPeriod) + 1;
+	return lastDisplay + static_cast<uint64_t>(periods * displayPeriod);
+}
+
+uint64_t FramePacer::getDepthTime(uint64_t displayTime) const
+{
+	uint64_t delay = static_cast<uint64_t>(depthPeriod + latency);
+	return displayTime > delay ? displayTime - delay : 0;
+}
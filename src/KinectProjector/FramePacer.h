@@ -0,0 +1,57 @@
+/***********************************************************************
+FramePacer - Projector refresh and depth frame timing
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#pragma once
+#include "ofMain.h"
+
+// Estimates the projector refresh period and the depth frame period and latency
+// (exponential moving averages, in microseconds) to predict when the next projector
+// refresh is shown and which depth capture time it should show.
+// The depth frames are shown one depth period plus the pipeline latency after their
+// capture, so the frame following the shown time has always been received already
+class FramePacer {
+public:
+	FramePacer();
+
+	// The projector window was drawn at time
+	void displayed(uint64_t time);
+	// A depth frame captured at captureTime reached the main thread at receiveTime
+	void depthFrameReceived(uint64_t captureTime, uint64_t receiveTime);
+
+	// Time of the first projector refresh after now
+	uint64_t predictNextDisplay(uint64_t now) const;
+	// Depth capture time to show at displayTime
+	uint64_t getDepthTime(uint64_t displayTime) const;
+
+	float getDisplayPeriod() const {
+		return displayPeriod;
+	}
+	float getDepthPeriod() const {
+		return depthPeriod;
+	}
+	float getLatency() const {
+		return latency;
+	}
+
+private:
+	uint64_t lastDisplay, lastCapture;
+	bool hasDisplay, hasCapture;
+	float displayPeriod, depthPeriod, latency;
+};
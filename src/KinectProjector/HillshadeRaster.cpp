@@ -0,0 +1,228 @@
+/***********************************************************************
+HillshadeRaster - Multi-directional relief shading of the elevation raster
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "HillshadeRaster.h"
+#include "SimdUtils.h"
+
+HillshadeRaster::HillshadeRaster()
+: width(0),
+height(0),
+zFactor(1),
+pixelSize(2),
+numLights(0),
+minX(0),
+maxX(0),
+minY(0),
+maxY(0),
+tilesX(0),
+tilesY(0),
+lastRasterUpdate(0),
+updateCount(0),
+fullUpdate(true)
+{
+	// Multi-directional shading: the main light from the north west, flanked by three weaker ones
+	lights = { { 315, 45, 2 }, { 270, 45, 1 }, { 0, 45, 1 }, { 225, 45, 0.5f } };
+	updateLightVectors();
+}
+
+void HillshadeRaster::setup(int swidth, int sheight)
+{
+	width = swidth;
+	height = sheight;
+	shading.assign(width * height, 128);
+	fullUpdate = true;
+}
+
+void HillshadeRaster::setLights(const std::vector<HillshadeLight>& slights)
+{
+	lights.assign(slights.begin(), slights.begin() + std::min<size_t>(slights.size(), maxLights));
+	updateLightVectors();
+	fullUpdate = true;
+}
+
+void HillshadeRaster::setZFactor(float szFactor)
+{
+	if (szFactor == zFactor)
+		return;
+	zFactor = szFactor;
+	fullUpdate = true;
+}
+
+void HillshadeRaster::setPixelSize(float spixelSize)
+{
+	// Small changes of the base plane distance are not worth shading everything again
+	if (spixelSize <= 0 || std::abs(spixelSize - pixelSize) < 0.01f * pixelSize)
+		return;
+	pixelSize = spixelSize;
+	fullUpdate = true;
+}
+
+void HillshadeRaster::updateLightVectors()
+{
+	float totalWeight = 0, flat = 0;
+	for (const auto& light : lights)
+	{
+		totalWeight += light.weight;
+		flat += light.weight * sin(ofDegToRad(light.altitude));
+	}
+	numLights = 0;
+	if (totalWeight <= 0 || flat <= 0)
+		return;
+
+	// Image y goes down, so the top of the image (azimuth 0) is -y
+	float scale = 128.0f / flat;
+	for (const auto& light : lights)
+	{
+		float azimuth = ofDegToRad(light.azimuth);
+		float altitude = ofDegToRad(light.altitude);
+		float w = light.weight * scale;
+		lightX[numLights] = w * sin(azimuth) * cos(altitude);
+		lightY[numLights] = -w * cos(azimuth) * cos(altitude);
+		lightZ[numLights] = w * sin(altitude);
+		numLights++;
+	}
+}
+
+int HillshadeRaster::update(const ElevationRaster& raster, const ofRectangle& ROI)
+{
+	if (raster.getWidth() != width || raster.getHeight() != height || !raster.isReady())
+		return 0;
+
+	int rx0 = ofClamp(static_cast<int>(ROI.getMinX()), 0, width);
+	int rx1 = ofClamp(static_cast<int>(ROI.getMaxX()), 0, width);
+	int ry0 = ofClamp(static_cast<int>(ROI.getMinY()), 0, height);
+	int ry1 = ofClamp(static_cast<int>(ROI.getMaxY()), 0, height);
+	if (rx0 != minX || rx1 != maxX || ry0 != minY || ry1 != maxY || raster.getTilesX() != tilesX || raster.getTilesY() != tilesY)
+	{
+		minX = rx0;
+		maxX = rx1;
+		minY = ry0;
+		maxY = ry1;
+		tilesX = raster.getTilesX();
+		tilesY = raster.getTilesY();
+		std::fill(shading.begin(), shading.end(), 128);
+		fullUpdate = true;
+	}
+	if (maxX - minX < 2 || maxY - minY < 2)
+		return 0;
+
+	std::vector<unsigned char> shade(tilesX * tilesY, fullUpdate ? 1 : 0);
+	if (!fullUpdate)
+	{
+		for (int ty = 0; ty < tilesY; ty++)
+		{
+			for (int tx = 0; tx < tilesX; tx++)
+			{
+				if (raster.getTileUpdate(tx, ty) <= lastRasterUpdate)
+					continue;
+				for (int y = std::max(ty - 1, 0); y <= std::min(ty + 1, tilesY - 1); y++)
+					for (int x = std::max(tx - 1, 0); x <= std::min(tx + 1, tilesX - 1); x++)
+						shade[y * tilesX + x] = 1;
+			}
+		}
+	}
+
+	int tileSize = raster.getTileSize();
+	int shaded = 0;
+	for (int ty = 0; ty < tilesY; ty++)
+	{
+		int y0 = std::max(ty * tileSize, minY);
+		int y1 = std::min((ty + 1) * tileSize, maxY);
+		for (int tx = 0; tx < tilesX; tx++)
+		{
+			int x0 = std::max(tx * tileSize, minX);
+			int x1 = std::min((tx + 1) * tileSize, maxX);
+			if (!shade[ty * tilesX + tx] || x0 >= x1 || y0 >= y1)
+				continue;
+			shadeRows(raster.getData(), x0, x1, y0, y1);
+			shaded++;
+		}
+	}
+	lastRasterUpdate = raster.getUpdateCount();
+	fullUpdate = false;
+	if (shaded > 0)
+		updateCount++;
+	return shaded;
+}
+
+inline void HillshadeRaster::shadePixel(const float* row, const float* up, const float* down, int x, float k, unsigned char* out) const
+{
+	int left = std::max(x - 1, minX);
+	int right = std::min(x + 1, maxX - 1);
+	float gx = (row[right] - row[left]) * k;
+	float gy = (down[x] - up[x]) * k;
+	float norm = 1.0f / std::sqrt(gx * gx + gy * gy + 1.0f);
+	float sum = 0;
+	for (int l = 0; l < numLights; l++)
+		sum += std::max(lightZ[l] - (gx * lightX[l] + gy * lightY[l]), 0.0f);
+	out[x] = static_cast<unsigned char>(std::min(sum * norm + 0.5f, 255.0f));
+}
+
+// Shading of the pixels x0 <= x < x1, y0 <= y < y1. Neighbours outside the ROI are clamped
+void HillshadeRaster::shadeRows(const float* elevation, int x0, int x1, int y0, int y1)
+{
+	// Gradients in elevation per pixel, scaled to a slope on the sand
+	float k = 0.5f * zFactor / pixelSize;
+
+	for (int y = y0; y < y1; y++)
+	{
+		const float* row = elevation + y * width;
+		const float* up = elevation + std::max(y - 1, minY) * width;
+		const float* down = elevation + std::min(y + 1, maxY - 1) * width;
+		unsigned char* out = shading.data() + y * width;
+
+		// value = sum(max(0, light . (-gx, -gy, 1))) / |(-gx, -gy, 1)|
+		// The first and last ROI columns have a clamped neighbour and are left to the scalar loop
+		int x = x0;
+		if (x == minX)
+			shadePixel(row, up, down, x++, k, out);
+#ifdef MAGICSAND_USE_SSE2
+		int xEnd = std::min(x1, maxX - 1);
+		__m128 vk = _mm_set1_ps(k);
+		__m128 one = _mm_set1_ps(1.0f);
+		__m128 zero = _mm_setzero_ps();
+		__m128 half = _mm_set1_ps(0.5f);
+		__m128 max = _mm_set1_ps(255.0f);
+		for (; x + 8 <= xEnd; x += 8)
+		{
+			__m128i packed[2];
+			for (int j = 0; j < 2; j++)
+			{
+				int i = x + 4 * j;
+				__m128 gx = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(row + i + 1), _mm_loadu_ps(row + i - 1)), vk);
+				__m128 gy = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(down + i), _mm_loadu_ps(up + i)), vk);
+				__m128 norm = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(gx, gx), _mm_mul_ps(gy, gy)), one)));
+				__m128 sum = zero;
+				for (int l = 0; l < numLights; l++)
+				{
+					__m128 d = _mm_sub_ps(_mm_set1_ps(lightZ[l]), _mm_add_ps(_mm_mul_ps(gx, _mm_set1_ps(lightX[l])), _mm_mul_ps(gy, _mm_set1_ps(lightY[l]))));
+					sum = _mm_add_ps(sum, _mm_max_ps(d, zero));
+				}
+				__m128 value = _mm_min_ps(_mm_add_ps(_mm_mul_ps(sum, norm), half), max);
+				packed[j] = _mm_cvttps_epi32(value);
+			}
+			__m128i words = _mm_packs_epi32(packed[0], packed[1]);
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(out + x), _mm_packus_epi16(words, words));
+		}
+#endif
+		for (; x < x1; x++)
+			shadePixel(row, up, down, x, k, out);
+	}
+}
@@ -0,0 +1,88 @@
+/***********************************************************************
+HillshadeRaster - Multi-directional relief shading of the elevation raster
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#pragma once
+#include "ofMain.h"
+#include "ElevationRaster.h"
+
+struct HillshadeLight {
+	float azimuth;  // Degrees, clockwise from the top of the kinect image
+	float altitude; // Degrees above the horizon
+	float weight;
+};
+
+// 8 bit shading of every kinect pixel, lit by several weighted lights.
+// 128 is the shading of flat ground, lit slopes are brighter and slopes facing away
+// darker, so the renderer multiplies the colour by 2 * shading / 255.
+// Only the kinect ROI is computed, pixels outside are 128. The normals use central
+// differences, so a raster tile changed since the last update is shaded again together
+// with its eight neighbours
+class HillshadeRaster {
+public:
+	HillshadeRaster();
+
+	void setup(int width, int height);
+
+	// Up to maxLights lights, the default is four lights from the north west quadrant
+	void setLights(const std::vector<HillshadeLight>& lights);
+	// Vertical exaggeration of the relief
+	void setZFactor(float zFactor);
+	// Size of a kinect pixel on the sand in mm
+	void setPixelSize(float pixelSize);
+
+	// Shade the tiles changed since the last update. Returns the number of shaded tiles
+	int update(const ElevationRaster& raster, const ofRectangle& ROI);
+
+	int getWidth() const {
+		return width;
+	}
+	int getHeight() const {
+		return height;
+	}
+	const unsigned char* getShading() const {
+		return shading.data();
+	}
+	// Incremented by every update shading at least one tile
+	uint64_t getUpdateCount() const {
+		return updateCount;
+	}
+
+	static const int maxLights = 8;
+
+private:
+	void updateLightVectors();
+	void shadeRows(const float* elevation, int x0, int x1, int y0, int y1);
+	void shadePixel(const float* row, const float* up, const float* down, int x, float k, unsigned char* out) const;
+
+	int width, height;
+	std::vector<unsigned char> shading;
+	std::vector<HillshadeLight> lights;
+	float zFactor, pixelSize;
+
+	// Light vectors pre-multiplied by their normalised weight and 128 / (shading of flat ground)
+	int numLights;
+	float lightX[maxLights], lightY[maxLights], lightZ[maxLights];
+
+	int minX, maxX, minY, maxY; // ROI used for the current shading
+	int tilesX, tilesY;
+	uint64_t lastRasterUpdate; // Last raster update included in the shading
+	uint64_t updateCount;
+	bool fullUpdate;
+};
@@ -50,11 +50,30 @@ void KinectGrabber::stop(){
 bool KinectGrabber::setup(){
 	// settings and defaults
 	storedframes = 0;
+	frameReadyToSend = false;
+	frameSequence = 0;
+	droppedFrames = 0;
 	ROIAverageValue = 0;
 	setToGlobalAvg = 0;
 	setToLocalAvg = 0;
 	doInPaint = 0;
 	doFullFrameFiltering = false;
+	dualRate = true;
+	snapshotPending = false;
+	snapshotTolerance = 15;
+	snapshotMinAgreement = 0.8;
+
+	if (simulator)
+	{
+		width = simulator->getWidth();
+		height = simulator->getHeight();
+		kinectDepthImage.allocate(width, height, 1);
+		filteredframe.allocate(width, height, 1);
+		kinectColorImage.allocate(width, height);
+		kinectColorImage.setUseTexture(false);
+		kinectOpened = true;
+		return true;
+	}
 
 	kinect.init();
 	kinect.setRegistration(true); // To have correspondance between RGB and depth images
@@ -70,6 +89,8 @@ bool KinectGrabber::setup(){
 }
 
 bool KinectGrabber::openKinect() {
+	if (simulator)
+		return true;
 	kinectOpened = kinect.open();
 	return kinectOpened;
 }
@@ -91,6 +112,9 @@ void KinectGrabber::setupFramefilter(int sgradFieldresolution, float newMaxOffse
     maxVariance = 4 ;
     hysteresis = 0.5f ;
     bigChange = 10.0f ;
+    fastWeight = 0.5f;
+    motionThreshold = 8.0f;
+    stillFrames = 5;
 //	instableValue = 0.0;
     maxgradfield = 1000;
     initialValue = 4000;
@@ -131,6 +155,15 @@ void KinectGrabber::initiateBuffers(void){
         for(unsigned int x=0;x<width;++x,++vbPtr)
             *vbPtr=initialValue;
     
+    /* Initialize the dual-rate filtering buffers: */
+    fastBuffer=new float[height*width];
+    stillBuffer=new unsigned char[height*width];
+    for(unsigned int i=0;i<height*width;++i)
+    {
+        fastBuffer[i]=initialValue;
+        stillBuffer[i]=0;
+    }
+    
     /* Initialize the gradient field buffer: */
     gradField = new ofVec2f[gradFieldcols*gradFieldrows];
     ofVec2f* gfPtr=gradField;
@@ -143,14 +176,20 @@ void KinectGrabber::initiateBuffers(void){
     firstImageReady = false;
 }
 
-void KinectGrabber::resetBuffers(void){
+void KinectGrabber::releaseBuffers(void){
     if (bufferInitiated){
         bufferInitiated = false;
         delete[] averagingBuffer;
         delete[] statBuffer;
         delete[] validBuffer;
+        delete[] fastBuffer;
+        delete[] stillBuffer;
         delete[] gradField;
     }
+}
+
+void KinectGrabber::resetBuffers(void){
+    releaseBuffers();
     initiateBuffers();
 }
 
@@ -163,30 +202,52 @@ void KinectGrabber::threadedFunction() {
         this->actions.clear();
         this->actionsLock.unlock();
         
-        kinect.update();
-        if(kinect.isFrameNew()){
-            kinectDepthImage = kinect.getRawDepthPixels();
+        bool frameNew;
+        if (simulator)
+            frameNew = simulator->update();
+        else
+        {
+            kinect.update();
+            frameNew = kinect.isFrameNew();
+        }
+        if(frameNew){
+            // The previous frame is still waiting for the main thread and is replaced
+            if (frameReadyToSend)
+                droppedFrames++;
+            currentFrameInfo = DepthFrameInfo();
+            currentFrameInfo.sequence = ++frameSequence;
+            currentFrameInfo.captureTime = ofGetElapsedTimeMicros();
+
+            kinectDepthImage = simulator ? simulator->getRawDepthPixels() : kinect.getRawDepthPixels();
             filter();
             filteredframe.setImageType(OF_IMAGE_GRAYSCALE);
             updateGradientField();
-			kinectColorImage.setFromPixels(kinect.getPixels());
+			kinectColorImage.setFromPixels(simulator ? simulator->getPixels() : kinect.getPixels());
+
+            currentFrameInfo.filterTime = ofGetElapsedTimeMicros();
+            frameReadyToSend = true;
         }
-        if (storedframes == 0)
+        // Only hand over frames that have not been sent before
+        if (storedframes == 0 && frameReadyToSend)
         {
-            filtered.send(std::move(filteredframe));
-			gradient.send(std::move(gradField));
-            colored.send(std::move(kinectColorImage.getPixels()));
+            currentFrameInfo.sendTime = ofGetElapsedTimeMicros();
+            currentFrameInfo.droppedInGrabber = droppedFrames;
+
+            // The frames are copied since the filter keeps working in its own buffers
+            filtered.send(std::make_pair(filteredframe, currentFrameInfo));
+			gradient.send(gradField);
+            colored.send(kinectColorImage.getPixels());
+            frameReadyToSend = false;
             lock();
             storedframes += 1;
             unlock();
         }
         
     }
-    kinect.close();
-    delete[] averagingBuffer;
-    delete[] statBuffer;
-    delete[] validBuffer;
-    delete[] gradField;
+    saveSnapshot();
+    if (!simulator)
+        kinect.close();
+    releaseBuffers();
 }
 
 void KinectGrabber::performInThread(std::function<void(KinectGrabber&)> action) {
@@ -231,16 +292,23 @@ void KinectGrabber::filter()
 	}
 	else if (bufferInitiated)
     {
+        if (snapshotPending)
+            restoreSnapshot();
+
         const RawDepth* inputFramePtr = static_cast<const RawDepth*>(kinectDepthImage.getData());
         float* averagingBufferPtr = averagingBuffer+averagingSlotIndex*height*width;
         float* statBufferPtr = statBuffer;
         float* validBufferPtr = validBuffer;
+        float* fastBufferPtr = fastBuffer;
+        unsigned char* stillBufferPtr = stillBuffer;
         float* filteredFramePtr = filteredframe.getData();
         
         inputFramePtr += minY*width;  // We only scan kinect ROI
         averagingBufferPtr += minY*width;
         statBufferPtr += minY*width*3;
         validBufferPtr += minY*width;
+        fastBufferPtr += minY*width;
+        stillBufferPtr += minY*width;
         filteredFramePtr += minY*width;
 
 		for(unsigned int y=minY ; y<maxY ; ++y)
@@ -249,8 +317,10 @@ void KinectGrabber::filter()
             averagingBufferPtr += minX;
             statBufferPtr += minX*3;
             validBufferPtr += minX;
+            fastBufferPtr += minX;
+            stillBufferPtr += minX;
             filteredFramePtr += minX;
-            for(unsigned int x=minX ; x<maxX ; ++x,++inputFramePtr,++averagingBufferPtr,statBufferPtr+=3,++validBufferPtr,++filteredFramePtr)
+            for(unsigned int x=minX ; x<maxX ; ++x,++inputFramePtr,++averagingBufferPtr,statBufferPtr+=3,++validBufferPtr,++fastBufferPtr,++stillBufferPtr,++filteredFramePtr)
             {
                 float newVal = static_cast<float>(*inputFramePtr);
                 float oldVal = *averagingBufferPtr;
@@ -284,9 +354,30 @@ void KinectGrabber::filter()
                         statBufferPtr[1] -= oldVal; // Sum of valid samples
                         statBufferPtr[2] -= oldVal * oldVal; // Sum of squares of valid samples
                     }
+                    
+                    /* Dual-rate filtering: track a lightly smoothed value and check it against the running mean */
+                    if (dualRate)
+                    {
+                        if (*fastBufferPtr == initialValue)
+                            *fastBufferPtr = newVal;
+                        else
+                            *fastBufferPtr += fastWeight*(newVal - *fastBufferPtr);
+                        
+                        float mean = statBufferPtr[1]/statBufferPtr[0];
+                        if (abs(*fastBufferPtr - mean) >= motionThreshold)
+                            *stillBufferPtr = 0; // The pixel is moving
+                        else if (*stillBufferPtr < stillFrames)
+                            ++*stillBufferPtr;
+                    }
+                }
+                if (dualRate && *stillBufferPtr < stillFrames)
+                {
+                    /* Moving pixel: bypass the long average until it has been still for a while */
+                    if (*fastBufferPtr != initialValue)
+                        *validBufferPtr = *fastBufferPtr;
                 }
                 // Check if the pixel is "stable": */
-                if(statBufferPtr[0] >= minNumSamples &&
+                else if(statBufferPtr[0] >= minNumSamples &&
                    statBufferPtr[2]*statBufferPtr[0] <= maxVariance*statBufferPtr[0]*statBufferPtr[0] + statBufferPtr[1]*statBufferPtr[1])
                 {
                     /* Check if the new running mean is outside the previous value's envelope: */
@@ -306,6 +397,8 @@ void KinectGrabber::filter()
             averagingBufferPtr += width-maxX;
             statBufferPtr += (width-maxX)*3;
             validBufferPtr += width-maxX;
+            fastBufferPtr += width-maxX;
+            stillBufferPtr += width-maxX;
             filteredFramePtr += width-maxX;
         }
 
@@ -332,6 +425,131 @@ void KinectGrabber::filter()
 	}
 }
 
+void KinectGrabber::setSnapshot(const std::string& path, const ofVec4f& basePlaneEq)
+{
+	snapshotPath = path;
+	snapshotBasePlane = basePlaneEq;
+}
+
+bool KinectGrabber::loadSnapshot(const std::string& path, const ofVec4f& basePlaneEq)
+{
+	setSnapshot(path, basePlaneEq);
+	snapshotPending = false;
+	if (!pendingSnapshot.load(path))
+		return false;
+	const FilterSnapshotHeader& h = pendingSnapshot.header;
+	if (h.width != width || h.height != height)
+	{
+		ofLogVerbose("kinectGrabber") << "loadSnapshot(): Snapshot is for a " << h.width << "x" << h.height << " kinect";
+		return false;
+	}
+	// The surface is only meaningful with the base plane it was acquired with
+	ofVec3f normal(h.basePlaneEq[0], h.basePlaneEq[1], h.basePlaneEq[2]);
+	if ((normal - ofVec3f(basePlaneEq.x, basePlaneEq.y, basePlaneEq.z)).length() > 1e-4f || abs(h.basePlaneEq[3] - basePlaneEq.w) > 0.5f)
+	{
+		ofLogVerbose("kinectGrabber") << "loadSnapshot(): The base plane has changed since the snapshot was taken";
+		return false;
+	}
+	ofLogVerbose("kinectGrabber") << "loadSnapshot(): Snapshot from " << (time(nullptr) - h.time) << " s ago loaded";
+	snapshotPending = true;
+	return true;
+}
+
+bool KinectGrabber::saveSnapshot()
+{
+	if (snapshotPath.empty() || !bufferInitiated || !firstImageReady)
+		return false;
+
+	FilterSnapshot snapshot;
+	snapshot.allocate(width, height);
+	snapshot.header.roi[0] = minX;
+	snapshot.header.roi[1] = minY;
+	snapshot.header.roi[2] = maxX;
+	snapshot.header.roi[3] = maxY;
+	for (int i = 0; i < 4; i++)
+		snapshot.header.basePlaneEq[i] = snapshotBasePlane[i];
+	snapshot.header.time = time(nullptr);
+
+	const float* sbPtr = statBuffer;
+	for (unsigned int i = 0; i < width * height; i++, sbPtr += 3)
+	{
+		snapshot.depth[i] = validBuffer[i];
+		if (sbPtr[0] > 0)
+		{
+			float mean = sbPtr[1] / sbPtr[0];
+			snapshot.variance[i] = max(0.0f, sbPtr[2] / sbPtr[0] - mean * mean);
+		}
+	}
+	bool saved = snapshot.save(snapshotPath);
+	ofLogVerbose("kinectGrabber") << "saveSnapshot(): Snapshot " << (saved ? "saved to " : "could not be saved to ") << snapshotPath;
+	return saved;
+}
+
+// Check the snapshot against the current raw frame and fill the filter buffers with it.
+// Pixels where the live depth disagrees start from the live value instead
+void KinectGrabber::restoreSnapshot()
+{
+	snapshotPending = false;
+	const RawDepth* raw = static_cast<const RawDepth*>(kinectDepthImage.getData());
+	const std::vector<float>& depth = pendingSnapshot.depth;
+
+	int checked = 0, agreeing = 0;
+	for (unsigned int y = minY; y < maxY; ++y)
+	{
+		for (unsigned int x = minX; x < maxX; ++x)
+		{
+			int idx = y * width + x;
+			float newVal = raw[idx];
+			if (newVal <= maxOffset || depth[idx] == initialValue)
+				continue;
+			checked++;
+			if (abs(newVal - depth[idx]) < snapshotTolerance)
+				agreeing++;
+		}
+	}
+	if (checked == 0 || agreeing < snapshotMinAgreement * checked)
+	{
+		ofLogVerbose("kinectGrabber") << "restoreSnapshot(): Only " << agreeing << " of " << checked << " pixels agree with the live depth - starting from scratch";
+		pendingSnapshot = FilterSnapshot();
+		return;
+	}
+
+	// The averaging slots get values around the stored mean with the stored variance so the statistics stay consistent
+	int frameSize = width * height;
+	for (int idx = 0; idx < frameSize; idx++)
+	{
+		float value = depth[idx];
+		float deviation = sqrt(pendingSnapshot.variance[idx]);
+		float newVal = raw[idx];
+		if (newVal > maxOffset && abs(newVal - value) >= snapshotTolerance)
+		{
+			value = newVal;
+			deviation = 0;
+		}
+		if (value == initialValue)
+			continue;
+
+		float* sbPtr = statBuffer + idx * 3;
+		sbPtr[0] = sbPtr[1] = sbPtr[2] = 0;
+		for (int i = 0; i < numAveragingSlots; i++)
+		{
+			float v = value;
+			if (i < numAveragingSlots - numAveragingSlots % 2)
+				v += (i % 2) ? deviation : -deviation;
+			averagingBuffer[i * frameSize + idx] = v;
+			sbPtr[0] += 1;
+			sbPtr[1] += v;
+			sbPtr[2] += v * v;
+		}
+		validBuffer[idx] = value;
+		fastBuffer[idx] = value;
+		stillBuffer[idx] = stillFrames;
+	}
+	firstImageReady = true;
+	pendingSnapshot = FilterSnapshot();
+	ofLogVerbose("kinectGrabber") << "restoreSnapshot(): Filter restored, " << agreeing << " of " << checked << " pixels agree with the live depth";
+}
+
 void KinectGrabber::setFullFrameFiltering(bool ff, ofRectangle ROI)
 {
 	doFullFrameFiltering = ff;
@@ -580,38 +798,20 @@ void KinectGrabber::setKinectROI(ofRectangle ROI){
 }
 
 void KinectGrabber::setAveragingSlotsNumber(int snumAveragingSlots){
-    if (bufferInitiated){
-            bufferInitiated = false;
-            delete[] averagingBuffer;
-            delete[] statBuffer;
-            delete[] validBuffer;
-            delete[] gradField;
-        }
+    releaseBuffers();
     numAveragingSlots = snumAveragingSlots;
     minNumSamples=(numAveragingSlots+1)/2;
     initiateBuffers();
 }
 
 void KinectGrabber::setGradFieldResolution(int sgradFieldresolution){
-    if (bufferInitiated){
-        bufferInitiated = false;
-        delete[] averagingBuffer;
-        delete[] statBuffer;
-        delete[] validBuffer;
-        delete[] gradField;
-    }
+    releaseBuffers();
     gradFieldresolution = sgradFieldresolution;
     initiateBuffers();
 }
 
 void KinectGrabber::setFollowBigChange(bool newfollowBigChange){
-    if (bufferInitiated){
-        bufferInitiated = false;
-        delete[] averagingBuffer;
-        delete[] statBuffer;
-        delete[] validBuffer;
-        delete[] gradField;
-    }
+    releaseBuffers();
     followBigChange = newfollowBigChange;
     initiateBuffers();
 }
@@ -633,6 +833,8 @@ float KinectGrabber::getValidBuffer(int x, int y){
 
 ofMatrix4x4 KinectGrabber::getWorldMatrix() {
 	auto mat = ofMatrix4x4();
+	if (simulator)
+		return simulator->getWorldMatrix();
 	if (kinectOpened) {
 		ofVec3f a = kinect.getWorldCoordinateAt(0, 0, 1);// Trick to access kinect internal parameters without having to modify ofxKinect
 		ofVec3f b = kinect.getWorldCoordinateAt(1, 1, 1);
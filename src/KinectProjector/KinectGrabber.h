@@ -26,6 +26,20 @@ General Public License for more details.
 #include "ofxKinect.h"
 
 #include "Utils.h"
+#include "KinectSimulator.h"
+#include "FilterSnapshot.h"
+
+// Bookkeeping attached to every depth frame handed over by the grabber
+// All times are in microseconds since application start (ofGetElapsedTimeMicros)
+struct DepthFrameInfo {
+	uint64_t sequence = 0;         // Monotonically increasing number of the kinect frame
+	uint64_t captureTime = 0;      // Time the frame was received from the kinect driver
+	uint64_t filterTime = 0;       // Time the filtering of the frame was done
+	uint64_t sendTime = 0;         // Time the frame was handed over to the main thread
+	uint64_t receiveTime = 0;      // Time the main thread picked up the frame
+	uint64_t uploadTime = 0;       // Time the frame was uploaded to the GPU
+	uint64_t droppedInGrabber = 0; // Frames filtered so far that never left the grabber thread
+};
 
 class KinectGrabber: public ofThread {
 public:
@@ -38,10 +52,16 @@ public:
     void stop();
     void performInThread(std::function<void(KinectGrabber&)> action);
     bool setup();
+	// Use simulated frames instead of the kinect, to be called before setup()
+	void setSimulator(std::shared_ptr<KinectSimulator> ssimulator)
+	{
+		simulator = ssimulator;
+	}
 	bool openKinect();
 	void setupFramefilter(int gradFieldresolution, float newMaxOffset, ofRectangle ROI, bool spatialFilter, bool followBigChange, int numAveragingSlots);
     void initiateBuffers(void); // Reinitialise buffers
     void resetBuffers(void);
+    void releaseBuffers(void);
     
     ofVec3f getStatBuffer(int x, int y);
     float getAveragingBuffer(int x, int y, int slotNum);
@@ -71,6 +91,11 @@ public:
     float getRawDepthAt(int x, int y){
         return kinectDepthImage.getData()[(int)(y*width+x)];
     }
+
+	// Only to be used from the grabber thread (performInThread)
+	const ofShortPixels& getRawDepthPixels() const {
+		return kinectDepthImage;
+	}
     
 	ofMatrix4x4 getWorldMatrix();
     
@@ -91,10 +116,23 @@ public:
 		doInPaint = inp;
 	}
 
+	// Moving pixels bypass the long average until they have been still for a number of frames
+	void setDualRateFiltering(bool dr)
+	{
+		dualRate = dr;
+	}
+
 	// Should the entire frame be filtered and thereby ignoring the KinectROI
 	void setFullFrameFiltering(bool ff, ofRectangle ROI);
 
-	ofThreadChannel<ofFloatPixels> filtered;
+	// Warm start: the stable surface is saved on request and when the thread stops. A loaded
+	// snapshot is restored once it has been checked against the first live frame
+	void setSnapshot(const std::string& path, const ofVec4f& basePlaneEq);
+	bool loadSnapshot(const std::string& path, const ofVec4f& basePlaneEq);
+	bool saveSnapshot();
+
+	// The info travels with its frame so the two cannot get out of step
+	ofThreadChannel<std::pair<ofFloatPixels, DepthFrameInfo> > filtered;
 	ofThreadChannel<ofPixels> colored;
 	ofThreadChannel<ofVec2f*> gradient;
     
@@ -103,6 +141,7 @@ private:
     void filter();
     bool isInsideROI(int x, int y); // test is x, y is inside ROI
     void applySpaceFilter();
+    void restoreSnapshot();
     void updateGradientField();
     
 	// A simple inpainting algorithm to remove outliers in the depth
@@ -119,6 +158,12 @@ private:
     bool bufferInitiated;
     bool firstImageReady;
     int storedframes;
+
+    // Frame bookkeeping
+    DepthFrameInfo currentFrameInfo; // Info of the last filtered frame
+    bool frameReadyToSend; // The last filtered frame has not been handed over yet
+    uint64_t frameSequence;
+    uint64_t droppedFrames; // Filtered frames overwritten before they could be sent
     
     // Thread lambda functions (actions)
 	vector<std::function<void(KinectGrabber&)> > actions;
@@ -127,6 +172,7 @@ private:
     // Kinect parameters
 	bool kinectOpened;
     ofxKinect               kinect;
+    std::shared_ptr<KinectSimulator> simulator;
     unsigned int width, height; // Width and height of kinect frames
 	int minX, maxX; // , ROIwidth; // ROI definition
 	int minY, maxY; //, ROIheight;
@@ -141,6 +187,8 @@ private:
 	float* averagingBuffer; // Buffer to calculate running averages of each pixel's depth value
 	float* statBuffer; // Buffer retaining the running means and variances of each pixel's depth value
 	float* validBuffer; // Buffer holding the most recent stable depth value for each pixel
+	float* fastBuffer; // Buffer holding a lightly smoothed depth value for each pixel
+	unsigned char* stillBuffer; // Number of consecutive frames each pixel has been still
     
     // Gradient computation variables
     int gradFieldcols, gradFieldrows;
@@ -157,6 +205,10 @@ private:
 	float hysteresis; // Amount by which a new filtered value has to differ from the current value to update the display
     bool followBigChange;
     float bigChange; // Amount of change over which the averaging slot is reset to new value
+    bool dualRate; // Flag whether moving pixels should bypass the long average
+    float fastWeight; // Weight of a new value in the lightly smoothed buffer
+    float motionThreshold; // Distance between the smoothed value and the running mean over which a pixel is moving
+    unsigned char stillFrames; // Number of still frames before a pixel goes back to the long average
 //	float instableValue; // Value to assign to instable pixels if retainValids is false
 	bool spatialFilter; // Flag whether to apply a spatial filter to time-averaged depth values
     float maxOffset;
@@ -167,6 +219,14 @@ private:
 	bool doInPaint;
 
 	bool doFullFrameFiltering;
+
+    // Warm start
+    std::string snapshotPath;
+    ofVec4f snapshotBasePlane;
+    FilterSnapshot pendingSnapshot;
+    bool snapshotPending; // Loaded and waiting for a live frame to be checked against
+    float snapshotTolerance; // Distance between the snapshot and the live depth for a pixel to agree
+    float snapshotMinAgreement; // Fraction of agreeing pixels needed to restore the snapshot
     // Debug
 //    int blockX, blockY;
 };
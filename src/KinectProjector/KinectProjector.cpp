@@ -51,8 +51,36 @@ KinectProjector::KinectProjector(std::shared_ptr<ofAppBaseWindow> const &p)
 	verticalOffset = 0;
 	DumpDebugFiles = true;
 	DebugFileOutDir = "DebugFiles//";
+	settingsDir = "settings/";
+	colorFrameSequence = 0;
+	contourExtraction = false;
+	contourExtractionRequested = false;
+	contourDistanceRequested = 10;
+	contourMajorEveryRequested = 5;
+	hillshading = false;
+	simulationStep = SIMULATION_STEP_DONE;
+	simulationStart = 0;
+	simulationStageStart = 0;
 	forceGuiUpdate = false;
 	askToFlattenSandFlag = false;
+	lastSeaLevelCheck = 0;
+	seaLevelCheckInterval = 10;
+	seaLevelAngleTolerance = 1.5;
+	seaLevelOffsetTolerance = 15;
+	seaLevelDriftCount = 0;
+	lastSnapshotTime = 0;
+	snapshotInterval = 600;
+	chessboardGeneration = 0;
+	calibrationJobPending = false;
+	projKinectLUTDirty = true;
+	projKinectLUTRasterUpdate = 0;
+	multiChessboardCalibration = false;
+	calibSingleBoard = true;
+	calibBoardSize = 300;
+	structuredLightCalibration = false;
+	structuredLightPattern = 0;
+	structuredLightPass = 0;
+	structuredLightFrames = 0;
 }
 
 void KinectProjector::setup(bool sdisplayGui)
@@ -107,6 +135,12 @@ void KinectProjector::setup(bool sdisplayGui)
 	doFullFrameFiltering = false;
 	spatialFiltering = true;
 	followBigChanges = false;
+	dualRateFiltering = true;
+	depthInterpolation = false;
+	displayDepthReady = false;
+	depthTextureVersion = 0;
+	filteredDepthVersion = 0;
+	depthScaleChanged = false;
 	numAveragingSlots = 15;
 	TemporalFrameCounter = 0;
 
@@ -118,7 +152,14 @@ void KinectProjector::setup(bool sdisplayGui)
 
 	// Initialize the fbos and images
 	FilteredDepthImage.allocate(kinectRes.x, kinectRes.y);
+	DisplayDepthImage.allocate(kinectRes.x, kinectRes.y);
+	depthInterpolator.setup(kinectRes.x, kinectRes.y);
 	kinectColorImage.allocate(kinectRes.x, kinectRes.y);
+	elevationRaster.setup(kinectRes.x, kinectRes.y);
+	landMask.setup(kinectRes.x, kinectRes.y);
+	contourExtractor.setup(kinectRes.x, kinectRes.y);
+	hillshade.setup(kinectRes.x, kinectRes.y);
+	projKinectLUT.setup(projRes.x, projRes.y);
 	thresholdedImage.allocate(kinectRes.x, kinectRes.y);
 
 	kpt = new ofxKinectProjectorToolkit(projRes, kinectRes);
@@ -126,6 +167,7 @@ void KinectProjector::setup(bool sdisplayGui)
 	// finish kinectgrabber setup and start the grabber
 	kinectgrabber.setupFramefilter(gradFieldResolution, maxOffset, kinectROI, spatialFiltering, followBigChanges, numAveragingSlots);
 	kinectWorldMatrix = kinectgrabber.getWorldMatrix();
+	rayTable.setup(kinectRes.x, kinectRes.y, kinectWorldMatrix);
 	ofLogVerbose("KinectProjector") << "KinectProjector.setup(): kinectWorldMatrix: " << kinectWorldMatrix;
 
 	// Setup gradient field
@@ -146,6 +188,11 @@ void KinectProjector::setup(bool sdisplayGui)
 		setupGui();
 
 	kinectgrabber.start(); // Start the acquisition
+	seaLevelMonitor.start();
+	calibrationWorker.start();
+	debugSnapshotWriter.start();
+	thumbnailService.setup(2, OF_IMAGE_FORMAT_PNG);
+	thumbnailService.start();
 
 	updateStatusGUI();
 	checkStartReady(false);
@@ -153,6 +200,10 @@ void KinectProjector::setup(bool sdisplayGui)
 
 void KinectProjector::exit(ofEventArgs &e)
 {
+	seaLevelMonitor.stop();
+	calibrationWorker.stop();
+	debugSnapshotWriter.stop();
+	thumbnailService.stop();
 	if (ROIcalibrated)
 	{
 		if (saveSettings())
@@ -166,6 +217,156 @@ void KinectProjector::exit(ofEventArgs &e)
 	}
 }
 
+void KinectProjector::enableSimulation()
+{
+	simulator = std::make_shared<KinectSimulator>();
+	simulator->setup(projWindow->getWidth(), projWindow->getHeight());
+	kinectgrabber.setSimulator(simulator);
+	settingsDir = "settings/simulation/";
+	ofDirectory::createDirectory(settingsDir, true, true);
+	simulationStep = SIMULATION_STEP_WAIT_KINECT;
+	ofLogNotice("KinectProjector") << "enableSimulation(): Using a simulated kinect and projector";
+}
+
+// Drive the ROI detection and the projector calibration like an operator would and time their stages
+void KinectProjector::updateSimulation()
+{
+	// The simulated projector shows what is drawn in the projector window
+	ofPixels projectorImage;
+	fboProjWindow.readToPixels(projectorImage);
+	simulator->setProjectorImage(projectorImage);
+
+	if (confirmModalState == CONFIRM_MODAL_OPENED && GetApplicationState() == APPLICATION_STATE_CALIBRATING)
+	{
+		if (confirmModalMessage == "COVER_SANDBOX_WITH_BOARD")
+			simulator->setBoardRaised(true);
+		if (confirmModalMessage == "FLATTEN_SAND" || confirmModalMessage == "COVER_SANDBOX_WITH_BOARD")
+			onConfirmCalibration();
+	}
+
+	float now = ofGetElapsedTimef();
+	string stage = getSimulationStage();
+	if (stage != simulationStage)
+	{
+		if (!simulationStage.empty())
+			simulationStageTimes.push_back(make_pair(simulationStage, now - simulationStageStart));
+		simulationStage = stage;
+		simulationStageStart = now;
+	}
+
+	if (simulationStep == SIMULATION_STEP_WAIT_KINECT && imageStabilized)
+	{
+		simulationStart = now;
+		simulationStageTimes.clear();
+		startAutomaticROIDetection();
+		simulationStep = SIMULATION_STEP_ROI;
+	}
+	else if (simulationStep == SIMULATION_STEP_ROI && GetApplicationState() != APPLICATION_STATE_CALIBRATING)
+	{
+		if (confirmModalState == CONFIRM_MODAL_OPENED) // The sandbox walls were not found
+		{
+			writeSimulationReport();
+			simulationStep = SIMULATION_STEP_DONE;
+			return;
+		}
+		simulator->setBoardRaised(false);
+		startAutomaticKinectProjectorCalibration(true);
+		simulationStep = SIMULATION_STEP_CALIBRATION;
+	}
+	else if (simulationStep == SIMULATION_STEP_CALIBRATION && GetApplicationState() != APPLICATION_STATE_CALIBRATING)
+	{
+		writeSimulationReport();
+		simulationStep = SIMULATION_STEP_DONE;
+	}
+}
+
+string KinectProjector::getSimulationStage()
+{
+	if (GetApplicationState() != APPLICATION_STATE_CALIBRATING)
+		return "idle";
+	if (waitingForFlattenSand)
+		return "waiting for operator";
+	if (GetCalibrationState() == CALIBRATION_STATE_ROI_AUTO_DETERMINATION)
+	{
+		const char* names[] = { "ROI init", "ROI stabilizing", "ROI wall detection", "ROI done" };
+		return names[GetROICalibState()];
+	}
+	if (GetCalibrationState() == CALIBRATION_STATE_PROJ_KINECT_AUTO_CALIBRATION)
+	{
+		const char* names[] = { "stabilizing", "sea level plane", "chessboards", "solver", "done", "structured light" };
+		string name = names[GetAutoCalibrationState()];
+		if (GetAutoCalibrationState() == AUTOCALIB_STATE_NEXT_POINT || GetAutoCalibrationState() == AUTOCALIB_STATE_STRUCTURED_LIGHT)
+			name += upframe ? " (high)" : " (low)";
+		return name;
+	}
+	return "other";
+}
+
+void KinectProjector::writeSimulationReport()
+{
+	std::ostringstream report;
+	report << "Calibration simulation: " << calibrationText << std::endl;
+	report << "Point pairs: " << pairsKinect.size() << ", inliers: " << kpt->getNumInliers() << std::endl;
+
+	if (isCalibrated() && simulationStep == SIMULATION_STEP_CALIBRATION)
+	{
+		report << "Reprojection error (px): " << ComputeReprojectionError(false) << std::endl;
+
+		// Compare the calibrated projection with the simulated projector on the surface seen in the ROI
+		double sum = 0, maxError = 0;
+		int n = 0;
+		for (int y = kinectROI.getMinY(); y < kinectROI.getMaxY(); y += 8)
+		{
+			for (int x = kinectROI.getMinX(); x < kinectROI.getMaxX(); x += 8)
+			{
+				ofVec3f wc = simulator->kinectCoordToWorldCoord(x, y, simulator->getSurfaceDepth(x, y));
+				ofVec2f truth = simulator->worldToProjector(wc);
+				if (truth.x < 0 || truth.y < 0 || truth.x >= projRes.x || truth.y >= projRes.y)
+					continue;
+				double error = truth.distance(worldCoordToProjCoord(wc));
+				sum += error;
+				maxError = max(maxError, error);
+				n++;
+			}
+		}
+		if (n > 0)
+			report << "Projection error on the sand (px): mean " << sum / n << " max " << maxError << " over " << n << " points" << std::endl;
+	}
+
+	report << "Stage times (s):" << std::endl;
+	for (auto & stage : simulationStageTimes)
+		report << "  " << stage.first << ": " << stage.second << std::endl;
+	report << "Total (s): " << ofGetElapsedTimef() - simulationStart << std::endl;
+
+	ofLogNotice("KinectProjector") << report.str();
+	ofBuffer buffer;
+	buffer.set(report.str());
+	ofBufferToFile(settingsDir + "calibrationReport_" + GetTimeAndDateString() + ".txt", buffer);
+}
+
+// Save the stable surface of the filter periodically and tell the grabber when the base plane changes,
+// the grabber saves a last snapshot when it stops
+void KinectProjector::updateFilterSnapshot()
+{
+	if (!ROIcalibrated || !basePlaneComputed || GetApplicationState() == APPLICATION_STATE_CALIBRATING)
+		return;
+	float TimeStamp = ofGetElapsedTimef();
+	bool save = imageStabilized && TimeStamp - lastSnapshotTime > snapshotInterval;
+	if (!save && basePlaneEq == snapshotBasePlane)
+		return;
+
+	string path = ofToDataPath(settingsDir + "filterSnapshot.bin");
+	ofVec4f eq = basePlaneEq;
+	snapshotBasePlane = eq;
+	if (save)
+		lastSnapshotTime = TimeStamp;
+	kinectgrabber.performInThread([path, eq, save](KinectGrabber& kg) {
+		kg.setSnapshot(path, eq);
+		if (save)
+			kg.saveSnapshot();
+	});
+}
+
 void KinectProjector::setupGradientField()
 {
 	gradFieldcols = kinectRes.x / gradFieldResolution;
@@ -252,6 +453,8 @@ void KinectProjector::updateStatusGUI()
 
 	gui->getToggle(CMP_SPATIAL_FILTERING)->setChecked(spatialFiltering);
 	gui->getToggle(CMP_QUICK_REACTION)->setChecked(followBigChanges);
+	gui->getToggle(CMP_DUAL_RATE_FILTERING)->setChecked(dualRateFiltering);
+	gui->getToggle(CMP_DEPTH_INTERPOLATION)->setChecked(depthInterpolation);
 	gui->getToggle(CMP_INPAINT_OUTLIERS)->setChecked(doInpainting);
 	gui->getToggle(CMP_FULL_FRAME_FILTERING)->setChecked(doFullFrameFiltering);
 }
@@ -273,6 +476,10 @@ void KinectProjector::updateGuiValue()
 		gui->getToggle(CMP_INPAINT_OUTLIERS)->setChecked(doInpainting);
 		gui->getToggle(CMP_FULL_FRAME_FILTERING)->setChecked(doFullFrameFiltering);
 		gui->getToggle(CMP_QUICK_REACTION)->setChecked(followBigChanges);
+		gui->getToggle(CMP_DUAL_RATE_FILTERING)->setChecked(dualRateFiltering);
+		gui->getToggle(CMP_DEPTH_INTERPOLATION)->setChecked(depthInterpolation);
+		gui->getToggle(CMP_MULTI_CHESSBOARD)->setChecked(multiChessboardCalibration);
+		gui->getToggle(CMP_STRUCTURED_LIGHT)->setChecked(structuredLightCalibration);
 		gui->getSlider(CMP_AVERAGING)->setValue(numAveragingSlots);
 		gui->getSlider(CMP_TILT_X)->setValue(tiltX);
 		gui->getSlider(CMP_TILT_Y)->setValue(tiltY);
@@ -288,6 +495,15 @@ void KinectProjector::update()
 	//    ROIUpdated = false;
 	projKinectCalibrationUpdated = false;
 
+	if (simulator)
+		updateSimulation();
+
+	updateFilterSnapshot();
+
+	// Hands the color frame over only when a websocket client is waiting for a thumbnail
+	if (colorFrameSequence > 0)
+		thumbnailService.update(kinectColorImage.getPixels(), colorFrameSequence);
+
 	// Try to open the kinect every 3. second if it is not yet open
 	float TimeStamp = ofGetElapsedTimef();
 	if (!kinectOpened && TimeStamp - lastKinectOpenTry > 3)
@@ -304,6 +520,14 @@ void KinectProjector::update()
 
 			kinectgrabber.setupFramefilter(gradFieldResolution, maxOffset, kinectROI, spatialFiltering, followBigChanges, numAveragingSlots);
 			kinectWorldMatrix = kinectgrabber.getWorldMatrix();
+			rayTable.setup(kinectRes.x, kinectRes.y, kinectWorldMatrix);
+			elevationRaster.setup(kinectRes.x, kinectRes.y);
+			projKinectLUTDirty = true;
+			landMask.setup(kinectRes.x, kinectRes.y);
+			contourExtractor.setup(kinectRes.x, kinectRes.y);
+			hillshade.setup(kinectRes.x, kinectRes.y);
+			depthInterpolator.setup(kinectRes.x, kinectRes.y);
+			displayDepthReady = false;
 			ofLogVerbose("KinectProjector") << "KinectProjector.update(): kinectWorldMatrix: " << kinectWorldMatrix;
 
 			updateStatusGUI();
@@ -325,20 +549,62 @@ void KinectProjector::update()
 	}
 
 	// Get images from kinect grabber
-	ofFloatPixels filteredframe;
-	if (kinectOpened && kinectgrabber.filtered.tryReceive(filteredframe))
+	std::pair<ofFloatPixels, DepthFrameInfo> frame;
+	if (kinectOpened && kinectgrabber.filtered.tryReceive(frame))
 	{
+		const ofFloatPixels& filteredframe = frame.first;
+		DepthFrameInfo& frameInfo = frame.second;
 		fpsKinect.newFrame();
 		fpsKinectText->setText(ofToString(fpsKinect.getFps(), 2));
 
-		FilteredDepthImage.setFromPixels(filteredframe.getData(), kinectRes.x, kinectRes.y);
-		FilteredDepthImage.updateTexture();
+		frameInfo.receiveTime = ofGetElapsedTimeMicros();
+
+		// Only the tiles where the depth changed need a new elevation. A frame without
+		// changed tiles is identical to the previous one and is not uploaded again
+		bool depthChanged = elevationRaster.markChangedTiles(FilteredDepthImage.getFloatPixelsRef().getData(), filteredframe.getData()) > 0
+			|| !elevationRaster.isReady() || depthScaleChanged;
+		depthScaleChanged = false;
+
+		if (depthChanged)
+		{
+			FilteredDepthImage.setFromPixels(filteredframe.getData(), kinectRes.x, kinectRes.y);
+			FilteredDepthImage.updateTexture();
+			filteredDepthVersion++;
+			if (!depthInterpolation)
+				depthTextureVersion++;
+		}
+		// A frame without info has no capture time to pace or interpolate with
+		if (frameInfo.sequence != 0)
+		{
+			framePacer.depthFrameReceived(frameInfo.captureTime, frameInfo.receiveTime);
+			if (depthInterpolation)
+				depthInterpolator.addFrame(filteredframe, frameInfo.captureTime);
+		}
+		frameInfo.uploadTime = ofGetElapsedTimeMicros();
+		updateFrameStatistics(frameInfo);
+
+		elevationRaster.update(FilteredDepthImage.getFloatPixelsRef().getData(), rayTable, basePlaneEq);
+		landMask.update(elevationRaster, kinectROI);
+		// The lines were not followed while the extraction was off: trace all the tiles again
+		if (contourExtractionRequested && !contourExtraction)
+			contourExtractor.setup(kinectRes.x, kinectRes.y);
+		contourExtraction = contourExtractionRequested;
+		if (contourExtraction)
+		{
+			contourExtractor.setLevels(contourDistanceRequested, contourMajorEveryRequested);
+			contourExtractor.update(elevationRaster, kinectROI);
+		}
+		if (hillshading)
+			updateHillshade();
+		updateProjKinectLUT();
+		updateSeaLevelMonitor();
 
 		// Get color image from kinect grabber
 		ofPixels coloredframe;
 		if (kinectgrabber.colored.tryReceive(coloredframe))
 		{
 			kinectColorImage.setFromPixels(coloredframe);
+			colorFrameSequence++;
 
 			if (TemporalFilteringType == 0)
 				TemporalFrameFilter.NewFrame(kinectColorImage.getPixels().getData(), kinectColorImage.width, kinectColorImage.height);
@@ -362,7 +628,7 @@ void KinectProjector::update()
 		{
 			updateCalibration();
 		}
-		else
+		else if (mainWindowChanged())
 		{
 			//ofEnableAlphaBlending();
 			fboMainWindow.begin();
@@ -411,6 +677,9 @@ void KinectProjector::update()
 		}
 	}
 
+	if (depthInterpolation)
+		updateDepthInterpolation();
+
 	fboProjWindow.begin();
 
 	if (GetApplicationState() != APPLICATION_STATE_CALIBRATING)
@@ -464,6 +733,42 @@ void KinectProjector::update()
 	fboProjWindow.end();
 }
 
+// The kinect view is only redrawn when the shown frame or its overlays changed,
+// and cleared once when it is hidden
+bool KinectProjector::mainWindowChanged()
+{
+	mainWindowRedraw.begin()
+		.add(drawKinectView).add(drawKinectColorView)
+		.add(GetApplicationState()).add(GetCalibrationState()).add(GetROICalibState())
+		.add(kinectROI).add(ROIcalibrated).add(ROIStartPoint).add(ROICurrentPoint);
+	if (drawKinectColorView)
+		mainWindowRedraw.add(colorFrameSequence);
+	else if (drawKinectView)
+		mainWindowRedraw.add(filteredDepthVersion);
+	return mainWindowRedraw.changed();
+}
+
+void KinectProjector::updateFrameStatistics(DepthFrameInfo& info)
+{
+	frameStatistics.framesReceived++;
+	if (info.sequence == 0) // No info came with the frame
+		return;
+
+	// A sequence gap that the grabber did not account for has been lost on the way
+	if (lastFrameInfo.sequence > 0 && info.sequence > lastFrameInfo.sequence + 1)
+	{
+		uint64_t missing = info.sequence - lastFrameInfo.sequence - 1;
+		uint64_t grabberDrops = info.droppedInGrabber - lastFrameInfo.droppedInGrabber;
+		if (missing > grabberDrops)
+			frameStatistics.droppedInTransfer += missing - grabberDrops;
+	}
+	frameStatistics.droppedInGrabber = info.droppedInGrabber;
+	lastFrameInfo = info;
+
+	droppedFramesText->setText(ofToString(frameStatistics.droppedInGrabber + frameStatistics.droppedInTransfer));
+	latencyText->setText(ofToString((info.uploadTime - info.captureTime) / 1000.0, 1));
+}
+
 void KinectProjector::mousePressed(int x, int y, int button)
 {
 	if (GetCalibrationState() == CALIBRATION_STATE_ROI_MANUAL_DETERMINATION && GetROICalibState() == ROI_CALIBRATION_STATE_INIT)
@@ -665,7 +970,6 @@ void KinectProjector::updateROIFromColorImage()
 
 void KinectProjector::updateROIFromDepthImage()
 {
-	int counter = 0;
 	if (GetROICalibState() == ROI_CALIBRATION_STATE_INIT)
 	{
 		calibModal->setMessage("Enlarging acquisition area & resetting buffers.");
@@ -679,46 +983,27 @@ void KinectProjector::updateROIFromDepthImage()
 		ofLogVerbose("KinectProjector") << "updateROIFromDepthImage(): ROI_CALIBRATION_STATE_READY_TO_MOVE_UP: got a stable depth image";
 		setROICalibState(ROI_CALIBRATION_STATE_MOVE_UP);
 		large = ofPolyline();
-		ofxCvFloatImage temp;
-		temp.setFromPixels(FilteredDepthImage.getFloatPixelsRef().getData(), kinectRes.x, kinectRes.y);
-		temp.setNativeScale(FilteredDepthImage.getNativeScaleMin(), FilteredDepthImage.getNativeScaleMax());
-		temp.convertToRange(0, 1);
-		thresholdedImage.setFromPixels(temp.getFloatPixelsRef());
-		threshold = 0; // We go from the higher distance to the kinect (lower position) to the lower distance
+
+		// The walls are searched on a copy of the depth image so the UI keeps running
+		vector<unsigned char> levels(kinectRes.x * kinectRes.y);
+		SandboxWallDetector::quantise(FilteredDepthImage.getFloatPixelsRef().getData(), levels.size(),
+			FilteredDepthImage.getNativeScaleMin(), FilteredDepthImage.getNativeScaleMax(), levels.data());
+		int width = kinectRes.x;
+		int height = kinectRes.y;
+		ofVec2f seed(kinectRes.x / 2, kinectRes.y / 2);
+		wallDetection = std::async(std::launch::async, [levels, width, height, seed]() {
+			return SandboxWallDetector::detect(levels, width, height, seed);
+		});
 	}
 	else if (GetROICalibState() == ROI_CALIBRATION_STATE_MOVE_UP)
 	{
-		ofLogVerbose("KinectProjector") << "updateROIFromDepthImage(): ROI_CALIBRATION_STATE_MOVE_UP";
-		while (threshold < 255)
-		{
-			cvThreshold(thresholdedImage.getCvImage(), thresholdedImage.getCvImage(), 255 - threshold, 255, CV_THRESH_TOZERO_INV);
-			thresholdedImage.updateTexture();
-			//			SaveDepthDebugImageNative(thresholdedImage, counter++);
-			contourFinder.findContours(thresholdedImage, 12, kinectRes.x * kinectRes.y, 5, true, false);
-			ofPolyline small = ofPolyline();
-			for (int i = 0; i < contourFinder.nBlobs; i++)
-			{
-				ofxCvBlob blobContour = contourFinder.blobs[i];
-				if (blobContour.hole)
-				{
-					ofPolyline poly = ofPolyline(blobContour.pts);
-					if (poly.inside(kinectRes.x / 2, kinectRes.y / 2))
-					{
-						if (small.size() == 0 || poly.getArea() < small.getArea())
-						{
-							small = poly;
-						}
-					}
-				}
-			}
-			if (large.getArea() < small.getArea())
-			{
-				ofLogVerbose("KinectProjector") << "updateROIFromDepthImage(): updating ROI";
-				large = small;
-			}
-			threshold += 1;
-		}
-		if (large.getArea() == 0)
+		if (!wallDetection.valid() || wallDetection.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			return;
+
+		SandboxWalls walls = wallDetection.get();
+		ofLogVerbose("KinectProjector") << "updateROIFromDepthImage(): ROI_CALIBRATION_STATE_MOVE_UP: walls found: " << walls.found << " level: " << walls.level << " area: " << walls.area;
+		large = walls.contour;
+		if (!walls.found)
 		{
 			ofLogVerbose("KinectProjector") << "Calibration failed: The sandbox walls could not be found";
 			calibModal->hide();
@@ -732,7 +1017,7 @@ void KinectProjector::updateROIFromDepthImage()
 		}
 		else
 		{
-			kinectROI = large.getBoundingBox();
+			kinectROI = walls.boundingBox;
 			//            insideROIPoly = large.getResampledBySpacing(10);
 			kinectROI.standardize();
 			calibModal->setMessage("Sand area successfully detected");
@@ -755,7 +1040,7 @@ void KinectProjector::updateROIFromDepthImage()
 
 void KinectProjector::updateROIFromFile()
 {
-	string settingsFile = "settings/kinectProjectorSettings.xml";
+	string settingsFile = settingsDir + "kinectProjectorSettings.xml";
 
 	ofXml xml;
 	if (xml.load(settingsFile))
@@ -896,18 +1181,69 @@ void KinectProjector::updateProjKinectAutoCalibration()
 		autoCalibPts[8] = ofPoint(css, projRes.y - css) - sc;			  // Lower left
 		autoCalibPts[9] = ofPoint(css, css) - sc;						  // upper left
 
+		calibBoardSize = chessboardSize;
+		if (multiChessboardCalibration)
+		{
+			// Smaller boards in the center and the four corners. The boards that do not overlap are shown
+			// together: all five on wide projectors, else the center one and then the four corners.
+			// Each board keeps a white border of one square
+			calibBoardSize = min(chessboardSize, static_cast<int>(min(projRes.x, projRes.y) / 2 / (1 + 2.0 / chessboardX)) - 10);
+			float d = calibBoardSize / 2 + calibBoardSize / chessboardX + 5;
+			for (int h = 0; h < 10; h += 5)
+			{
+				autoCalibPts[h + 0] = ofPoint(0, 0);								// Center
+				autoCalibPts[h + 1] = ofPoint(projRes.x - d, d) - sc;				// upper right
+				autoCalibPts[h + 2] = ofPoint(projRes.x - d, projRes.y - d) - sc;	// Lower right
+				autoCalibPts[h + 3] = ofPoint(d, projRes.y - d) - sc;				// Lower left
+				autoCalibPts[h + 4] = ofPoint(d, d) - sc;							// upper left
+			}
+		}
+
 		currentCalibPts = 0;
 		upframe = false;
+		pairsKinect.clear();
+		pairsProjector.clear();
+		kpt->clearPairs();
 		trials = 0;
 		TemporalFrameCounter = 0;
+		calibrationJobPending = false;
+		calibPtDone.assign(10, false);
+		calibSingleBoard = !multiChessboardCalibration;
 
-		ofPoint dispPt = ofPoint(projRes.x / 2, projRes.y / 2) + autoCalibPts[currentCalibPts]; //
-		drawChessboard(dispPt.x, dispPt.y, chessboardSize);										// We can now draw the next chess board
+		if (structuredLightCalibration)
+		{
+			structuredLightPass = 0;
+			startStructuredLightPass();
+			setAutoCalibrationState(AUTOCALIB_STATE_STRUCTURED_LIGHT);
+			return;
+		}
+
+		startNextCalibExposure(); // We can now draw the first chess boards
 
 		setAutoCalibrationState(AUTOCALIB_STATE_NEXT_POINT);
 	}
+	else if (autoCalibState == AUTOCALIB_STATE_STRUCTURED_LIGHT && imageStabilized)
+	{
+		updateStructuredLightCalibration();
+	}
 	else if (autoCalibState == AUTOCALIB_STATE_NEXT_POINT && imageStabilized)
 	{
+		CalibrationResult result;
+		while (calibrationWorker.results.tryReceive(result))
+		{
+			if (result.generation != chessboardGeneration)
+			{
+				ofLogVerbose("KinectProjector") << "autoCalib(): Dropping result for a chessboard that has moved";
+				continue;
+			}
+			calibrationJobPending = false;
+			handleChessboardResult(result);
+			TemporalFrameCounter = 0;
+		}
+		// The chessboard and status keep being drawn while the worker analyses the image
+		if (calibrationJobPending)
+			return;
+
 		if (!(TemporalFrameCounter % 20))
 			ofLogVerbose("KinectProjector") << "autoCalib(): Got frame " + ofToString(TemporalFrameCounter) + " / " + ofToString(TemporalFrameFilter.getBufferSize() + 3) + " for temporal filter";
 
@@ -934,8 +1270,20 @@ void KinectProjector::updateProjKinectAutoCalibration()
 		else
 		{
 			ofLogVerbose("KinectProjector") << "autoCalib(): Calibrating";
-			kpt->calibrate(pairsKinect, pairsProjector);
+			// The point pairs were added to the solver as they were acquired
+			if (!kpt->calibrate())
+			{
+				ofLogVerbose("KinectProjector") << "autoCalib(): No consistent projection found in the point pairs";
+				setProjKinectCalibrated(false);
+				projKinectCalibrationUpdated = false;
+				setApplicationState(APPLICATION_STATE_SETUP);
+				calibrationText = "Calibration failed - inconsistent points";
+				updateStatusGUI();
+				return;
+			}
 			kinectProjMatrix = kpt->getProjectionMatrix();
+			projKinectLUTDirty = true;
+			ofLogVerbose("KinectProjector") << "autoCalib(): " << kpt->getNumInliers() << " of " << kpt->getNumPairs() << " point pairs used";
 
 			double ReprojectionError = ComputeReprojectionError(DumpDebugFiles);
 			ofLogVerbose("KinectProjector") << "autoCalib(): ReprojectionError " + ofToString(ReprojectionError);
@@ -960,7 +1308,7 @@ void KinectProjector::updateProjKinectAutoCalibration()
 			calibrationText = "Calibration successful";
 			
 			//saveCalibrationAndSettings(); // Already done in updateROIFromCalibration
-			if (kpt->saveCalibration("settings/calibration.xml"))
+			if (kpt->saveCalibration(settingsDir + "calibration.xml"))
 			{
 				ofLogVerbose("KinectProjector") << "update(): initialisation: Calibration saved ";
 			}
@@ -988,9 +1336,15 @@ double KinectProjector::ComputeReprojectionError(bool WriteFile)
 	std::string oErrors = ofToDataPath(DebugFileOutDir + "CalibrationReprojectionErrors_" + GetTimeAndDateString() + ".txt");
 
 	double PError = 0;
+	int nInliers = 0;
 
+	// Pairs rejected as outliers by the calibration solver are not counted
 	for (int i = 0; i < pairsKinect.size(); i++)
 	{
+		if (i < kpt->getNumPairs() && !kpt->isInlier(i))
+			continue;
+		nInliers++;
+
 		ofVec4f wc = pairsKinect[i];
 		wc.w = 1;
 
@@ -1002,7 +1356,8 @@ double KinectProjector::ComputeReprojectionError(bool WriteFile)
 
 		PError += D;
 	}
-	PError /= (double)pairsKinect.size();
+	if (nInliers > 0)
+		PError /= (double)nInliers;
 
 	if (WriteFile)
 	{
@@ -1020,7 +1375,8 @@ double KinectProjector::ComputeReprojectionError(bool WriteFile)
 			double D = sqrt((projectedPoint.x - projP.x) * (projectedPoint.x - projP.x) + (projectedPoint.y - projP.y) * (projectedPoint.y - projP.y));
 
 			fost2 << wc.x << ", " << wc.y << ", " << wc.z << ", "
-				  << projP.x << ", " << projP.y << ", " << projectedPoint.x << ", " << projectedPoint.y << ", " << D << std::endl;
+				  << projP.x << ", " << projP.y << ", " << projectedPoint.x << ", " << projectedPoint.y << ", " << D << ", "
+				  << (i < kpt->getNumPairs() && kpt->isInlier(i)) << std::endl;
 		}
 	}
 
@@ -1042,126 +1398,325 @@ void KinectProjector::CalibrateNextPoint()
 			updateStatusGUI();
 		}
 
-		// Current RGB frame - probably with rolling shutter problems
-		cvRgbImage = ofxCv::toCv(kinectColorImage.getPixels());
-
-		ofxCvGrayscaleImage tempImage;
+		// The image analysis is done by the calibration worker, see handleChessboardResult()
+		CheckAndNormalizeKinectROI();
+		CalibrationJob job;
+		job.generation = chessboardGeneration;
+		job.projectorCorners = exposureProjectorPoints;
+		job.ROI = kinectROI;
+		job.patternSize = cv::Size(chessboardX - 1, chessboardY - 1);
 		if (TemporalFilteringType == 0)
-			tempImage.setFromPixels(TemporalFrameFilter.getMedianFilteredImage(), kinectColorImage.width, kinectColorImage.height);
+			job.grayImage.setFromPixels(TemporalFrameFilter.getMedianFilteredImage(), kinectColorImage.width, kinectColorImage.height, OF_IMAGE_GRAYSCALE);
 		if (TemporalFilteringType == 1)
-			tempImage.setFromPixels(TemporalFrameFilter.getAverageFilteredColImage(), kinectColorImage.width, kinectColorImage.height);
-
-		ProcessChessBoardInput(tempImage);
-
+			job.grayImage.setFromPixels(TemporalFrameFilter.getAverageFilteredColImage(), kinectColorImage.width, kinectColorImage.height, OF_IMAGE_GRAYSCALE);
 		if (DumpDebugFiles)
 		{
-			std::string tname = DebugFileOutDir + "ChessboardImage_" + GetTimeAndDateString() + "_" + ofToString(currentCalibPts) + "_try_" + ofToString(trials) + ".png";
-			ofSaveImage(tempImage.getPixels(), tname);
+			job.colorImage = kinectColorImage.getPixels();
+			job.debugDir = DebugFileOutDir;
+			job.debugName = GetTimeAndDateString() + "_" + ofToString(currentCalibPts) + "_try_" + ofToString(trials);
 		}
+		calibrationJobPending = true;
+		calibrationWorker.analyse(job);
+	}
+	else
+	{
+		if (upframe)
+		{ // We are done
+			calibrationText = "Updating acquisition ceiling";
+			updateMaxOffset(); // Find max offset
+			setAutoCalibrationState(AUTOCALIB_STATE_COMPUTE);
+			updateStatusGUI();
+		}
+		else
+		{ // We ask for higher points
+			calibModal->hide();
+			setConfirmModalState(CONFIRM_MODAL_OPENED);
+			setConfirmModalMessage("COVER_SANDBOX_WITH_BOARD");
+			// confirmModal->setMessage("Please cover the sandbox with a board and press ok.");
+		}
+	}
+}
 
-		cvGrayImage = ofxCv::toCv(tempImage.getPixels());
+// Draw the chessboards of the next calibration positions of the current height (low: 0-4, high: 5-9).
+// In multiple chessboard mode all the positions whose boards do not overlap are shown at once
+void KinectProjector::startNextCalibExposure()
+{
+	int first = currentCalibPts < 5 ? 0 : 5;
 
-		cv::Rect tempROI((int)kinectROI.x, (int)kinectROI.y, (int)kinectROI.width, (int)kinectROI.height);
-		cv::Mat cvGrayROI = cvGrayImage(tempROI);
+	// Keep a white border of one square around each board
+	float border = calibBoardSize / chessboardX;
+	vector<ofRectangle> boards;
+	vector<ofPoint> centers;
+	calibExposure.clear();
+	for (int p = first; p < first + 5; p++)
+	{
+		if (calibPtDone[p])
+			continue;
+		ofPoint center = ofPoint(projRes.x / 2, projRes.y / 2) + autoCalibPts[p];
+		ofRectangle board;
+		board.setFromCenter(center, calibBoardSize + 2 * border, calibBoardSize + 2 * border);
+		bool overlaps = false;
+		for (auto & r : boards)
+			overlaps |= r.intersects(board);
+		if (!calibExposure.empty() && (calibSingleBoard || overlaps))
+			continue;
+		calibExposure.push_back(p);
+		boards.push_back(board);
+		centers.push_back(center);
+	}
+	if (calibExposure.empty())
+		return;
 
-		cv::Size patternSize = cv::Size(chessboardX - 1, chessboardY - 1);
-		//	int chessFlags = cv::CALIB_CB_ADAPTIVE_THRESH + cv::CALIB_CB_FAST_CHECK;
-		int chessFlags = 0;
+	ofLogVerbose("KinectProjector") << "startNextCalibExposure(): Showing " << calibExposure.size() << " chessboards";
+	drawChessboards(centers, calibBoardSize);
+}
 
-		//bool foundChessboard = findChessboardCorners(cvGrayImage, patternSize, cvPoints, chessFlags);
-		bool foundChessboard = findChessboardCorners(cvGrayROI, patternSize, cvPoints, chessFlags);
+void KinectProjector::handleChessboardResult(CalibrationResult &result)
+{
+	cv::Size patternSize = cv::Size(chessboardX - 1, chessboardY - 1);
+	bool progress = false;
+	bool drawn = false;
+	int acquired = currentCalibPts;
+	vector<int> missing;
+	vector<float> moveFactor;
 
-		if (!foundChessboard)
+	// Changed logic so the "cleared" flag is not used - we do a long frame average instead
+	for (int b = 0; b < calibExposure.size(); b++)
+	{
+		int pos = calibExposure[b];
+		if (b >= result.boards.size() || result.boards[b].empty())
 		{
-			int chessFlags = cv::CALIB_CB_ADAPTIVE_THRESH + cv::CALIB_CB_FAST_CHECK;
-			foundChessboard = findChessboardCorners(cvGrayROI, patternSize, cvPoints, chessFlags);
+			// We cannot find the chessboard
+			missing.push_back(pos);
+			moveFactor.push_back(3.0 / 4.0);
+			continue;
 		}
+		cvPoints = result.boards[b];
+		currentProjectorPoints = exposureProjectorPoints[b];
 
-		// Changed logic so the "cleared" flag is not used - we do a long frame average instead
-		if (foundChessboard)
+		// Current RGB frame - probably with rolling shutter problems
+		if (!drawn)
+			cvRgbImage = ofxCv::toCv(kinectColorImage.getPixels());
+		drawChessboardCorners(cvRgbImage, patternSize, cv::Mat(cvPoints), true);
+		drawn = true;
+
+		ofLogVerbose("KinectProjector") << "autoCalib(): Chessboard found for point :" << pos;
+		if (addPointPair())
 		{
-			for (int i = 0; i < cvPoints.size(); i++)
-			{
-				cvPoints[i].x += tempROI.x;
-				cvPoints[i].y += tempROI.y;
-			}
+			calibPtDone[pos] = true;
+			currentCalibPts++;
+			progress = true;
+		}
+		else
+		{
+			// We cannot get all depth points for the chessboard
+			missing.push_back(pos);
+			moveFactor.push_back(4.0 / 5.0);
+		}
+	}
+	if (drawn)
+	{
+		kinectColorImage.updateTexture();
+		fboMainWindow.begin();
+		kinectColorImage.draw(0, 0);
+		fboMainWindow.end();
+	}
 
-			cornerSubPix(cvGrayImage, cvPoints, cv::Size(2, 2), cv::Size(-1, -1), // Rasmus: changed search size to 2 from 11 - since this caused false findings
-						 cv::TermCriteria(CV_TERMCRIT_EPS + CV_TERMCRIT_ITER, 30, 0.1));
+	bool moved = false;
+	if (progress)
+	{
+		trials = 0;
+		if (acquired < 5 && currentCalibPts >= 5)
+			calibSingleBoard = !multiChessboardCalibration; // The high positions start again with several boards
+	}
+	else
+	{
+		trials++;
+		ofLogVerbose("KinectProjector") << "autoCalib(): " << missing.size() << " chessboards not found on trial : " << trials;
+		if (trials > 3)
+		{
+			// Move the chessboards closer to the center of the screen and show them one at a time
+			ofLogVerbose("KinectProjector") << "autoCalib(): Chessboard could not be found moving chessboard closer to center ";
+			for (int i = 0; i < missing.size(); i++)
+				autoCalibPts[missing[i]] = moveFactor[i] * autoCalibPts[missing[i]];
+			calibSingleBoard = true;
+			trials = 0;
+			moved = true;
+		}
+	}
+	if (progress || moved)
+		startNextCalibExposure(); // We can now draw the next chess boards
+}
 
-			drawChessboardCorners(cvRgbImage, patternSize, cv::Mat(cvPoints), foundChessboard);
+// Project every pattern of a structured light pass from the first one
+void KinectProjector::startStructuredLightPass()
+{
+	if (structuredLightDecoding.valid())
+		structuredLightDecoding.get(); // Result of an aborted calibration
+	structuredLight.setup(projRes.x, projRes.y);
+	structuredLightPattern = 0;
+	structuredLightFrames = 0;
+	structuredLightCaptures.clear();
+	TemporalFrameCounter = 0;
+	drawStructuredLightPattern(0);
+}
 
-			if (DumpDebugFiles)
-			{
-				std::string tname = DebugFileOutDir + "FoundChessboard_" + GetTimeAndDateString() + "_" + ofToString(currentCalibPts) + "_try_" + ofToString(trials) + ".png";
-				ofSaveImage(kinectColorImage.getPixels(), tname);
-			}
+void KinectProjector::drawStructuredLightPattern(int index)
+{
+	calibrationText = string("Structured light (") + (structuredLightPass == 0 ? "low" : "high") + ") pattern " + std::to_string(index + 1) + "/" + std::to_string(structuredLight.getNumPatterns());
+	updateStatusGUI();
 
-			kinectColorImage.updateTexture();
-			fboMainWindow.begin();
-			kinectColorImage.draw(0, 0);
-			fboMainWindow.end();
+	ofPixels pattern;
+	structuredLight.getPattern(index, pattern);
+	structuredLightImage.setFromPixels(pattern);
+	// Each pattern pixel has to cover exactly one projector column or row
+	structuredLightImage.getTexture().setTextureMinMagFilter(GL_NEAREST, GL_NEAREST);
 
-			ofLogVerbose("KinectProjector") << "autoCalib(): Chessboard found for point :" << currentCalibPts;
-			bool okchess = addPointPair();
+	fboProjWindow.begin();
+	ofBackground(0);
+	ofSetColor(255);
+	structuredLightImage.draw(0, 0, projRes.x, projRes.y);
+	fboProjWindow.end();
+}
 
-			if (okchess)
-			{
-				trials = 0;
-				currentCalibPts++;
-				ofPoint dispPt = ofPoint(projRes.x / 2, projRes.y / 2) + autoCalibPts[currentCalibPts]; // Compute next chessboard position
-				drawChessboard(dispPt.x, dispPt.y, chessboardSize);										// We can now draw the next chess board
-			}
-			else
-			{
-				// We cannot get all depth points for the chessboard
-				trials++;
-				ofLogVerbose("KinectProjector") << "autoCalib(): Depth points of chessboard not allfound on trial : " << trials;
-				if (trials > 3)
-				{
-					// Move the chessboard closer to the center of the screen
-					ofLogVerbose("KinectProjector") << "autoCalib(): Chessboard could not be found moving chessboard closer to center ";
-					autoCalibPts[currentCalibPts] = 4 * autoCalibPts[currentCalibPts] / 5;
-					ofPoint dispPt = ofPoint(projRes.x / 2, projRes.y / 2) + autoCalibPts[currentCalibPts]; // Compute next chessboard position
-					drawChessboard(dispPt.x, dispPt.y, chessboardSize);										// We can now draw the next chess board
-					trials = 0;
-				}
-			}
-		}
-		else
-		{
-			// We cannot find the chessboard
-			trials++;
-			ofLogVerbose("KinectProjector") << "autoCalib(): Chessboard not found on trial : " << trials;
-			if (trials > 3)
-			{
-				// Move the chessboard closer to the center of the screen
-				ofLogVerbose("KinectProjector") << "autoCalib(): Chessboard could not be found moving chessboard closer to center ";
-				autoCalibPts[currentCalibPts] = 3 * autoCalibPts[currentCalibPts] / 4;
+void KinectProjector::updateStructuredLightCalibration()
+{
+	// Frames skipped after drawing a pattern (projector and kinect latency) then averaged
+	const int settleFrames = 15;
+	const int averageFrames = 8;
+	// Below this standard deviation of the elevation the points are too close to a plane
+	const float minRelief = 20;
 
-				ofPoint dispPt = ofPoint(projRes.x / 2, projRes.y / 2) + autoCalibPts[currentCalibPts]; // Compute next chessboard position
-				drawChessboard(dispPt.x, dispPt.y, chessboardSize);										// We can now draw the next chess board
-				trials = 0;
-			}
-		}
-	}
-	else
+	if (structuredLightDecoding.valid())
 	{
-		if (upframe)
-		{ // We are done
-			calibrationText = "Updating acquisition ceiling";
-			updateMaxOffset(); // Find max offset
-			setAutoCalibrationState(AUTOCALIB_STATE_COMPUTE);
+		if (structuredLightDecoding.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			return;
+		StructuredLightDecoding decoding = structuredLightDecoding.get();
+		float relief = 0;
+		int added = addStructuredLightPairs(decoding, relief);
+		ofLogVerbose("KinectProjector") << "updateStructuredLightCalibration(): Added " << added << " point pairs, elevation deviation " << relief;
+		if (added < 100)
+		{
+			updateKinectGrabberROI(kinectROI);
+			kinectgrabber.performInThread([this](KinectGrabber &kg) {
+				kg.setMaxOffset(this->maxOffset);
+			});
+			setApplicationState(APPLICATION_STATE_SETUP);
+			calibrationText = "Calibration failed - structured light not decoded";
 			updateStatusGUI();
+			return;
 		}
-		else
-		{ // We ask for higher points
+		if (structuredLightPass == 0 && relief < minRelief)
+		{
+			// Same as the chessboard calibration: we ask for higher points
 			calibModal->hide();
 			setConfirmModalState(CONFIRM_MODAL_OPENED);
 			setConfirmModalMessage("COVER_SANDBOX_WITH_BOARD");
-			// confirmModal->setMessage("Please cover the sandbox with a board and press ok.");
+			return;
+		}
+		calibrationText = "Updating acquisition ceiling";
+		updateMaxOffset(); // Find max offset
+		setAutoCalibrationState(AUTOCALIB_STATE_COMPUTE);
+		updateStatusGUI();
+		return;
+	}
+
+	if (structuredLightPattern >= structuredLight.getNumPatterns())
+	{
+		// Waiting for the board to be placed
+		if (upframe && structuredLightPass == 0)
+		{
+			structuredLightPass = 1;
+			startStructuredLightPass();
 		}
+		return;
 	}
+
+	if (TemporalFrameCounter++ < settleFrames)
+		return;
+
+	cv::Mat gray;
+	cv::cvtColor(ofxCv::toCv(kinectColorImage.getPixels()), gray, CV_RGB2GRAY);
+	if (structuredLightFrames == 0)
+		structuredLightSum = cv::Mat::zeros(gray.size(), CV_32F);
+	cv::accumulate(gray, structuredLightSum);
+	if (++structuredLightFrames < averageFrames)
+		return;
+
+	cv::Mat capture;
+	structuredLightSum.convertTo(capture, CV_8U, 1.0 / structuredLightFrames);
+	structuredLightCaptures.push_back(capture);
+	structuredLightFrames = 0;
+	TemporalFrameCounter = 0;
+	if (++structuredLightPattern < structuredLight.getNumPatterns())
+	{
+		drawStructuredLightPattern(structuredLightPattern);
+		return;
+	}
+
+	// All the patterns are captured, decode them without blocking the application
+	calibrationText = "Decoding structured light";
+	updateStatusGUI();
+	fboProjWindow.begin();
+	ofBackground(255);
+	fboProjWindow.end();
+
+	StructuredLightCoder coder = structuredLight;
+	vector<cv::Mat> captures;
+	captures.swap(structuredLightCaptures);
+	structuredLightDecoding = std::async(std::launch::async, [coder, captures]() {
+		uint64_t start = ofGetElapsedTimeMillis();
+		StructuredLightDecoding decoding = coder.decode(captures);
+		ofLogVerbose("KinectProjector") << "updateStructuredLightCalibration(): Decoded " << decoding.numValid << " pixels in " << ofGetElapsedTimeMillis() - start << " ms";
+		return decoding;
+	});
+}
+
+// Add a point pair for the kinect pixels of the ROI that saw a decoded projector position.
+// relief is the standard deviation of the elevation of the added points
+int KinectProjector::addStructuredLightPairs(const StructuredLightDecoding& decoding, float& relief)
+{
+	// One pair every few pixels is plenty for the solver
+	const int step = 4;
+	int added = 0;
+	double sum = 0, sum2 = 0;
+	relief = 0;
+	if (decoding.numValid == 0)
+		return 0;
+
+	kpt->beginAcquisition();
+	int maxX = min(static_cast<int>(kinectROI.getMaxX()), decoding.valid.cols);
+	int maxY = min(static_cast<int>(kinectROI.getMaxY()), decoding.valid.rows);
+	for (int y = max(0, static_cast<int>(kinectROI.getMinY())); y < maxY; y += step)
+	{
+		for (int x = max(0, static_cast<int>(kinectROI.getMinX())); x < maxX; x += step)
+		{
+			if (!decoding.valid.at<unsigned char>(y, x))
+				continue;
+			ofVec3f worldPoint = kinectCoordToWorldCoord(x, y);
+			if (worldPoint.z <= 0)
+				continue;
+			ofVec2f projectorPoint(decoding.projX.at<float>(y, x), decoding.projY.at<float>(y, x));
+			pairsKinect.push_back(worldPoint);
+			pairsProjector.push_back(projectorPoint);
+			kpt->addPair(worldPoint, projectorPoint);
+
+			double elevation = -basePlaneEq.dot(ofVec4f(worldPoint.x, worldPoint.y, worldPoint.z, 1));
+			sum += elevation;
+			sum2 += elevation * elevation;
+			added++;
+		}
+	}
+	if (added > 0)
+	{
+		double mean = sum / added;
+		relief = sqrt(max(0.0, sum2 / added - mean * mean));
+	}
+	if (DumpDebugFiles)
+	{
+		savePointPair();
+	}
+	return added;
 }
 
 //TODO: Add manual Prj Kinect calibration
@@ -1202,24 +1757,20 @@ void KinectProjector::updateBasePlane()
 		ofLogVerbose("KinectProjector") << "updateBasePlane(): smallROI is null, cannot compute base plane normal";
 		return;
 	}
-	ofVec4f pt;
-	ofVec3f *points;
-	points = new ofVec3f[sw * sh];
 	ofLogVerbose("KinectProjector") << "updateBasePlane(): Computing points in smallROI : " << sw * sh;
-	for (int x = 0; x < sw; x++)
-	{
-		for (int y = 0; y < sh; y++)
-		{
-			points[x + y * sw] = kinectCoordToWorldCoord(x + sl, y + st);
-		}
-	}
-	ofLogVerbose("KinectProjector") << "updateBasePlane(): Computing plane from points";
-	basePlaneEq = plane_from_points(points, sw * sh);
-	if (basePlaneEq.x == 0 && basePlaneEq.y == 0 && basePlaneEq.z == 0)
+	collectPlanePoints(smallROI, 2, planePoints);
+	planeEstimator.clear();
+	for (auto & p : planePoints)
+		planeEstimator.addPoint(p.x, p.y, p.z, p.w);
+
+	ofLogVerbose("KinectProjector") << "updateBasePlane(): Computing plane from " << planePoints.size() << " points";
+	ofVec4f planeEq;
+	if (!planeEstimator.estimate(planeEq))
 	{
-		ofLogVerbose("KinectProjector") << "updateBasePlane(): plane_from_points could not compute basePlane";
+		ofLogVerbose("KinectProjector") << "updateBasePlane(): could not compute basePlane";
 		return;
 	}
+	basePlaneEq = planeEq;
 
 	basePlaneNormal = ofVec3f(basePlaneEq);
 	basePlaneOffset = ofVec3f(0, 0, -basePlaneEq.w);
@@ -1245,19 +1796,19 @@ void KinectProjector::updateMaxOffset()
 		ofLogVerbose("KinectProjector") << "updateMaxOffset(): smallROI is null, cannot compute base plane normal";
 		return;
 	}
-	ofVec4f pt;
-	ofVec3f *points;
-	points = new ofVec3f[sw * sh];
 	ofLogVerbose("KinectProjector") << "updateMaxOffset(): Computing points in smallROI : " << sw * sh;
-	for (int x = 0; x < sw; x++)
+	collectPlanePoints(smallROI, 2, planePoints);
+	planeEstimator.clear();
+	for (auto & p : planePoints)
+		planeEstimator.addPoint(p.x, p.y, p.z, p.w);
+
+	ofLogVerbose("KinectProjector") << "updateMaxOffset(): Computing plane from " << planePoints.size() << " points";
+	ofVec4f eqoff;
+	if (!planeEstimator.estimate(eqoff))
 	{
-		for (int y = 0; y < sh; y++)
-		{
-			points[x + y * sw] = kinectCoordToWorldCoord(x + sl, y + st); //vertexCcvertexCc;
-		}
+		ofLogVerbose("KinectProjector") << "updateMaxOffset(): could not compute plane";
+		return;
 	}
-	ofLogVerbose("KinectProjector") << "updateMaxOffset(): Computing plane from points";
-	ofVec4f eqoff = plane_from_points(points, sw * sh);
 	maxOffset = -eqoff.w - maxOffsetSafeRange;
 	maxOffsetBack = maxOffset;
 	// Update max Offset
@@ -1267,6 +1818,100 @@ void KinectProjector::updateMaxOffset()
 	});
 }
 
+void KinectProjector::collectPlanePoints(ofRectangle area, int step, vector<ofVec4f> &points)
+{
+	points.clear();
+	area = area.getIntersection(ofRectangle(0, 0, kinectRes.x, kinectRes.y));
+	int sw = static_cast<int>(area.width);
+	int sl = static_cast<int>(area.getLeft());
+	int st = static_cast<int>(area.getTop());
+	int sb = static_cast<int>(area.getBottom());
+	if (sw <= 0)
+		return;
+
+	const float *depth = FilteredDepthImage.getFloatPixelsRef().getData();
+	batchX.resize(sw);
+	batchY.resize(sw);
+	batchZ.resize(sw);
+	for (int y = st; y < sb; y += step)
+	{
+		kinectRowToWorldCoord(sl, y, sw, batchX.data(), batchY.data(), batchZ.data());
+		for (int x = 0; x < sw; x += step)
+		{
+			float z = depth[y * static_cast<int>(kinectRes.x) + sl + x];
+			if (z <= 0 || z >= 4000) // No data or not yet initialised by the grabber
+				continue;
+
+			// The depth noise of the kinect grows with the square of the distance
+			float weight = (1000.0f / z) * (1000.0f / z);
+			points.push_back(ofVec4f(batchX[x], batchY[x], batchZ[x], weight));
+		}
+	}
+}
+
+void KinectProjector::updateSeaLevelMonitor()
+{
+	SeaLevelCheck check;
+	if (seaLevelMonitor.results.tryReceive(check))
+		checkSeaLevelDrift(check);
+
+	if (GetApplicationState() != APPLICATION_STATE_RUNNING || !basePlaneComputed)
+		return;
+
+	float now = ofGetElapsedTimef();
+	if (now - lastSeaLevelCheck < seaLevelCheckInterval)
+		return;
+
+	ofRectangle smallROI = kinectROI;
+	smallROI.scaleFromCenter(0.75);
+	vector<ofVec4f> points;
+	collectPlanePoints(smallROI, 4, points);
+	if (seaLevelMonitor.requestCheck(points))
+		lastSeaLevelCheck = now;
+}
+
+void KinectProjector::checkSeaLevelDrift(SeaLevelCheck &check)
+{
+	// Too much of the sand has been moved to see the sea level plane
+	if (!check.valid || check.inlierRatio < 0.3)
+		return;
+
+	// Compare with the calibrated plane, not including the users tilt and offset adjustments
+	ofVec4f calibratedEq = getPlaneEquation(basePlaneOffsetBack, basePlaneNormalBack);
+	ofVec3f calibratedNormal(calibratedEq);
+	ofVec3f measuredNormal(check.planeEq);
+	float angle = ofRadToDeg(acos(ofClamp(calibratedNormal.dot(measuredNormal), -1, 1)));
+
+	// Elevation of the measured plane where the ray through the ROI centre hits it
+	ofVec3f ray = rayTable.getRay(kinectROI.getCenter().x, kinectROI.getCenter().y);
+	float denom = measuredNormal.dot(ray);
+	if (denom == 0)
+		return;
+	ofVec4f p = ray * (-check.planeEq.w / denom);
+	p.w = 1;
+	float offset = -calibratedEq.dot(p);
+
+	if (angle > seaLevelAngleTolerance || fabs(offset) > seaLevelOffsetTolerance)
+		seaLevelDriftCount++;
+	else
+		seaLevelDriftCount = 0;
+
+	ofLogVerbose("KinectProjector") << "checkSeaLevelDrift(): angle " << angle << " offset " << offset << " inliers " << check.inlierRatio << " drift count " << seaLevelDriftCount;
+
+	// Only report once per drift and only when it is seen several times in a row
+	if (seaLevelDriftCount == 3)
+	{
+		ofLogWarning("KinectProjector") << "checkSeaLevelDrift(): The sea level has drifted - angle " << angle << " deg, offset " << offset << " mm. Please recalibrate";
+		SeaLevelDriftEventArgs args;
+		args.calibratedPlane = calibratedEq;
+		args.measuredPlane = check.planeEq;
+		args.angle = angle;
+		args.offset = offset;
+		ofNotifyEvent(seaLevelDriftEvent, args, this);
+		updateErrorEvent("SEA_LEVEL_DRIFT");
+	}
+}
+
 bool KinectProjector::addPointPair()
 {
 	bool okchess = true;
@@ -1281,11 +1926,13 @@ bool KinectProjector::addPointPair()
 	}
 	if (nDepthPoints == (chessboardX - 1) * (chessboardY - 1))
 	{
+		kpt->beginAcquisition();
 		for (int i = 0; i < cvPoints.size(); i++)
 		{
 			ofVec3f worldPoint = kinectCoordToWorldCoord(cvPoints[i].x, cvPoints[i].y);
 			pairsKinect.push_back(worldPoint);
 			pairsProjector.push_back(currentProjectorPoints[i]);
+			kpt->addPair(worldPoint, currentProjectorPoints[i]);
 		}
 		resultMessage = "addPointPair(): Added " + ofToString((chessboardX - 1) * (chessboardY - 1)) + " points pairs.";
 		if (DumpDebugFiles)
@@ -1316,6 +1963,7 @@ void KinectProjector::askToFlattenSand()
 void KinectProjector::drawProjectorWindow()
 {
 	fboProjWindow.draw(0, 0);
+	framePacer.displayed(ofGetElapsedTimeMicros());
 }
 
 void KinectProjector::drawMainWindow(float x, float y, float width, float height)
@@ -1339,36 +1987,50 @@ void KinectProjector::drawMainWindow(float x, float y, float width, float height
 }
 
 void KinectProjector::drawChessboard(int x, int y, int chessboardSize)
+{
+	drawChessboards(vector<ofPoint>(1, ofPoint(x, y)), chessboardSize);
+}
+
+void KinectProjector::drawChessboards(const vector<ofPoint>& centers, int chessboardSize)
 {
 	fboProjWindow.begin();
 	ofFill();
-	// Draw the calibration chess board on the projector window
+	// Draw the calibration chess boards on the projector window
 	float w = chessboardSize / chessboardX;
 	float h = chessboardSize / chessboardY;
 
-	float xf = x - chessboardSize / 2; // x and y are chess board center size
-	float yf = y - chessboardSize / 2;
-
-	currentProjectorPoints.clear();
+	exposureProjectorPoints.clear();
+	chessboardGeneration++; // Pending calibration results are for the previous boards
 
 	ofClear(255, 255, 255, 0);
 	ofBackground(255);
 	ofSetColor(0);
-	ofTranslate(xf, yf);
-	for (int j = 0; j < chessboardY; j++)
+	for (auto & center : centers)
 	{
-		for (int i = 0; i < chessboardX; i++)
+		float xf = center.x - chessboardSize / 2; // x and y are chess board center size
+		float yf = center.y - chessboardSize / 2;
+		vector<ofVec2f> points;
+
+		ofPushMatrix();
+		ofTranslate(xf, yf);
+		for (int j = 0; j < chessboardY; j++)
 		{
-			int x0 = ofMap(i, 0, chessboardX, 0, chessboardSize);
-			int y0 = ofMap(j, 0, chessboardY, 0, chessboardSize);
-			if (j > 0 && i > 0)
+			for (int i = 0; i < chessboardX; i++)
 			{
-				currentProjectorPoints.push_back(ofVec2f(xf + x0, yf + y0));
+				int x0 = ofMap(i, 0, chessboardX, 0, chessboardSize);
+				int y0 = ofMap(j, 0, chessboardY, 0, chessboardSize);
+				if (j > 0 && i > 0)
+				{
+					points.push_back(ofVec2f(xf + x0, yf + y0));
+				}
+				if ((i + j) % 2 == 0)
+					ofDrawRectangle(x0, y0, w, h);
 			}
-			if ((i + j) % 2 == 0)
-				ofDrawRectangle(x0, y0, w, h);
 		}
+		ofPopMatrix();
+		exposureProjectorPoints.push_back(points);
 	}
+	currentProjectorPoints = exposureProjectorPoints.empty() ? vector<ofVec2f>() : exposureProjectorPoints[0];
 	ofSetColor(255);
 	fboProjWindow.end();
 }
@@ -1414,6 +2076,9 @@ void KinectProjector::drawArrow(ofVec2f projectedPoint, ofVec2f v1)
 void KinectProjector::updateNativeScale(float scaleMin, float scaleMax)
 {
 	FilteredDepthImage.setNativeScale(scaleMin, scaleMax);
+	DisplayDepthImage.setNativeScale(scaleMin, scaleMax);
+	displayDepthReady = false;
+	depthScaleChanged = true;
 }
 
 ofVec2f KinectProjector::kinectCoordToProjCoord(float x, float y) // x, y in kinect pixel coord
@@ -1423,12 +2088,7 @@ ofVec2f KinectProjector::kinectCoordToProjCoord(float x, float y) // x, y in kin
 
 ofVec2f KinectProjector::kinectCoordToProjCoord(float x, float y, float z)
 {
-	ofVec4f kc = ofVec2f(x, y);
-	kc.z = z;
-	kc.w = 1;
-	ofVec4f wc = kinectWorldMatrix * kc * kc.z;
-
-	return worldCoordToProjCoord(wc);
+	return worldCoordToProjCoord(rayTable.getRay(x, y) * z);
 }
 
 ofVec2f KinectProjector::worldCoordToProjCoord(ofVec3f vin)
@@ -1457,7 +2117,7 @@ ofVec3f KinectProjector::projCoordAndWorldZToWorldCoord(float projX, float projY
 	return ofVec3f(x, y, worldZ);
 }
 
-ofVec3f KinectProjector::kinectCoordToWorldCoord(float x, float y) // x, y in kinect pixel coord
+ofVec2f KinectProjector::clampKinectCoord(float x, float y) const
 {
 	// Simple crash avoidence
 	if (y < 0)
@@ -1468,18 +2128,23 @@ ofVec3f KinectProjector::kinectCoordToWorldCoord(float x, float y) // x, y in ki
 		x = 0;
 	if (x >= kinectRes.x)
 		x = kinectRes.x - 1;
+	return ofVec2f(x, y);
+}
+
+ofVec3f KinectProjector::kinectCoordToWorldCoord(float x, float y) // x, y in kinect pixel coord
+{
+	ofVec2f c = clampKinectCoord(x, y);
+	x = c.x;
+	y = c.y;
 
-	ofVec4f kc = ofVec2f(x, y);
 	int ind = static_cast<int>(y) * kinectRes.x + static_cast<int>(x);
-	kc.z = FilteredDepthImage.getFloatPixelsRef().getData()[ind];
-	//if (kc.z == 0)
+	float z = FilteredDepthImage.getFloatPixelsRef().getData()[ind];
+	//if (z == 0)
 	//	ofLogVerbose("KinectProjector") << "kinectCoordToWorldCoord z coordinate 0";
-	//if (kc.z == 4000)
+	//if (z == 4000)
 	//	ofLogVerbose("KinectProjector") << "kinectCoordToWorldCoord z coordinate 4000 (invalid)";
 
-	kc.w = 1;
-	ofVec4f wc = kinectWorldMatrix * kc * kc.z;
-	return ofVec3f(wc);
+	return rayTable.getRay(x, y) * z;
 }
 
 ofVec2f KinectProjector::worldCoordTokinectCoord(ofVec3f wc)
@@ -1491,10 +2156,8 @@ ofVec2f KinectProjector::worldCoordTokinectCoord(ofVec3f wc)
 
 ofVec3f KinectProjector::RawKinectCoordToWorldCoord(float x, float y) // x, y in kinect pixel coord
 {
-	ofVec4f kc = ofVec3f(x, y, kinectgrabber.getRawDepthAt(static_cast<int>(x), static_cast<int>(y)));
-	kc.w = 1;
-	ofVec4f wc = kinectWorldMatrix * kc * kc.z;
-	return ofVec3f(wc);
+	float z = kinectgrabber.getRawDepthAt(static_cast<int>(x), static_cast<int>(y));
+	return rayTable.getRay(x, y) * z;
 }
 
 float KinectProjector::elevationAtKinectCoord(float x, float y) // x, y in kinect pixel coordinate
@@ -1514,6 +2177,68 @@ float KinectProjector::elevationToKinectDepth(float elevation, float x, float y)
 	return kinectDepth;
 }
 
+void KinectProjector::kinectCoordToWorldCoord(const ofVec2f* kc, int n, ofVec3f* wc)
+{
+	batchDepth.resize(n);
+	batchKinect.resize(n);
+	const float* depth = FilteredDepthImage.getFloatPixelsRef().getData();
+	for (int i = 0; i < n; i++)
+	{
+		// Same clamping as the single point version, for the depth and the ray
+		batchKinect[i] = clampKinectCoord(kc[i].x, kc[i].y);
+		int x = static_cast<int>(batchKinect[i].x);
+		int y = static_cast<int>(batchKinect[i].y);
+		batchDepth[i] = depth[y * static_cast<int>(kinectRes.x) + x];
+	}
+	rayTable.toWorld(batchKinect.data(), batchDepth.data(), n, wc);
+}
+
+void KinectProjector::kinectCoordToProjCoord(const ofVec2f* kc, int n, ofVec2f* pc)
+{
+	batchX.resize(n);
+	batchY.resize(n);
+	batchZ.resize(n);
+	const float* depth = FilteredDepthImage.getFloatPixelsRef().getData();
+	for (int i = 0; i < n; i++)
+	{
+		ofVec2f c = clampKinectCoord(kc[i].x, kc[i].y);
+		float z = depth[static_cast<int>(c.y) * static_cast<int>(kinectRes.x) + static_cast<int>(c.x)];
+		ofVec3f ray = rayTable.getRay(c.x, c.y);
+		batchX[i] = ray.x * z;
+		batchY[i] = ray.y * z;
+		batchZ[i] = ray.z * z;
+	}
+	batchU.resize(n);
+	batchV.resize(n);
+	KinectRayTable::worldToProj(kinectProjMatrix, batchX.data(), batchY.data(), batchZ.data(), n, batchU.data(), batchV.data());
+	for (int i = 0; i < n; i++)
+		pc[i].set(batchU[i], batchV[i]);
+}
+
+void KinectProjector::elevationAtKinectCoord(const ofVec2f* kc, int n, float* elevation)
+{
+	const float* depth = FilteredDepthImage.getFloatPixelsRef().getData();
+	for (int i = 0; i < n; i++)
+	{
+		ofVec2f c = clampKinectCoord(kc[i].x, kc[i].y);
+		float z = depth[static_cast<int>(c.y) * static_cast<int>(kinectRes.x) + static_cast<int>(c.x)];
+		ofVec3f ray = rayTable.getRay(c.x, c.y);
+		elevation[i] = -(basePlaneEq.x * ray.x + basePlaneEq.y * ray.y + basePlaneEq.z * ray.z) * z - basePlaneEq.w;
+	}
+}
+
+void KinectProjector::kinectRowToWorldCoord(int x, int y, int n, float* wx, float* wy, float* wz)
+{
+	const float* depth = FilteredDepthImage.getFloatPixelsRef().getData() + y * static_cast<int>(kinectRes.x) + x;
+	rayTable.toWorld(x, y, n, depth, wx, wy, wz);
+}
+
+void KinectProjector::elevationAtKinectRow(int x, int y, int n, float* elevation)
+{
+	const float* depth = FilteredDepthImage.getFloatPixelsRef().getData() + y * static_cast<int>(kinectRes.x) + x;
+	rayTable.toElevation(x, y, n, depth, basePlaneEq, elevation);
+}
+
 ofVec2f KinectProjector::gradientAtKinectCoord(float x, float y)
 {
 	int ind = static_cast<int>(floor(x / gradFieldResolution)) + gradFieldcols * static_cast<int>(floor(y / gradFieldResolution));
@@ -1529,6 +2254,8 @@ void KinectProjector::setupGui()
 	gui->addBreak();
 	gui->addFRM();
 	fpsKinectText = gui->addTextInput("Kinect FPS", "0");
+	droppedFramesText = gui->addTextInput("Dropped frames", "0");
+	latencyText = gui->addTextInput("Kinect latency (ms)", "0");
 	gui->addBreak();
 
 	auto advancedFolder = gui->addFolder("Advanced", ofColor::purple);
@@ -1540,6 +2267,8 @@ void KinectProjector::setupGui()
 	advancedFolder->addToggle(CMP_INPAINT_OUTLIERS, doInpainting);
 	advancedFolder->addToggle(CMP_FULL_FRAME_FILTERING, doFullFrameFiltering);
 	advancedFolder->addToggle(CMP_QUICK_REACTION, followBigChanges);
+	advancedFolder->addToggle(CMP_DUAL_RATE_FILTERING, dualRateFiltering);
+	advancedFolder->addToggle(CMP_DEPTH_INTERPOLATION, depthInterpolation);
 	advancedFolder->addSlider(CMP_AVERAGING, 1, 40, numAveragingSlots)->setPrecision(0);
 	advancedFolder->addSlider(CMP_TILT_X, -30, 30, tiltX);
 	advancedFolder->addSlider(CMP_TILT_Y, -30, 30, tiltY);
@@ -1552,6 +2281,8 @@ void KinectProjector::setupGui()
 	calibrationFolder->addButton("Automatically calibrate kinect & projector");
 	calibrationFolder->addButton("Auto Adjust ROI");
 	calibrationFolder->addToggle(CMP_SHOW_ROI_ON_SAND, doShowROIonProjector);
+	calibrationFolder->addToggle(CMP_MULTI_CHESSBOARD, multiChessboardCalibration);
+	calibrationFolder->addToggle(CMP_STRUCTURED_LIGHT, structuredLightCalibration);
 
 	//	  advancedFolder->addButton("Draw ROI")->setName("Draw ROI");
 	//    advancedFolder->addButton("Calibrate")->setName("Full Calibration");
@@ -1603,10 +2334,11 @@ string KinectProjector::checkStartReady(bool updateFlag = true) {
 	{
 		ofLogVerbose("KinectProjector") << "KinectProjector.startApplication(): Kinect projector not calibrated - trying to load calibration.xml";
 		//Try to load calibration file if possible
-		if (kpt->loadCalibration("settings/calibration.xml"))
+		if (kpt->loadCalibration(settingsDir + "calibration.xml"))
 		{
 			ofLogVerbose("KinectProjector") << "KinectProjector.setup(): Calibration loaded ";
 			kinectProjMatrix = kpt->getProjectionMatrix();
+			projKinectLUTDirty = true;
 			ofLogVerbose("KinectProjector") << "KinectProjector.setup(): kinectProjMatrix: " << kinectProjMatrix;
 			setProjKinectCalibrated(true);
 			projKinectCalibrationUpdated = true;
@@ -1634,11 +2366,19 @@ string KinectProjector::checkStartReady(bool updateFlag = true) {
 			setFullFrameFiltering(doFullFrameFiltering, updateFlag);
 			setInPainting(doInpainting, updateFlag);
 			setFollowBigChanges(followBigChanges, updateFlag);
+			setDualRateFiltering(dualRateFiltering, updateFlag);
 			setSpatialFiltering(spatialFiltering, updateFlag);
 
 			int nAvg = numAveragingSlots;
 			kinectgrabber.performInThread([nAvg](KinectGrabber& kg) { kg.setAveragingSlotsNumber(nAvg); });
 
+			// Warm start the filter with the surface saved before the last exit
+			string snapshotPath = ofToDataPath(settingsDir + "filterSnapshot.bin");
+			ofVec4f eq = basePlaneEq;
+			snapshotBasePlane = eq;
+			lastSnapshotTime = ofGetElapsedTimef();
+			kinectgrabber.performInThread([snapshotPath, eq](KinectGrabber& kg) { kg.loadSnapshot(snapshotPath, eq); });
+
 			updateFlag ? updateStatusGUI() : noop;
 		}
 		else
@@ -1844,6 +2584,106 @@ void KinectProjector::setFollowBigChanges(bool sfollowBigChanges, bool updateGui
 	}
 }
 
+void KinectProjector::setDualRateFiltering(bool sdualRate, bool updateGui = true)
+{
+	dualRateFiltering = sdualRate;
+	kinectgrabber.performInThread([sdualRate](KinectGrabber &kg) {
+		kg.setDualRateFiltering(sdualRate);
+	});
+	if (updateGui)
+	{
+		updateStatusGUI();
+	}
+}
+
+bool KinectProjector::getDualRateFiltering()
+{
+	return dualRateFiltering;
+}
+
+void KinectProjector::setDepthInterpolation(bool sdepthInterpolation, bool updateGui = true)
+{
+	// The frames kept by the interpolator are stale when it is switched back on
+	if (sdepthInterpolation && !depthInterpolation)
+		depthInterpolator.setup(kinectRes.x, kinectRes.y);
+	depthInterpolation = sdepthInterpolation;
+	displayDepthReady = false;
+	depthTextureVersion++;
+	if (updateGui)
+	{
+		updateStatusGUI();
+	}
+}
+
+bool KinectProjector::getDepthInterpolation()
+{
+	return depthInterpolation;
+}
+
+void KinectProjector::updateDepthInterpolation()
+{
+	// Blend for the depth time shown at the next projector refresh, skipped when the
+	// surface would move by less than half a millimeter
+	uint64_t displayTime = framePacer.predictNextDisplay(ofGetElapsedTimeMicros());
+	if (!depthInterpolator.interpolate(framePacer.getDepthTime(displayTime), displayDepthReady ? 0.5f : 0))
+		return;
+	const ofFloatPixels& depth = depthInterpolator.getPixels();
+	DisplayDepthImage.setFromPixels(depth.getData(), depth.getWidth(), depth.getHeight());
+	DisplayDepthImage.updateTexture();
+	displayDepthReady = true;
+	depthTextureVersion++;
+}
+
+void KinectProjector::setContourExtraction(bool enabled)
+{
+	contourExtractionRequested = enabled;
+}
+
+void KinectProjector::setContourLevels(float distance, int majorEvery)
+{
+	// Called from the websocket thread too: the extractor only changes in update()
+	if (distance > 0)
+		contourDistanceRequested = distance;
+	contourMajorEveryRequested = majorEvery;
+}
+
+void KinectProjector::setHillshading(bool enabled)
+{
+	hillshading = enabled;
+	if (hillshading && elevationRaster.isReady())
+		updateHillshade();
+}
+
+void KinectProjector::updateHillshade()
+{
+	// Size of a pixel at the center of the ROI on the base plane
+	ofPoint center = kinectROI.getCenter();
+	int cx = ofClamp(center.x, 0, kinectRes.x - 2);
+	int cy = ofClamp(center.y, 0, kinectRes.y - 1);
+	hillshade.setPixelSize((rayTable.getRay(cx + 1, cy) - rayTable.getRay(cx, cy)).length() * basePlaneOffset.z);
+	hillshade.update(elevationRaster, kinectROI);
+}
+
+void KinectProjector::setMultiChessboardCalibration(bool multi)
+{
+	multiChessboardCalibration = multi;
+}
+
+bool KinectProjector::getMultiChessboardCalibration()
+{
+	return multiChessboardCalibration;
+}
+
+void KinectProjector::setStructuredLightCalibration(bool structuredLight)
+{
+	structuredLightCalibration = structuredLight;
+}
+
+bool KinectProjector::getStructuredLightCalibration()
+{
+	return structuredLightCalibration;
+}
+
 bool KinectProjector::getFollowBigChanges()
 {
 	return followBigChanges;
@@ -2016,7 +2856,7 @@ bool KinectProjector::getDumpDebugFiles()
 
 void KinectProjector::onToggleEvent(ofxDatGuiToggleEvent e)
 {
-	(e.target->is(CMP_SPATIAL_FILTERING)) ? setSpatialFiltering(e.checked) : (e.target->is(CMP_QUICK_REACTION)) ? setFollowBigChanges(e.checked) : (e.target->is(CMP_INPAINT_OUTLIERS)) ? setInPainting(e.checked) : (e.target->is(CMP_FULL_FRAME_FILTERING)) ? setFullFrameFiltering(e.checked) : (e.target->is(CMP_DRAW_KINECT_DEPTH_VIEW)) ? setDrawKinectDepthView(e.checked) : (e.target->is(CMP_DRAW_KINECT_COLOR_VIEW)) ? setDrawKinectColorView(e.checked) : (e.target->is(CMP_DUMP_DEBUG)) ? setDumpDebugFiles(e.checked) : (e.target->is(CMP_SHOW_ROI_ON_SAND)) ? showROIonProjector(e.checked) : noop;
+	(e.target->is(CMP_SPATIAL_FILTERING)) ? setSpatialFiltering(e.checked) : (e.target->is(CMP_QUICK_REACTION)) ? setFollowBigChanges(e.checked) : (e.target->is(CMP_DUAL_RATE_FILTERING)) ? setDualRateFiltering(e.checked) : (e.target->is(CMP_DEPTH_INTERPOLATION)) ? setDepthInterpolation(e.checked) : (e.target->is(CMP_INPAINT_OUTLIERS)) ? setInPainting(e.checked) : (e.target->is(CMP_FULL_FRAME_FILTERING)) ? setFullFrameFiltering(e.checked) : (e.target->is(CMP_DRAW_KINECT_DEPTH_VIEW)) ? setDrawKinectDepthView(e.checked) : (e.target->is(CMP_DRAW_KINECT_COLOR_VIEW)) ? setDrawKinectColorView(e.checked) : (e.target->is(CMP_DUMP_DEBUG)) ? setDumpDebugFiles(e.checked) : (e.target->is(CMP_SHOW_ROI_ON_SAND)) ? showROIonProjector(e.checked) : (e.target->is(CMP_MULTI_CHESSBOARD)) ? setMultiChessboardCalibration(e.checked) : (e.target->is(CMP_STRUCTURED_LIGHT)) ? setStructuredLightCalibration(e.checked) : noop;
 }
 
 void KinectProjector::setAveraging(float value)
@@ -2192,7 +3032,7 @@ string KinectProjector::onConfirmCalibration()
 		} else
 		if ((GetCalibrationState() == CALIBRATION_STATE_PROJ_KINECT_AUTO_CALIBRATION ||
 			(GetCalibrationState() == CALIBRATION_STATE_FULL_AUTO_CALIBRATION && GetFullCalibState() == FULL_CALIBRATION_STATE_AUTOCALIB)) &&
-			GetAutoCalibrationState() == AUTOCALIB_STATE_NEXT_POINT)
+			(GetAutoCalibrationState() == AUTOCALIB_STATE_NEXT_POINT || GetAutoCalibrationState() == AUTOCALIB_STATE_STRUCTURED_LIGHT))
 		{
 			if (!upframe) {
 				upframe = true;
@@ -2226,7 +3066,7 @@ void KinectProjector::saveCalibrationAndSettings()
 {
 	if (isCalibrated())
 	{
-		if (kpt->saveCalibration("settings/calibration.xml"))
+		if (kpt->saveCalibration(settingsDir + "calibration.xml"))
 		{
 			ofLogVerbose("KinectProjector") << "update(): initialisation: Calibration saved ";
 		}
@@ -2250,7 +3090,7 @@ void KinectProjector::saveCalibrationAndSettings()
 
 bool KinectProjector::loadSettings()
 {
-	string settingsFile = "settings/kinectProjectorSettings.xml";
+	string settingsFile = settingsDir + "kinectProjectorSettings.xml";
 
 	ofXml xml;
 	if (!xml.load(settingsFile))
@@ -2266,6 +3106,10 @@ bool KinectProjector::loadSettings()
 	maxOffset = maxOffsetBack;
 	spatialFiltering = xml.getValue<bool>("spatialFiltering");
 	followBigChanges = xml.getValue<bool>("followBigChanges");
+	dualRateFiltering = xml.getValue<bool>("DualRateFiltering", true);
+	depthInterpolation = xml.getValue<bool>("DepthInterpolation", false);
+	multiChessboardCalibration = xml.getValue<bool>("MultiChessboardCalibration", false);
+	structuredLightCalibration = xml.getValue<bool>("StructuredLightCalibration", false);
 	numAveragingSlots = xml.getValue<int>("numAveragingSlots");
 	doInpainting = xml.getValue<bool>("OutlierInpainting", false);
 	doFullFrameFiltering = xml.getValue<bool>("FullFrameFiltering", false);
@@ -2274,7 +3118,7 @@ bool KinectProjector::loadSettings()
 
 bool KinectProjector::saveSettings()
 {
-	string settingsFile = "settings/kinectProjectorSettings.xml";
+	string settingsFile = settingsDir + "kinectProjectorSettings.xml";
 
 	ofXml xml;
 	xml.addChild("KINECTSETTINGS");
@@ -2286,6 +3130,10 @@ bool KinectProjector::saveSettings()
 	xml.addValue("maxOffsetBack", maxOffsetBack);
 	xml.addValue("spatialFiltering", spatialFiltering);
 	xml.addValue("followBigChanges", followBigChanges);
+	xml.addValue("DualRateFiltering", dualRateFiltering);
+	xml.addValue("DepthInterpolation", depthInterpolation);
+	xml.addValue("MultiChessboardCalibration", multiChessboardCalibration);
+	xml.addValue("StructuredLightCalibration", structuredLightCalibration);
 	xml.addValue("numAveragingSlots", numAveragingSlots);
 	xml.addValue("OutlierInpainting", doInpainting);
 	xml.addValue("FullFrameFiltering", doFullFrameFiltering);
@@ -2293,46 +3141,6 @@ bool KinectProjector::saveSettings()
 	return xml.save(settingsFile);
 }
 
-void KinectProjector::ProcessChessBoardInput(ofxCvGrayscaleImage &image)
-{
-	CheckAndNormalizeKinectROI();
-
-	unsigned char *imgD = image.getPixels().getData();
-	unsigned char minV = 255;
-	unsigned char maxV = 0;
-
-	// Find min and max values inside ROI
-	for (int y = kinectROI.getMinY(); y < kinectROI.getMaxY(); y++)
-	{
-		for (int x = kinectROI.getMinX(); x < kinectROI.getMaxX(); x++)
-		{
-			int idx = y * image.width + x;
-			unsigned char val = imgD[idx];
-
-			if (val > maxV)
-				maxV = val;
-			if (val < minV)
-				minV = val;
-		}
-	}
-	std::cout << "Min " << (int)minV << " max " << (int)maxV << std::endl;
-	double scale = 255.0 / (maxV - minV);
-
-	for (int y = 0; y < image.height; y++)
-	{
-		for (int x = 0; x < image.width; x++)
-		{
-			int idx = y * image.width + x;
-			unsigned char val = imgD[idx];
-			double newVal = (val - minV) * scale;
-			newVal = std::min(newVal, 255.0);
-			newVal = std::max(newVal, 0.0);
-
-			imgD[idx] = (unsigned char)newVal;
-		}
-	}
-}
-
 void KinectProjector::CheckAndNormalizeKinectROI()
 {
 	bool fixed = false;
@@ -2361,165 +3169,66 @@ void KinectProjector::CheckAndNormalizeKinectROI()
 		ofLogVerbose("KinectProjector") << "CheckAndNormalizeKinectROI(): Kinect ROI fixed since it was out of bounds";
 }
 
-void KinectProjector::SaveFilteredDepthImageDebug()
-{
-	std::string rawValOutKC = ofToDataPath(DebugFileOutDir + "RawValsKinectCoords.txt");
-	std::string rawValOutWC = ofToDataPath(DebugFileOutDir + "RawValsWorldCoords.txt");
-	std::string rawValOutHM = ofToDataPath(DebugFileOutDir + "RawValsHM.txt");
-	std::string BinOutName = DebugFileOutDir + "RawBinImg.png";
-	std::string DepthOutName = DebugFileOutDir + "RawDepthImg.png";
-
-	std::ofstream fostKC(rawValOutKC.c_str());
-	std::ofstream fostWC(rawValOutWC.c_str());
-	std::ofstream fostHM(rawValOutHM.c_str());
-
-	ofxCvFloatImage temp;
-	temp.setFromPixels(FilteredDepthImage.getFloatPixelsRef().getData(), kinectRes.x, kinectRes.y);
-	temp.setNativeScale(FilteredDepthImage.getNativeScaleMin(), FilteredDepthImage.getNativeScaleMax());
-	temp.convertToRange(0, 1);
-	ofxCvGrayscaleImage temp2;
-	temp2.setFromPixels(temp.getFloatPixelsRef());
-	ofSaveImage(temp2.getPixels(), DepthOutName);
-
-	float *imgData = FilteredDepthImage.getFloatPixelsRef().getData();
-
-	ofxCvGrayscaleImage BinImg;
-	BinImg.allocate(kinectRes.x, kinectRes.y);
-	unsigned char *binData = BinImg.getPixels().getData();
-
-	for (int y = 0; y < kinectRes.y; y++)
-	{
-		for (int x = 0; x < kinectRes.x; x++)
-		{
-			int IDX = y * kinectRes.x + x;
-			double val = imgData[IDX];
-
-			fostKC << val << std::endl;
-
-			// Kinect coords
-			ofVec4f kc = ofVec4f(x, y, val, 1);
-
-			// World coords
-			ofVec4f wc = kinectWorldMatrix * kc * kc.z;
-			fostWC << wc.x << " " << wc.y << " " << wc.z << std::endl;
-
-			float H = elevationAtKinectCoord(x, y);
-			fostHM << H << std::endl;
-
-			unsigned char BinOut = H > 0;
-
-			binData[IDX] = BinOut;
-		}
-	}
-
-	ofSaveImage(BinImg.getPixels(), BinOutName);
-}
-
 bool KinectProjector::getBinaryLandImage(ofxCvGrayscaleImage &BinImg)
 {
-	if (!kinectOpened)
+	if (!kinectOpened || !elevationRaster.isReady())
 		return false;
 
-	float *imgData = FilteredDepthImage.getFloatPixelsRef().getData();
-
-	BinImg.allocate(kinectRes.x, kinectRes.y);
-	unsigned char *binData = BinImg.getPixels().getData();
-
-	for (int y = 0; y < kinectRes.y; y++)
-	{
-		for (int x = 0; x < kinectRes.x; x++)
-		{
-			int IDX = y * kinectRes.x + x;
-			double val = imgData[IDX];
-
-			float H = elevationAtKinectCoord(x, y);
-
-			unsigned char BinOut = 255 * (H > 0);
-
-			binData[IDX] = BinOut;
-		}
-	}
+	// The sea level mask is kept up to date every frame so we only copy it.
+	// setFromPixels only allocates the image the first time
+	BinImg.setFromPixels(landMask.getMask(), landMask.getWidth(), landMask.getHeight());
 
 	return true;
 }
 
 ofRectangle KinectProjector::getProjectorActiveROI()
 {
-	ofRectangle projROI = ofRectangle(ofPoint(0, 0), ofPoint(projRes.x, projRes.y));
+	// Projector pixels that see the kinect ROI at the current terrain height
+	if (projKinectLUT.isReady())
+		return projKinectLUT.getProjectorROI(kinectROI);
 
-	//if (kinectOpened)
-	//{
+	return ofRectangle(ofPoint(0, 0), ofPoint(projRes.x, projRes.y));
+}
 
-	//	ofVec2f a = worldCoordTokinectCoord(projCoordAndWorldZToWorldCoord(0, 0, basePlaneOffset.z));
-	//	ofVec2f b = worldCoordTokinectCoord(projCoordAndWorldZToWorldCoord(projRes.x, 0, basePlaneOffset.z));
-	//	ofVec2f c = worldCoordTokinectCoord(projCoordAndWorldZToWorldCoord(projRes.x, projRes.y, basePlaneOffset.z));
-	//	ofVec2f d = worldCoordTokinectCoord(projCoordAndWorldZToWorldCoord(0, projRes.y, basePlaneOffset.z));
-	//	float x1 = max(a.x, d.x);
-	//	float x2 = min(b.x, c.x);
-	//	float y1 = max(a.y, b.y);
-	//	float y2 = min(c.y, d.y);
+void KinectProjector::updateProjKinectLUT()
+{
+	if (!projKinectCalibrated || !basePlaneComputed)
+		return;
 
-	//	ofVec2f UL = kinectCoordToProjCoord(x1, y1, basePlaneOffset.z);
-	//	ofVec2f LR = kinectCoordToProjCoord(x2, y2, basePlaneOffset.z);
-	//	projROI = ofRectangle(ofPoint(UL.x, UL.y), ofPoint(LR.x, LR.y));
-	//	projROI.standardize();
-	//}
+	// The terrain changes slowly, the table is refreshed at most every 10 depth frames
+	// and only when some tile of the raster was recomputed since the last refresh
+	uint64_t rasterUpdate = elevationRaster.getUpdateCount();
+	if (!projKinectLUTDirty && (elevationRaster.getLastChange() <= projKinectLUTRasterUpdate
+		|| rasterUpdate - projKinectLUTRasterUpdate < 10))
+		return;
 
-	return projROI;
+	if (!projKinectLUT.update(kinectProjMatrix, rayTable, elevationRaster, basePlaneEq))
+		ofLogVerbose("KinectProjector") << "updateProjKinectLUT(): Could not invert the projection matrix";
+	projKinectLUTRasterUpdate = rasterUpdate;
+	projKinectLUTDirty = false;
 }
 
 void KinectProjector::SaveFilteredDepthImage()
 {
-	std::string rawValOutKC = ofToDataPath(DebugFileOutDir + "RawValsKinectCoords.txt");
-	std::string rawValOutWC = ofToDataPath(DebugFileOutDir + "RawValsWorldCoords.txt");
-	std::string rawValOutHM = ofToDataPath(DebugFileOutDir + "RawValsHM.txt");
-	std::string BinOutName = DebugFileOutDir + "RawBinImg.png";
-	std::string DepthOutName = DebugFileOutDir + "RawDepthImg.png";
-
-	std::ofstream fostKC(rawValOutKC.c_str());
-	std::ofstream fostWC(rawValOutWC.c_str());
-	std::ofstream fostHM(rawValOutHM.c_str());
-
-	ofxCvFloatImage temp;
-	temp.setFromPixels(FilteredDepthImage.getFloatPixelsRef().getData(), kinectRes.x, kinectRes.y);
-	temp.setNativeScale(FilteredDepthImage.getNativeScaleMin(), FilteredDepthImage.getNativeScaleMax());
-	temp.convertToRange(0, 1);
-	ofxCvGrayscaleImage temp2;
-	temp2.setFromPixels(temp.getFloatPixelsRef());
-	ofSaveImage(temp2.getPixels(), DepthOutName);
-
-	float *imgData = FilteredDepthImage.getFloatPixelsRef().getData();
-
-	ofxCvGrayscaleImage BinImg;
-	BinImg.allocate(kinectRes.x, kinectRes.y);
-	unsigned char *binData = BinImg.getPixels().getData();
-
-	for (int y = 0; y < kinectRes.y; y++)
-	{
-		for (int x = 0; x < kinectRes.x; x++)
-		{
-			int IDX = y * kinectRes.x + x;
-			double val = imgData[IDX];
-
-			fostKC << val << std::endl;
-
-			// Kinect coords
-			ofVec4f kc = ofVec4f(x, y, val, 1);
-
-			// World coords
-			ofVec4f wc = kinectWorldMatrix * kc * kc.z;
-			fostWC << wc.x << " " << wc.y << " " << wc.z << std::endl;
-
-			float H = elevationAtKinectCoord(x, y);
-			fostHM << H << std::endl;
-
-			unsigned char BinOut = H > 0;
-
-			binData[IDX] = BinOut;
-		}
-	}
+	if (!kinectOpened || !elevationRaster.isReady())
+		return;
 
-	ofSaveImage(BinImg.getPixels(), BinOutName);
+	// Only the frames are copied here, the world coordinates and the file are done by the writer thread
+	auto snapshot = std::make_shared<DebugSnapshot>();
+	snapshot->path = ofToDataPath(DebugFileOutDir + "DebugSnapshot_" + GetTimeAndDateString() + ".npz");
+	snapshot->filteredDepth = FilteredDepthImage.getFloatPixelsRef();
+	const float* elevation = elevationRaster.getData();
+	snapshot->elevation.assign(elevation, elevation + elevationRaster.getWidth() * elevationRaster.getHeight());
+	snapshot->color = kinectColorImage.getPixels();
+	snapshot->kinectWorldMatrix = kinectWorldMatrix;
+
+	// The raw frame is owned by the grabber thread, it is added there before the snapshot is queued
+	DebugSnapshotWriter* writer = &debugSnapshotWriter;
+	kinectgrabber.performInThread([snapshot, writer](KinectGrabber& kg) {
+		snapshot->rawDepth = kg.getRawDepthPixels();
+		writer->write(snapshot);
+	});
+	ofLogVerbose("KinectProjector") << "SaveFilteredDepthImage(): Queued " << snapshot->path;
 }
 
 void KinectProjector::SaveKinectColorImage()
@@ -2540,38 +3249,9 @@ void KinectProjector::SaveKinectColorImage()
 	}
 }
 
-static void removeCRLF(string &targetStr)
-{
-	const char CR = '\r';
-	const char LF = '\n';
-	string str;
-	for (const auto c : targetStr)
-	{
-		if (c != CR && c != LF)
-		{
-			str += c;
-		}
-	}
-	targetStr = std::move(str);
-}
-static string base64_encode(ofBuffer buffer)
-{
-	stringstream ss;
-	ss.str("");
-	Poco::Base64Encoder encoder(ss);
-	encoder << buffer;
-	encoder.close();
-	string str = ss.str();
-	removeCRLF(str);
-	return str;
-}
-
 string KinectProjector::getKinectColorImage()
 {
-	ofPixels pixels = kinectColorImage.getPixels();
-	ofBuffer imageBuffer;
-	ofSaveImage(pixels, imageBuffer);
-	return base64_encode(imageBuffer);
+	return thumbnailService.getThumbnail();
 }
 
 ofxDatGui *KinectProjector::getGui()
@@ -26,17 +26,33 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include "ofxLibwebsockets.h"
 #include <iostream>
+#include <future>
+#include <atomic>
 #include "ofMain.h"
 #include "ofxOpenCv.h"
 #include "ofxCv.h"
 #include "KinectGrabber.h"
+#include "KinectRayTable.h"
+#include "ElevationRaster.h"
+#include "LandMask.h"
+#include "ContourExtractor.h"
+#include "HillshadeRaster.h"
+#include "FramePacer.h"
+#include "DepthInterpolator.h"
+#include "RedrawTracker.h"
+#include "PlaneEstimator.h"
+#include "SandboxWallDetector.h"
+#include "CalibrationWorker.h"
+#include "DebugSnapshotWriter.h"
+#include "ThumbnailService.h"
+#include "StructuredLightCoder.h"
+#include "ProjectorKinectLUT.h"
 #include "ofxModal.h"
 
 
 #include "KinectProjectorCalibration.h"
 #include "Utils.h"
 #include "TemporalFrameFilter.h"
-#include "Poco/Base64Encoder.h"
 
 // component names
 constexpr auto CMP_SPATIAL_FILTERING = "Spatial filtering";
@@ -52,6 +68,10 @@ constexpr auto CMP_VERTICAL_OFFSET = "Vertical offset";
 constexpr auto CMP_SHOW_ROI_ON_SAND = "Show ROI on sand";
 constexpr auto CMP_INPAINT_OUTLIERS = "Inpaint outliers";
 constexpr auto CMP_FULL_FRAME_FILTERING = "Full Frame Filtering";
+constexpr auto CMP_DUAL_RATE_FILTERING = "Fast response to motion";
+constexpr auto CMP_DEPTH_INTERPOLATION = "Smooth motion between frames";
+constexpr auto CMP_MULTI_CHESSBOARD = "Multiple chessboards";
+constexpr auto CMP_STRUCTURED_LIGHT = "Structured light calibration";
 
 // application states
 constexpr int APP_STATE_IDLE = 0;
@@ -59,6 +79,21 @@ constexpr int APP_STATE_SETUP = 1;  // Shows depth image and display white recta
 constexpr int APP_STATE_CALIBRATING = 2;
 constexpr int APP_STATE_RUNNING = 3;
 
+// Counters of the depth frames that went through the grabber pipeline
+struct DepthFrameStatistics {
+	uint64_t framesReceived = 0;    // Frames picked up by the main thread
+	uint64_t droppedInGrabber = 0;  // Frames filtered but replaced before the main thread picked them up
+	uint64_t droppedInTransfer = 0; // Sequence gaps not accounted for by the grabber
+};
+
+// Sent when the measured sea level plane has drifted away from the calibrated one
+struct SeaLevelDriftEventArgs {
+	ofVec4f calibratedPlane;
+	ofVec4f measuredPlane;
+	float angle;  // Angle between the plane normals (degrees)
+	float offset; // Elevation of the measured plane at the ROI centre (mm)
+};
+
 class ofxModalThemeProjKinect : public ofxModalTheme {
 public:
     ofxModalThemeProjKinect()
@@ -75,6 +110,10 @@ public:
     
     bool forceGuiUpdate;
 
+    // Replace the kinect with a simulated sandbox and run the calibration unattended.
+    // The settings are kept apart in settings/simulation/. To be called before setup()
+    void enableSimulation();
+
     // Running loop functions
     void setup(bool sdisplayGui);
     void update();
@@ -97,6 +136,60 @@ public:
     float elevationToKinectDepth(float elevation, float x, float y);
     ofVec2f gradientAtKinectCoord(float x, float y);
 
+	// Batch conversion functions operating on contiguous arrays of n kinect points
+	void kinectCoordToWorldCoord(const ofVec2f* kc, int n, ofVec3f* wc);
+	void kinectCoordToProjCoord(const ofVec2f* kc, int n, ofVec2f* pc);
+	void elevationAtKinectCoord(const ofVec2f* kc, int n, float* elevation);
+
+	// Batch conversion of n consecutive pixels of kinect row y starting at column x
+	void kinectRowToWorldCoord(int x, int y, int n, float* wx, float* wy, float* wz);
+	void elevationAtKinectRow(int x, int y, int n, float* elevation);
+
+	const KinectRayTable& getRayTable(){
+		return rayTable;
+	}
+
+	// Elevation of every kinect pixel, updated once per depth frame
+	const ElevationRaster& getElevationRaster(){
+		return elevationRaster;
+	}
+
+	// Land/water masks inside the kinect ROI, updated once per depth frame
+	const LandMask& getLandMask(){
+		return landMask;
+	}
+
+	// Contour line polylines in kinect coordinates, traced after each depth frame when enabled.
+	// Can be switched from any thread, the tracing itself is done in update()
+	void setContourExtraction(bool enabled);
+	bool getContourExtraction(){
+		return contourExtractionRequested;
+	}
+	void setContourLevels(float distance, int majorEvery = 5);
+	std::shared_ptr<const std::vector<ContourLine> > getContourLines(){
+		return contourExtractor.getSharedLines();
+	}
+
+	// Relief shading of the kinect pixels, updated after each depth frame when enabled
+	void setHillshading(bool enabled);
+	bool getHillshading(){
+		return hillshading;
+	}
+	void setHillshadeZFactor(float zFactor){
+		hillshade.setZFactor(zFactor);
+	}
+	const HillshadeRaster& getHillshade(){
+		return hillshade;
+	}
+
+	// Kinect coordinates seen by every projector pixel over the current terrain, refreshed every few depth frames
+	const ProjectorKinectLUT& getProjectorKinectLUT(){
+		return projKinectLUT;
+	}
+	bool projCoordToKinectCoord(float x, float y, ofVec2f& kinectCoord){
+		return projKinectLUT.projToKinect(x, y, kinectCoord);
+	}
+
 	// Try to start the application - assumes calibration has been done before
 	string startApplication();
 	string checkStartReady(bool updateFlag);
@@ -120,6 +213,17 @@ public:
 	
 	void setFollowBigChanges(bool sfollowBigChanges, bool updateGui);
     bool getFollowBigChanges();
+	void setDualRateFiltering(bool sdualRate, bool updateGui);
+	bool getDualRateFiltering();
+	// Show the filtered depth interpolated between the two latest frames at each projector refresh
+	void setDepthInterpolation(bool sdepthInterpolation, bool updateGui);
+	bool getDepthInterpolation();
+	// Show several calibration chessboards at once to shorten the automatic calibration
+	void setMultiChessboardCalibration(bool multi);
+	bool getMultiChessboardCalibration();
+	// Calibrate with Gray code and phase shift patterns instead of chessboards
+	void setStructuredLightCalibration(bool structuredLight);
+	bool getStructuredLightCalibration();
 	void StartManualROIDefinition();
 	void ResetSeaLevel();
 	void showROIonProjector(bool show);
@@ -161,16 +265,30 @@ public:
 
     // Functions for shaders
     void bind(){
-        FilteredDepthImage.getTexture().bind();
+        getDisplayDepthImage().getTexture().bind();
     }
     void unbind(){
-        FilteredDepthImage.getTexture().unbind();
+        getDisplayDepthImage().getTexture().unbind();
+    }
+    // Incremented every time the depth texture bound for the shaders changes
+    uint64_t getDepthTextureVersion(){
+        return depthTextureVersion;
     }
     ofMatrix4x4 getTransposedKinectWorldMatrix(){
         return kinectWorldMatrix.getTransposedOf(kinectWorldMatrix);
     } // For shaders: OpenGL is row-major order and OF is column-major order
     ofMatrix4x4 getTransposedKinectProjMatrix(){
         return kinectProjMatrix.getTransposedOf(kinectProjMatrix);
+    }
+    // For CPU rendering
+    const ofMatrix4x4& getKinectWorldMatrix(){
+        return kinectWorldMatrix;
+    }
+    const ofMatrix4x4& getKinectProjMatrix(){
+        return kinectProjMatrix;
+    }
+    const ofFloatPixels& getFilteredDepthPixels(){
+        return FilteredDepthImage.getFloatPixelsRef();
     }
 	// Depending on the mount direction of the Kinect, projections can be flipped. 
 	bool getProjectionFlipped();
@@ -178,7 +296,7 @@ public:
 
     // Getter and setter
     ofTexture & getTexture(){
-        return FilteredDepthImage.getTexture();
+        return getDisplayDepthImage().getTexture();
     }
     void setKinectROI(int x, int y, int width, int height) {
         kinectROI = ofRectangle(x, y, width, height);
@@ -190,6 +308,13 @@ public:
     ofVec2f getKinectRes(){
         return kinectRes;
     }
+    // Bookkeeping of the last depth frame received from the grabber
+    DepthFrameInfo getLastFrameInfo(){
+        return lastFrameInfo;
+    }
+    DepthFrameStatistics getFrameStatistics(){
+        return frameStatistics;
+    }
     ofVec4f getBasePlaneEq(){
         return basePlaneEq;
     }
@@ -250,7 +375,8 @@ public:
         AUTOCALIB_STATE_INIT_POINT = 1,
         AUTOCALIB_STATE_NEXT_POINT = 2,
         AUTOCALIB_STATE_COMPUTE = 3,
-        AUTOCALIB_STATE_DONE = 4
+        AUTOCALIB_STATE_DONE = 4,
+        AUTOCALIB_STATE_STRUCTURED_LIGHT = 5
     };
 
     enum Full_Calibration_state
@@ -325,7 +451,7 @@ public:
 	// Debug functions
 	void SaveFilteredDepthImage();
 	void SaveKinectColorImage();
-    string getKinectColorImage();
+    string getKinectColorImage(); // Base64 encoded thumbnail, can be called from any thread
 
     ofxDatGui* getGui();
 
@@ -343,6 +469,8 @@ public:
     void updateErrorEvent(string error);
     string getErrorEvent();
 
+	ofEvent<SeaLevelDriftEventArgs> seaLevelDriftEvent;
+
     void setConfirmModalState(ConfirmModal_State state);
     
 
@@ -355,6 +483,12 @@ private:
    
     void exit(ofEventArgs& e);
     void setupGradientField();
+    void updateFilterSnapshot();
+
+    // Calibration simulation
+    void updateSimulation();
+    string getSimulationStage();
+    void writeSimulationReport();
     
 
     void updateCalibration();
@@ -363,6 +497,9 @@ private:
     void updateROIFromColorImage();
     void updateROIFromDepthImage();
 	void updateROIFromFile();
+
+	// Kinect coordinates moved inside the kinect frame, used by all the conversion functions
+	ofVec2f clampKinectCoord(float x, float y) const;
 	
 //	void updateROIManualCalibration();
     void updateROIFromCalibration();
@@ -375,22 +512,38 @@ private:
 
 	double ComputeReprojectionError(bool WriteFile);
 	void CalibrateNextPoint();
+	void handleChessboardResult(CalibrationResult& result);
+	void startNextCalibExposure();
+	void startStructuredLightPass();
+	void drawStructuredLightPattern(int index);
+	void updateStructuredLightCalibration();
+	int addStructuredLightPairs(const StructuredLightDecoding& decoding, float& relief);
 
 	void updateProjKinectManualCalibration();
     bool addPointPair();
     void updateMaxOffset();
     void updateBasePlane();
+    void collectPlanePoints(ofRectangle area, int step, vector<ofVec4f>& points);
+    void updateSeaLevelMonitor();
+    void updateProjKinectLUT();
+    void updateHillshade();
+    void updateDepthInterpolation();
+    bool mainWindowChanged();
+    ofxCvFloatImage& getDisplayDepthImage(){
+        return depthInterpolation && displayDepthReady ? DisplayDepthImage : FilteredDepthImage;
+    }
+    void checkSeaLevelDrift(SeaLevelCheck& check);
     void askToFlattenSand();
     bool askToFlattenSandFlag;
 
     void drawChessboard(int x, int y, int chessboardSize);
+    void drawChessboards(const vector<ofPoint>& centers, int chessboardSize);
     void drawArrow(ofVec2f projectedPoint, ofVec2f v1);
 
     void saveCalibrationAndSettings();
     bool loadSettings();
     bool saveSettings();
     
-	void ProcessChessBoardInput(ofxCvGrayscaleImage& image);
 	void CheckAndNormalizeKinectROI();
 
     // State variables
@@ -420,6 +573,8 @@ private:
     KinectGrabber               kinectgrabber;
     bool                        spatialFiltering;
     bool                        followBigChanges;
+    bool                        dualRateFiltering;
+    bool                        depthInterpolation;
     int                         numAveragingSlots;
 	bool                        doInpainting;
 	bool                        doFullFrameFiltering;
@@ -430,10 +585,25 @@ private:
 
     //kinect buffer
     ofxCvFloatImage             FilteredDepthImage;
+    ofxCvFloatImage             DisplayDepthImage; // Interpolated depth shown on the projector
+    bool                        displayDepthReady;
+    uint64_t                    depthTextureVersion;
+    uint64_t                    filteredDepthVersion; // Incremented by every depth frame that differs from the previous one
+    bool                        depthScaleChanged; // The texture of the next frame has to be uploaded even if the frame did not change
+    RedrawTracker               mainWindowRedraw; // Inputs of fboMainWindow
+    FramePacer                  framePacer;
+    DepthInterpolator           depthInterpolator;
     ofxCvColorImage             kinectColorImage;
     ofVec2f*                    gradField;
 	ofFpsCounter                fpsKinect;
 	ofxDatGuiTextInput*         fpsKinectText;
+	ofxDatGuiTextInput*         droppedFramesText;
+	ofxDatGuiTextInput*         latencyText;
+
+	// Frame bookkeeping
+	void updateFrameStatistics(DepthFrameInfo& info);
+	DepthFrameInfo              lastFrameInfo;
+	DepthFrameStatistics        frameStatistics;
 
     // Projector and kinect variables
     ofVec2f projRes;
@@ -445,7 +615,6 @@ private:
 
     //Images and cv matrixes
     cv::Mat                     cvRgbImage;
-	cv::Mat                     cvGrayImage;
 //	ofxCvFloatImage             Dptimg;
     
     //Gradient field variables
@@ -466,6 +635,7 @@ private:
     ofxCvContourFinder          contourFinder;
     float                       threshold;
     ofPolyline                  large;
+    std::future<SandboxWalls>   wallDetection;
     ofRectangle                 kinectROI, kinectROIManualCalib;
 	ofVec2f                     ROIStartPoint;
 	ofVec2f                     ROICurrentPoint;
@@ -475,10 +645,43 @@ private:
     ofVec3f basePlaneNormal, basePlaneNormalBack;
     ofVec3f basePlaneOffset, basePlaneOffsetBack;
     ofVec4f basePlaneEq; // Base plane equation in GLSL-compatible format
+
+    // Snapshot of the filter state for a warm start after a restart
+    float lastSnapshotTime;
+    float snapshotInterval; // Seconds between two snapshots
+    ofVec4f snapshotBasePlane; // Base plane known by the grabber for its snapshots
+    PlaneEstimator planeEstimator;
+    vector<ofVec4f> planePoints; // x, y, z and weight of the points used for the plane estimation
+
+    // Background monitoring of the sea level plane
+    SeaLevelMonitor seaLevelMonitor;
+    float lastSeaLevelCheck;
+    float seaLevelCheckInterval; // Seconds between checks
+    float seaLevelAngleTolerance; // Degrees
+    float seaLevelOffsetTolerance; // mm
+    int seaLevelDriftCount; // Number of consecutive checks with drift
     
     // Conversion matrices
     ofMatrix4x4                 kinectProjMatrix;
     ofMatrix4x4                 kinectWorldMatrix;
+    KinectRayTable              rayTable;
+    ElevationRaster             elevationRaster;
+    LandMask                    landMask;
+    ContourExtractor            contourExtractor;
+    bool                        contourExtraction;
+    std::atomic<bool>           contourExtractionRequested;
+    // Levels requested from any thread, handed to the extractor in update()
+    std::atomic<float>          contourDistanceRequested;
+    std::atomic<int>            contourMajorEveryRequested;
+    HillshadeRaster             hillshade;
+    bool                        hillshading;
+    ProjectorKinectLUT          projKinectLUT;
+    bool                        projKinectLUTDirty; // The projection matrix or the base plane changed
+    uint64_t                    projKinectLUTRasterUpdate; // Raster update of the last table refresh
+
+    // Scratch buffers for the batch conversion functions
+    vector<float>               batchDepth, batchX, batchY, batchZ, batchU, batchV;
+    vector<ofVec2f>             batchKinect;
 
     // Max offset for keeping kinect points
     float maxOffset;
@@ -490,6 +693,43 @@ private:
     int currentCalibPts;
     int trials;
     bool upframe;
+    CalibrationWorker calibrationWorker;
+    DebugSnapshotWriter debugSnapshotWriter;
+    ThumbnailService thumbnailService;
+    uint64_t colorFrameSequence; // Number of color frames received
+    int chessboardGeneration; // Incremented each time a chessboard is drawn
+    bool calibrationJobPending;
+    bool multiChessboardCalibration;
+    bool calibSingleBoard; // Show one chessboard per exposure
+    int calibBoardSize; // Size of the calibration chessboards (smaller when several are shown)
+    vector<bool> calibPtDone; // autoCalibPts already acquired
+    vector<int> calibExposure; // autoCalibPts shown in the current exposure
+    vector<vector<ofVec2f> > exposureProjectorPoints; // Projector corners of each shown chessboard
+
+    // Structured light calibration
+    bool structuredLightCalibration;
+    StructuredLightCoder structuredLight;
+    ofImage structuredLightImage;
+    int structuredLightPattern; // Pattern currently projected
+    int structuredLightPass; // 0 on the sand, 1 with a board covering part of the sandbox
+    int structuredLightFrames; // Frames summed for the current pattern
+    cv::Mat structuredLightSum;
+    vector<cv::Mat> structuredLightCaptures;
+    std::future<StructuredLightDecoding> structuredLightDecoding;
+
+    // Calibration simulation
+    enum Simulation_step
+    {
+        SIMULATION_STEP_WAIT_KINECT = 0,
+        SIMULATION_STEP_ROI = 1,
+        SIMULATION_STEP_CALIBRATION = 2,
+        SIMULATION_STEP_DONE = 3
+    };
+    std::shared_ptr<KinectSimulator> simulator;
+    Simulation_step simulationStep;
+    string simulationStage; // Calibration stage currently timed
+    float simulationStart, simulationStageStart;
+    vector<pair<string, float> > simulationStageTimes;
 
 	// Temporal frame filter for cleaning the colour image used for calibration. It should probably be moved to the grabber class/thread
 	CTemporalFrameFilter TemporalFrameFilter;
@@ -517,9 +757,9 @@ private:
 	// Debug functions
 	bool DumpDebugFiles;
 	std::string DebugFileOutDir;
+	std::string settingsDir;
 	std::string GetTimeAndDateString();
 	bool savePointPair();
-	void SaveFilteredDepthImageDebug();
     bool stateEvent;
     string errorEvent;
 };
@@ -30,51 +30,312 @@ ofxKinectProjectorToolkit::ofxKinectProjectorToolkit(ofVec2f sprojRes, ofVec2f s
 	projRes = sprojRes;
 	kinectRes = skinectRes;
     calibrated = false;
+    nInliers = 0;
+    inlierThreshold = 5;
+    rngState = 2463534242u;
+    x = 0;
+    clearPairs();
 }
 
-void ofxKinectProjectorToolkit::calibrate(vector<ofVec3f> pairsKinect,
-                                          vector<ofVec2f> pairsProjector) {
-    int nPairs = pairsKinect.size();
-    A.set_size(nPairs*2, 11);
-    y.set_size(nPairs*2, 1);
+void ofxKinectProjectorToolkit::clearPairs() {
+    pairsKinect.clear();
+    pairsProjector.clear();
+    pairsAcquisition.clear();
+    acquisition = 0;
+}
+
+// The two rows of the linear system given by a pair
+void ofxKinectProjectorToolkit::pairRows(const ofVec3f& k, const ofVec2f& p, double r0[11], double r1[11]) {
+    r0[0] = k.x; r0[1] = k.y; r0[2] = k.z; r0[3] = 1;
+    r0[4] = 0; r0[5] = 0; r0[6] = 0; r0[7] = 0;
+    r0[8] = -k.x * p.x; r0[9] = -k.y * p.x; r0[10] = -k.z * p.x;
     
-    for (int i=0; i<nPairs; i++) {
-        A(2*i, 0) = pairsKinect[i].x;
-        A(2*i, 1) = pairsKinect[i].y;
-        A(2*i, 2) = pairsKinect[i].z;
-        A(2*i, 3) = 1;
-        A(2*i, 4) = 0;
-        A(2*i, 5) = 0;
-        A(2*i, 6) = 0;
-        A(2*i, 7) = 0;
-        A(2*i, 8) = -pairsKinect[i].x * pairsProjector[i].x;
-        A(2*i, 9) = -pairsKinect[i].y * pairsProjector[i].x;
-        A(2*i, 10) = -pairsKinect[i].z * pairsProjector[i].x;
-        
-        A(2*i+1, 0) = 0;
-        A(2*i+1, 1) = 0;
-        A(2*i+1, 2) = 0;
-        A(2*i+1, 3) = 0;
-        A(2*i+1, 4) = pairsKinect[i].x;
-        A(2*i+1, 5) = pairsKinect[i].y;
-        A(2*i+1, 6) = pairsKinect[i].z;
-        A(2*i+1, 7) = 1;
-        A(2*i+1, 8) = -pairsKinect[i].x * pairsProjector[i].y;
-        A(2*i+1, 9) = -pairsKinect[i].y * pairsProjector[i].y;
-        A(2*i+1, 10) = -pairsKinect[i].z * pairsProjector[i].y;
+    r1[0] = 0; r1[1] = 0; r1[2] = 0; r1[3] = 0;
+    r1[4] = k.x; r1[5] = k.y; r1[6] = k.z; r1[7] = 1;
+    r1[8] = -k.x * p.y; r1[9] = -k.y * p.y; r1[10] = -k.z * p.y;
+}
+
+// Least squares solution of A * sol = b by QR. Fails if the condition number of A,
+// estimated by |R| * |R^-1| (Frobenius norms), is above maxCondition
+template <typename M, typename V>
+bool ofxKinectProjectorToolkit::solve(const M& A, const V& b, double maxCondition, Params& sol) {
+    dlib::qr_decomposition<M> qr(A);
+    Normal R = qr.get_r();
+    Normal Rinv;
+    Rinv = 0;
+    double norm = 0, normInv = 0;
+    for (int j=0; j<11; j++) {
+        if (R(j, j) == 0)
+            return false;
+        // Column j of R^-1 by back substitution
+        Rinv(j, j) = 1 / R(j, j);
+        for (int i=j-1; i>=0; i--) {
+            double sum = 0;
+            for (int k=i+1; k<=j; k++)
+                sum += R(i, k) * Rinv(k, j);
+            Rinv(i, j) = -sum / R(i, i);
+        }
+        for (int i=0; i<=j; i++) {
+            norm += R(i, j) * R(i, j);
+            normInv += Rinv(i, j) * Rinv(i, j);
+        }
+    }
+    if (!(sqrt(norm * normInv) < maxCondition))
+        return false;
+    sol = qr.solve(b);
+    return true;
+}
+
+// Linear least squares solution for the given pairs. Both point sets are normalised
+// (centroid at the origin, mean distance sqrt(3) resp. sqrt(2)) before the stacked
+// system is solved. Fails if its condition number is above maxCondition
+bool ofxKinectProjectorToolkit::solveLinear(const vector<int>& indices, double maxCondition, Params& sol) const {
+    int n = indices.size();
+    if (n < 6)
+        return false;
+    ofVec3f ck(0, 0, 0);
+    ofVec2f cp(0, 0);
+    for (int i : indices) {
+        ck += pairsKinect[i];
+        cp += pairsProjector[i];
+    }
+    ck /= n;
+    cp /= n;
+    double dk = 0, dp = 0;
+    for (int i : indices) {
+        dk += pairsKinect[i].distance(ck);
+        dp += pairsProjector[i].distance(cp);
+    }
+    if (dk == 0 || dp == 0)
+        return false;
+    double sk = sqrt(3.0) * n / dk;
+    double sp = sqrt(2.0) * n / dp;
+    
+    dlib::matrix<double, 0, 11> A(2 * n, 11);
+    dlib::matrix<double, 0, 1> y(2 * n);
+    for (int r=0; r<n; r++) {
+        ofVec3f k = (pairsKinect[indices[r]] - ck) * sk;
+        ofVec2f p = (pairsProjector[indices[r]] - cp) * sp;
+        double r0[11], r1[11];
+        pairRows(k, p, r0, r1);
+        for (int j=0; j<11; j++) {
+            A(2 * r, j) = r0[j];
+            A(2 * r + 1, j) = r1[j];
+        }
+        y(2 * r) = p.x;
+        y(2 * r + 1) = p.y;
+    }
+    Params pn;
+    if (!solve(A, y, maxCondition, pn))
+        return false;
+    
+    // Back to the original coordinates: P = Tp^-1 * Pn * Tk
+    double Pn[3][4] = {{pn(0), pn(1), pn(2), pn(3)},
+                       {pn(4), pn(5), pn(6), pn(7)},
+                       {pn(8), pn(9), pn(10), 1}};
+    double P[3][4];
+    for (int r=0; r<3; r++) {
+        for (int j=0; j<3; j++)
+            P[r][j] = Pn[r][j] * sk;
+        P[r][3] = Pn[r][3] - sk * (Pn[r][0] * ck.x + Pn[r][1] * ck.y + Pn[r][2] * ck.z);
+    }
+    for (int j=0; j<4; j++) {
+        P[0][j] = P[0][j] / sp + cp.x * P[2][j];
+        P[1][j] = P[1][j] / sp + cp.y * P[2][j];
+    }
+    if (std::abs(P[2][3]) < 1e-12)
+        return false;
+    for (int j=0; j<4; j++) {
+        sol(j) = P[0][j] / P[2][3];
+        sol(4 + j) = P[1][j] / P[2][3];
+    }
+    for (int j=0; j<3; j++)
+        sol(8 + j) = P[2][j] / P[2][3];
+    return true;
+}
+
+void ofxKinectProjectorToolkit::addPair(const ofVec3f& kinectPoint, const ofVec2f& projectorPoint) {
+    pairsKinect.push_back(kinectPoint);
+    pairsProjector.push_back(projectorPoint);
+    pairsAcquisition.push_back(acquisition);
+}
+
+double ofxKinectProjectorToolkit::residual(const Params& p, const ofVec3f& k, const ofVec2f& proj) {
+    double w = p(8) * k.x + p(9) * k.y + p(10) * k.z + 1;
+    double u = (p(0) * k.x + p(1) * k.y + p(2) * k.z + p(3)) / w;
+    double v = (p(4) * k.x + p(5) * k.y + p(6) * k.z + p(7)) / w;
+    return sqrt((u - proj.x) * (u - proj.x) + (v - proj.y) * (v - proj.y));
+}
+
+int ofxKinectProjectorToolkit::findInliers(const Params& p, vector<unsigned char>& in) {
+    int n = 0;
+    in.resize(pairsKinect.size());
+    for (size_t i=0; i<pairsKinect.size(); i++) {
+        in[i] = residual(p, pairsKinect[i], pairsProjector[i]) < inlierThreshold;
+        n += in[i];
+    }
+    return n;
+}
+
+// Levenberg-Marquardt minimisation of the squared reprojection error of the inliers
+void ofxKinectProjectorToolkit::refine(Params& p) {
+    double lambda = 1e-3;
+    double error = 0;
+    for (size_t i=0; i<pairsKinect.size(); i++)
+        if (inliers[i])
+            error += pow(residual(p, pairsKinect[i], pairsProjector[i]), 2);
+    
+    for (int it=0; it<50; it++) {
+        Normal JtJ;
+        Params Jte;
+        JtJ = 0;
+        Jte = 0;
+        for (size_t i=0; i<pairsKinect.size(); i++) {
+            if (!inliers[i])
+                continue;
+            const ofVec3f& k = pairsKinect[i];
+            const ofVec2f& proj = pairsProjector[i];
+            double w = p(8) * k.x + p(9) * k.y + p(10) * k.z + 1;
+            double u = (p(0) * k.x + p(1) * k.y + p(2) * k.z + p(3)) / w;
+            double v = (p(4) * k.x + p(5) * k.y + p(6) * k.z + p(7)) / w;
+            double ju[11], jv[11];
+            pairRows(k, ofVec2f(u, v), ju, jv);
+            for (int j=0; j<11; j++) {
+                ju[j] /= w;
+                jv[j] /= w;
+            }
+            for (int a=0; a<11; a++) {
+                for (int b=0; b<11; b++)
+                    JtJ(a, b) += ju[a] * ju[b] + jv[a] * jv[b];
+                Jte(a) += ju[a] * (proj.x - u) + jv[a] * (proj.y - v);
+            }
+        }
         
-        y(2*i, 0) = pairsProjector[i].x;
-        y(2*i+1, 0) = pairsProjector[i].y;
+        bool improved = false;
+        while (!improved && lambda < 1e10) {
+            Normal H = JtJ;
+            for (int j=0; j<11; j++)
+                H(j, j) += lambda * JtJ(j, j);
+            Params step;
+            if (!solve(H, Jte, 1e12, step)) {
+                lambda *= 10;
+                continue;
+            }
+            Params candidate = p + step;
+            double newError = 0;
+            for (size_t i=0; i<pairsKinect.size(); i++)
+                if (inliers[i])
+                    newError += pow(residual(candidate, pairsKinect[i], pairsProjector[i]), 2);
+            if (newError < error) {
+                improved = true;
+                bool converged = error - newError < 1e-9 * error;
+                p = candidate;
+                error = newError;
+                lambda = max(lambda / 10, 1e-12);
+                if (converged)
+                    return;
+            } else {
+                lambda *= 10;
+            }
+        }
+        if (!improved)
+            return;
+    }
+}
+
+bool ofxKinectProjectorToolkit::calibrate(const vector<ofVec3f>& spairsKinect,
+                                          const vector<ofVec2f>& spairsProjector) {
+    clearPairs();
+    for (size_t i=0; i<spairsKinect.size() && i<spairsProjector.size(); i++)
+        addPair(spairsKinect[i], spairsProjector[i]);
+    return calibrate();
+}
+
+bool ofxKinectProjectorToolkit::calibrate() {
+    int nPairs = pairsKinect.size();
+    if (nPairs < 6) {
+        ofLogVerbose("ofxKinectProjectorToolkit") << "calibrate(): Not enough point pairs: " << nPairs;
+        return false;
     }
     
-    dlib::qr_decomposition<dlib::matrix<double, 0, 11> > qrd(A);
-    x = qrd.solve(y);
-    cout << "x: "<< x << endl;
+    // RANSAC: each sample of 6 distinct pairs gives 12 equations for the 11 parameters.
+    // A single board is planar, so samples are drawn from several acquisitions when there are
+    // several, and samples with an ill-conditioned system are skipped
+    vector<int> all(nPairs);
+    for (int i=0; i<nPairs; i++)
+        all[i] = i;
+    bool severalAcquisitions = false;
+    for (int i=1; i<nPairs && !severalAcquisitions; i++)
+        severalAcquisitions = pairsAcquisition[i] != pairsAcquisition[0];
+    
+    Params best;
+    int bestInliers = -1;
+    vector<unsigned char> in;
+    if (solveLinear(all, 1e12, best))
+        bestInliers = findInliers(best, in);
+    vector<int> order = all;
+    vector<int> sample(6);
+    for (int it=0; it<300 && bestInliers < nPairs; it++) {
+        // Partial Fisher-Yates shuffle, redrawn a few times if it stays on one acquisition
+        bool spread = false;
+        for (int tries=0; tries<10 && !spread; tries++) {
+            for (int s=0; s<6; s++) {
+                rngState ^= rngState << 13;
+                rngState ^= rngState >> 17;
+                rngState ^= rngState << 5;
+                swap(order[s], order[s + rngState % (nPairs - s)]);
+                sample[s] = order[s];
+            }
+            spread = !severalAcquisitions;
+            for (int s=1; s<6 && !spread; s++)
+                spread = pairsAcquisition[sample[s]] != pairsAcquisition[sample[0]];
+        }
+        Params candidate;
+        if (!spread || !solveLinear(sample, 1e5, candidate))
+            continue;
+        int n = findInliers(candidate, in);
+        if (n > bestInliers) {
+            bestInliers = n;
+            best = candidate;
+        }
+    }
+    if (bestInliers < 6) {
+        ofLogVerbose("ofxKinectProjectorToolkit") << "calibrate(): No consistent projection found";
+        return false;
+    }
+    
+    // Linear solution on the inliers
+    nInliers = findInliers(best, inliers);
+    vector<int> inlierIndices;
+    for (int i=0; i<nPairs; i++)
+        if (inliers[i])
+            inlierIndices.push_back(i);
+    Params p;
+    if (!solveLinear(inlierIndices, 1e12, p))
+        p = best;
+    
+    refine(p);
+    
+    // Pairs that fit the refined projection are kept for the final refinement
+    nInliers = findInliers(p, inliers);
+    refine(p);
+    
+    residuals.resize(nPairs);
+    for (int i=0; i<nPairs; i++)
+        residuals[i] = residual(p, pairsKinect[i], pairsProjector[i]);
+    ofLogVerbose("ofxKinectProjectorToolkit") << "calibrate(): " << nInliers << " inliers out of " << nPairs << " pairs";
+    
+    x = p;
+    updateProjectionMatrix();
+    calibrated = true;
+    return true;
+}
+
+void ofxKinectProjectorToolkit::updateProjectionMatrix() {
     projMatrice = ofMatrix4x4(x(0,0), x(1,0), x(2,0), x(3,0),
                               x(4,0), x(5,0), x(6,0), x(7,0),
                               x(8,0), x(9,0), x(10,0), 1,
                               0, 0, 0, 1);
-    calibrated = true;
 }
 
 ofMatrix4x4 ofxKinectProjectorToolkit::getProjectionMatrix() {
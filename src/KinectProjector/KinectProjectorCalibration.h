@@ -38,8 +38,27 @@ class ofxKinectProjectorToolkit
 public:
     ofxKinectProjectorToolkit(ofVec2f projRes, ofVec2f kinectRes);
     
-    void calibrate(vector<ofVec3f> pairsKinect,
-                   vector<ofVec2f> pairsProjector);
+    // Pairs added after a call to beginAcquisition() belong to a new board position / height,
+    // RANSAC samples span several of them. Pairs are only stored: every solve rebuilds the
+    // normalised stacked system from the selected pairs and solves it by QR. Accumulated normal
+    // equations square the condition number and cannot stably drop rejected pairs
+    void clearPairs();
+    void beginAcquisition() {acquisition++;}
+    void addPair(const ofVec3f& kinectPoint, const ofVec2f& projectorPoint);
+    int getNumPairs() const {return pairsKinect.size();}
+    
+    // RANSAC over the pairs, linear solve on the inliers and Levenberg-Marquardt refinement
+    // of the reprojection error. Returns false if no consistent projection was found
+    bool calibrate();
+    bool calibrate(const vector<ofVec3f>& pairsKinect,
+                   const vector<ofVec2f>& pairsProjector);
+    
+    // Reprojection error (projector pixels) of each pair for the last calibration
+    const vector<double>& getResiduals() const {return residuals;}
+    bool isInlier(int i) const {return i >= 0 && i < (int)inliers.size() && inliers[i] != 0;}
+    int getNumInliers() const {return nInliers;}
+    
+    void setInlierThreshold(double t) {inlierThreshold = t;}
     
     ofVec2f getProjectedPoint(ofVec3f worldPoint);
     ofMatrix4x4 getProjectionMatrix();
@@ -52,9 +71,29 @@ public:
     bool isCalibrated() {return calibrated;}
     
 private:
+    typedef dlib::matrix<double, 11, 1> Params;
+    typedef dlib::matrix<double, 11, 11> Normal;
+    
+    static void pairRows(const ofVec3f& k, const ofVec2f& p, double r0[11], double r1[11]);
+    template <typename M, typename V> static bool solve(const M& A, const V& b, double maxCondition, Params& sol);
+    bool solveLinear(const vector<int>& indices, double maxCondition, Params& sol) const;
+    static double residual(const Params& p, const ofVec3f& k, const ofVec2f& proj);
+    
+    int findInliers(const Params& p, vector<unsigned char>& in);
+    void refine(Params& p);
+    void updateProjectionMatrix();
+    
+    vector<ofVec3f> pairsKinect;
+    vector<ofVec2f> pairsProjector;
+    vector<int> pairsAcquisition;
+    int acquisition;
+    
+    vector<double> residuals;
+    vector<unsigned char> inliers;
+    int nInliers;
+    double inlierThreshold; // Max reprojection error of an inlier (projector pixels)
+    unsigned int rngState;
     
-    dlib::matrix<double, 0, 11> A;
-    dlib::matrix<double, 0, 1> y;
     dlib::matrix<double, 11, 1> x;
     
     ofMatrix4x4 projMatrice;
@@ -0,0 +1,184 @@
+/***********************************************************************
+KinectRayTable - Per-pixel viewing rays of the kinect depth camera, used
+to convert whole rows of depth values to world coordinates at once.
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "KinectRayTable.h"
+#include "SimdUtils.h"
+
+KinectRayTable::KinectRayTable()
+: width(0),
+height(0),
+version(0)
+{
+	for (int i = 0; i < 3; i++)
+	{
+		a[i] = b[i] = c[i] = 0;
+	}
+}
+
+void KinectRayTable::setup(int swidth, int sheight, const ofMatrix4x4& kinectWorldMatrix)
+{
+	width = swidth;
+	height = sheight;
+
+	for (int i = 0; i < 3; i++)
+	{
+		a[i] = kinectWorldMatrix(i, 0);
+		b[i] = kinectWorldMatrix(i, 1);
+		c[i] = kinectWorldMatrix(i, 3);
+	}
+	if (kinectWorldMatrix(0, 2) != 0 || kinectWorldMatrix(1, 2) != 0 || kinectWorldMatrix(2, 2) != 0)
+		ofLogWarning("KinectRayTable") << "setup(): kinect world matrix depends on depth - ray table is only approximate";
+
+	rayX.resize(width * height);
+	rayY.resize(width * height);
+	rayZ.resize(width * height);
+	int idx = 0;
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++, idx++)
+		{
+			rayX[idx] = a[0] * x + b[0] * y + c[0];
+			rayY[idx] = a[1] * x + b[1] * y + c[1];
+			rayZ[idx] = a[2] * x + b[2] * y + c[2];
+		}
+	}
+	version++;
+	ofLogVerbose("KinectRayTable") << "setup(): ray table computed for " << width << " x " << height << " pixels";
+}
+
+ofVec3f KinectRayTable::getRay(float x, float y) const
+{
+	return ofVec3f(a[0] * x + b[0] * y + c[0], a[1] * x + b[1] * y + c[1], a[2] * x + b[2] * y + c[2]);
+}
+
+ofVec3f KinectRayTable::getRay(int x, int y) const
+{
+	int idx = y * width + x;
+	return ofVec3f(rayX[idx], rayY[idx], rayZ[idx]);
+}
+
+ofVec2f KinectRayTable::worldToKinect(const ofVec3f& world) const
+{
+	// world is parallel to the ray: world.x * ray.z = world.z * ray.x and world.y * ray.z = world.z * ray.y
+	float m00 = world.x * a[2] - world.z * a[0];
+	float m01 = world.x * b[2] - world.z * b[0];
+	float r0 = world.z * c[0] - world.x * c[2];
+	float m10 = world.y * a[2] - world.z * a[1];
+	float m11 = world.y * b[2] - world.z * b[1];
+	float r1 = world.z * c[1] - world.y * c[2];
+	float det = m00 * m11 - m01 * m10;
+	if (det == 0)
+		return ofVec2f(-1, -1);
+	return ofVec2f((r0 * m11 - m01 * r1) / det, (m00 * r1 - r0 * m10) / det);
+}
+
+void KinectRayTable::toWorld(int x, int y, int n, const float* depth, float* wx, float* wy, float* wz) const
+{
+	const float* rx = &rayX[y * width + x];
+	const float* ry = &rayY[y * width + x];
+	const float* rz = &rayZ[y * width + x];
+	int i = 0;
+#ifdef MAGICSAND_USE_SSE2
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 d = _mm_loadu_ps(depth + i);
+		_mm_storeu_ps(wx + i, _mm_mul_ps(_mm_loadu_ps(rx + i), d));
+		_mm_storeu_ps(wy + i, _mm_mul_ps(_mm_loadu_ps(ry + i), d));
+		_mm_storeu_ps(wz + i, _mm_mul_ps(_mm_loadu_ps(rz + i), d));
+	}
+#endif
+	for (; i < n; i++)
+	{
+		wx[i] = rx[i] * depth[i];
+		wy[i] = ry[i] * depth[i];
+		wz[i] = rz[i] * depth[i];
+	}
+}
+
+void KinectRayTable::toElevation(int x, int y, int n, const float* depth, const ofVec4f& planeEq, float* elevation) const
+{
+	const float* rx = &rayX[y * width + x];
+	const float* ry = &rayY[y * width + x];
+	const float* rz = &rayZ[y * width + x];
+	int i = 0;
+#ifdef MAGICSAND_USE_SSE2
+	__m128 nx = _mm_set1_ps(-planeEq.x);
+	__m128 ny = _mm_set1_ps(-planeEq.y);
+	__m128 nz = _mm_set1_ps(-planeEq.z);
+	__m128 nw = _mm_set1_ps(-planeEq.w);
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 k = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, _mm_loadu_ps(rx + i)), _mm_mul_ps(ny, _mm_loadu_ps(ry + i))), _mm_mul_ps(nz, _mm_loadu_ps(rz + i)));
+		_mm_storeu_ps(elevation + i, _mm_add_ps(_mm_mul_ps(k, _mm_loadu_ps(depth + i)), nw));
+	}
+#endif
+	for (; i < n; i++)
+	{
+		float k = -planeEq.x * rx[i] - planeEq.y * ry[i] - planeEq.z * rz[i];
+		elevation[i] = k * depth[i] - planeEq.w;
+	}
+}
+
+void KinectRayTable::toWorld(const ofVec2f* points, const float* depth, int n, ofVec3f* world) const
+{
+	for (int i = 0; i < n; i++)
+	{
+		float x = points[i].x;
+		float y = points[i].y;
+		float d = depth[i];
+		world[i].set((a[0] * x + b[0] * y + c[0]) * d, (a[1] * x + b[1] * y + c[1]) * d, (a[2] * x + b[2] * y + c[2]) * d);
+	}
+}
+
+void KinectRayTable::worldToProj(const ofMatrix4x4& projMatrix, const float* wx, const float* wy, const float* wz, int n, float* px, float* py)
+{
+	float p[3][4];
+	for (int r = 0; r < 3; r++)
+		for (int k = 0; k < 4; k++)
+			p[r][k] = projMatrix(r, k);
+
+	int i = 0;
+#ifdef MAGICSAND_USE_SSE2
+	__m128 m[3][4];
+	for (int r = 0; r < 3; r++)
+		for (int k = 0; k < 4; k++)
+			m[r][k] = _mm_set1_ps(p[r][k]);
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(wx + i);
+		__m128 y = _mm_loadu_ps(wy + i);
+		__m128 z = _mm_loadu_ps(wz + i);
+		__m128 s[3];
+		for (int r = 0; r < 3; r++)
+			s[r] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[r][0], x), _mm_mul_ps(m[r][1], y)), _mm_add_ps(_mm_mul_ps(m[r][2], z), m[r][3]));
+		_mm_storeu_ps(px + i, _mm_div_ps(s[0], s[2]));
+		_mm_storeu_ps(py + i, _mm_div_ps(s[1], s[2]));
+	}
+#endif
+	for (; i < n; i++)
+	{
+		float sx = p[0][0] * wx[i] + p[0][1] * wy[i] + p[0][2] * wz[i] + p[0][3];
+		float sy = p[1][0] * wx[i] + p[1][1] * wy[i] + p[1][2] * wz[i] + p[1][3];
+		float sz = p[2][0] * wx[i] + p[2][1] * wy[i] + p[2][2] * wz[i] + p[2][3];
+		px[i] = sx / sz;
+		py[i] = sy / sz;
+	}
+}
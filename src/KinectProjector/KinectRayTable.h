@@ -0,0 +1,79 @@
+/***********************************************************************
+KinectRayTable - Per-pixel viewing rays of the kinect depth camera, used
+to convert whole rows of depth values to world coordinates at once.
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#pragma once
+#include "ofMain.h"
+
+// The kinect world matrix maps a kinect pixel (x, y) with depth z to
+//     world = kinectWorldMatrix * (x, y, z, 1) * z
+// Since the matrix does not depend on z (third column is zero) this is ray(x, y) * z.
+// The table stores the ray of every pixel in separate x, y and z arrays (structure of arrays)
+class KinectRayTable {
+public:
+	KinectRayTable();
+
+	// Compute the rays of all pixels of a width x height kinect frame
+	void setup(int width, int height, const ofMatrix4x4& kinectWorldMatrix);
+
+	bool isReady() const {
+		return width > 0 && height > 0;
+	}
+	int getWidth() const {
+		return width;
+	}
+	int getHeight() const {
+		return height;
+	}
+	// Incremented every time the rays are recomputed
+	unsigned int getVersion() const {
+		return version;
+	}
+
+	// Ray of an arbitrary (sub)pixel position
+	ofVec3f getRay(float x, float y) const;
+
+	// Ray of pixel (x, y) read from the table
+	ofVec3f getRay(int x, int y) const;
+
+	// Kinect (sub)pixel position whose ray goes through a world point
+	ofVec2f worldToKinect(const ofVec3f& world) const;
+
+	// World coordinates of n consecutive pixels of row y starting at column x. depth points to the first pixel
+	void toWorld(int x, int y, int n, const float* depth, float* wx, float* wy, float* wz) const;
+
+	// Elevation above the plane (-planeEq . (world, 1)) of n consecutive pixels of row y starting at column x
+	void toElevation(int x, int y, int n, const float* depth, const ofVec4f& planeEq, float* elevation) const;
+
+	// World coordinates of n arbitrary kinect points with their depth values
+	void toWorld(const ofVec2f* points, const float* depth, int n, ofVec3f* world) const;
+
+	// Projection of n world coordinates using the 4x4 kinect-projector matrix
+	static void worldToProj(const ofMatrix4x4& projMatrix, const float* wx, const float* wy, const float* wz, int n, float* px, float* py);
+
+private:
+	int width, height;
+	unsigned int version;
+
+	// Affine coefficients of the rays: ray.i = a[i] * x + b[i] * y + c[i]
+	float a[3], b[3], c[3];
+
+	std::vector<float> rayX, rayY, rayZ;
+};
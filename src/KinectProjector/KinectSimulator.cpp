@@ -0,0 +1,216 @@
+/***********************************************************************
+KinectSimulator - Synthetic kinect frames of a sandbox lit by a virtual projector.
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "KinectSimulator.h"
+
+KinectSimulator::KinectSimulator()
+	: width(640),
+	height(480),
+	focal(575),
+	frameInterval(33333),
+	lastFrameTime(0),
+	sandbox(-400, -300, 800, 600),
+	wallWidth(40),
+	sandDepth(1000),
+	wallDepth(850),
+	floorDepth(1300),
+	tiltX(0.02),
+	tiltY(-0.01),
+	boardHeight(120),
+	boardRaised(false),
+	projWidth(0),
+	projHeight(0),
+	projectorImageChanged(false)
+{
+	depthFrame.allocate(width, height, 1);
+	colorFrame.allocate(width, height, 3);
+	setup(1024, 768);
+}
+
+// The projector sits a bit beside the kinect and slightly rotated, its image covering the sandbox
+void KinectSimulator::setup(int sprojWidth, int sprojHeight)
+{
+	std::lock_guard<std::mutex> guard(sceneLock);
+	projWidth = sprojWidth;
+	projHeight = sprojHeight;
+	projectorImage.allocate(projWidth, projHeight, 4);
+	projectorImage.set(0);
+
+	ofVec3f center(30, -40, -100);
+	ofMatrix4x4 rotation;
+	rotation.makeRotationMatrix(3, ofVec3f(1, 0, 0), 0, ofVec3f(0, 1, 0), 2, ofVec3f(0, 0, 1));
+	float f = projWidth * (sandDepth - center.z) / 960.0f;
+	float k[3][3] = { { f, 0, projWidth / 2.0f }, { 0, f, projHeight / 2.0f }, { 0, 0, 1 } };
+	for (int r = 0; r < 3; r++)
+	{
+		float t = 0;
+		for (int c = 0; c < 3; c++)
+		{
+			float v = 0;
+			for (int i = 0; i < 3; i++)
+				v += k[r][i] * rotation(i, c);
+			projMatrix[r][c] = v;
+			t -= v * center[c];
+		}
+		projMatrix[r][3] = t;
+	}
+}
+
+ofMatrix4x4 KinectSimulator::getWorldMatrix() const
+{
+	// Same layout as KinectGrabber::getWorldMatrix()
+	return ofMatrix4x4(1 / focal, 0, 0, -width / 2 / focal,
+		0, 1 / focal, 0, -height / 2 / focal,
+		0, 0, 0, 1,
+		0, 0, 0, 1);
+}
+
+ofVec3f KinectSimulator::kinectCoordToWorldCoord(float x, float y, float depth) const
+{
+	return ofVec3f((x - width / 2) / focal, (y - height / 2) / focal, 1) * depth;
+}
+
+ofVec2f KinectSimulator::worldToProjector(const ofVec3f& world) const
+{
+	float p[3];
+	for (int r = 0; r < 3; r++)
+		p[r] = projMatrix[r][0] * world.x + projMatrix[r][1] * world.y + projMatrix[r][2] * world.z + projMatrix[r][3];
+	return ofVec2f(p[0] / p[2], p[1] / p[2]);
+}
+
+void KinectSimulator::setProjectorImage(const ofPixels& image)
+{
+	std::lock_guard<std::mutex> guard(sceneLock);
+	pendingProjectorImage = image;
+	projectorImageChanged = true;
+}
+
+void KinectSimulator::setBoardRaised(bool raised)
+{
+	std::lock_guard<std::mutex> guard(sceneLock);
+	boardRaised = raised;
+}
+
+float KinectSimulator::getSurfaceDepth(float x, float y)
+{
+	float albedo;
+	std::lock_guard<std::mutex> guard(sceneLock);
+	return surfaceDepth(x, y, boardRaised, albedo);
+}
+
+// Intersection of the ray of a kinect pixel with the scene, from the top of the walls down.
+// The vertical faces of the walls are ignored
+float KinectSimulator::surfaceDepth(float x, float y, bool board, float& albedo) const
+{
+	float rx = (x - width / 2) / focal;
+	float ry = (y - height / 2) / focal;
+
+	ofRectangle outside = sandbox;
+	outside.growToInclude(sandbox.getMinX() - wallWidth, sandbox.getMinY() - wallWidth);
+	outside.growToInclude(sandbox.getMaxX() + wallWidth, sandbox.getMaxY() + wallWidth);
+	ofPoint onWall(rx * wallDepth, ry * wallDepth);
+	if (outside.inside(onWall) && !sandbox.inside(onWall))
+	{
+		albedo = 0.6f;
+		return wallDepth;
+	}
+
+	// Sand plane z = d + tiltX * X + tiltY * Y with small bumps
+	float depth = sandDepth - (board ? boardHeight : 0);
+	float z = depth / (1 - tiltX * rx - tiltY * ry);
+	ofPoint onSand(rx * z, ry * z);
+	if (sandbox.inside(onSand))
+	{
+		albedo = board ? 0.95f : 0.85f;
+		if (!board)
+			z += 3 * sin(onSand.x / 60) * cos(onSand.y / 45);
+		return z;
+	}
+	albedo = 0.4f;
+	return floorDepth;
+}
+
+float KinectSimulator::projectorLight(const ofVec3f& world) const
+{
+	ofVec2f p = worldToProjector(world);
+	int px = static_cast<int>(floor(p.x));
+	int py = static_cast<int>(floor(p.y));
+	if (px < 0 || py < 0 || px >= projectorImage.getWidth() || py >= projectorImage.getHeight())
+		return 0;
+	const unsigned char* c = projectorImage.getData() + (py * projectorImage.getWidth() + px) * projectorImage.getNumChannels();
+	float light = (c[0] + c[1] + c[2]) / (3 * 255.0f);
+	if (projectorImage.getNumChannels() == 4)
+		light *= c[3] / 255.0f; // The transparent parts of the projector window are black
+	return light;
+}
+
+bool KinectSimulator::update()
+{
+	uint64_t now = ofGetElapsedTimeMicros();
+	if (now - lastFrameTime < frameInterval)
+	{
+		ofSleepMillis(1);
+		return false;
+	}
+	lastFrameTime = now;
+	render();
+	return true;
+}
+
+void KinectSimulator::render()
+{
+	std::lock_guard<std::mutex> guard(sceneLock);
+	if (projectorImageChanged)
+	{
+		std::swap(projectorImage, pendingProjectorImage);
+		projectorImageChanged = false;
+	}
+
+	std::normal_distribution<float> noise(0, 1);
+	const float ambient = 25;
+	const float sandColor[3] = { 1.0f, 0.92f, 0.78f };
+	unsigned short* depth = depthFrame.getData();
+	unsigned char* color = colorFrame.getData();
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++, depth++, color += 3)
+		{
+			float albedo;
+			float z = surfaceDepth(x, y, boardRaised, albedo);
+			// Kinect depth noise grows with the square of the distance
+			float sigma = 1 + 1.5e-6f * z * z;
+			*depth = static_cast<unsigned short>(ofClamp(z + sigma * noise(random) + 0.5f, 0, 65535));
+
+			// 2x2 samples per pixel so the projected patterns are smoothly resampled
+			float light = 0;
+			for (int s = 0; s < 4; s++)
+			{
+				float sx = x - 0.25f + 0.5f * (s & 1);
+				float sy = y - 0.25f + 0.5f * (s >> 1);
+				float sAlbedo;
+				float sz = surfaceDepth(sx, sy, boardRaised, sAlbedo);
+				light += projectorLight(kinectCoordToWorldCoord(sx, sy, sz));
+			}
+			float value = ambient + albedo * 200 * light / 4 + 2 * noise(random);
+			for (int c = 0; c < 3; c++)
+				color[c] = static_cast<unsigned char>(ofClamp(value * sandColor[c], 0, 255));
+		}
+	}
+}
@@ -0,0 +1,79 @@
+/***********************************************************************
+KinectSimulator - Synthetic kinect frames of a sandbox lit by a virtual projector.
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#pragma once
+#include "ofMain.h"
+#include <random>
+
+// Replaces the kinect in the grabber so the calibration can be run and timed without a
+// physical setup. The scene is a slightly tilted sand plane surrounded by walls, seen by
+// a kinect looking down and lit by a projector showing the content of the projector window.
+// The projector matrix of the scene is known, so the result of a calibration can be checked.
+// All distances are in mm, in the world coordinates of the kinect.
+class KinectSimulator {
+public:
+	KinectSimulator();
+	void setup(int projWidth, int projHeight);
+
+	// Called by the grabber thread, like ofxKinect::update() and isFrameNew()
+	bool update();
+	const ofShortPixels& getRawDepthPixels() const { return depthFrame; }
+	const ofPixels& getPixels() const { return colorFrame; }
+	ofMatrix4x4 getWorldMatrix() const;
+	int getWidth() const { return width; }
+	int getHeight() const { return height; }
+
+	// Called by the main thread
+	void setProjectorImage(const ofPixels& image);
+	void setBoardRaised(bool raised); // A board covering the sand, as asked by the calibration
+
+	// Ground truth of the scene
+	float getSurfaceDepth(float x, float y); // Depth without noise seen by a kinect pixel
+	ofVec3f kinectCoordToWorldCoord(float x, float y, float depth) const;
+	ofVec2f worldToProjector(const ofVec3f& world) const;
+
+private:
+	float surfaceDepth(float x, float y, bool board, float& albedo) const;
+	float projectorLight(const ofVec3f& world) const; // 0-1
+	void render();
+
+	int width, height;
+	float focal; // Kinect focal length in pixels
+	uint64_t frameInterval, lastFrameTime; // Microseconds
+
+	// Scene
+	ofRectangle sandbox; // Inside of the walls
+	float wallWidth;
+	float sandDepth, wallDepth, floorDepth;
+	float tiltX, tiltY; // Slope of the sand plane
+	float boardHeight;
+	bool boardRaised;
+
+	// Projector: projected = (P * world) / z like the calibrated kinectProjMatrix
+	float projMatrix[3][4];
+	int projWidth, projHeight;
+	ofPixels projectorImage, pendingProjectorImage;
+	bool projectorImageChanged;
+	std::mutex sceneLock;
+
+	ofShortPixels depthFrame;
+	ofPixels colorFrame;
+	std::mt19937 random;
+};
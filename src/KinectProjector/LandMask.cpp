@@ -0,0 +1,131 @@
+/***********************************************************************
+LandMask - Binary land/water masks thresholded from the elevation raster.
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "LandMask.h"
+#include "SimdUtils.h"
+
+// out[i] = 255 if elevation[i] > level else 0
+static void thresholdRow(const float* elevation, int n, float level, unsigned char* out)
+{
+	int i = 0;
+#ifdef MAGICSAND_USE_SSE2
+	__m128 l = _mm_set1_ps(level);
+	for (; i + 16 <= n; i += 16)
+	{
+		// Comparison results are all ones or all zeros and survive the saturated packing
+		__m128i a = _mm_castps_si128(_mm_cmpgt_ps(_mm_loadu_ps(elevation + i), l));
+		__m128i b = _mm_castps_si128(_mm_cmpgt_ps(_mm_loadu_ps(elevation + i + 4), l));
+		__m128i c = _mm_castps_si128(_mm_cmpgt_ps(_mm_loadu_ps(elevation + i + 8), l));
+		__m128i d = _mm_castps_si128(_mm_cmpgt_ps(_mm_loadu_ps(elevation + i + 12), l));
+		__m128i ab = _mm_packs_epi32(a, b);
+		__m128i cd = _mm_packs_epi32(c, d);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packs_epi16(ab, cd));
+	}
+#endif
+	for (; i < n; i++)
+	{
+		out[i] = elevation[i] > level ? 255 : 0;
+	}
+}
+
+LandMask::LandMask()
+: width(0),
+height(0),
+minX(0),
+maxX(0),
+minY(0),
+maxY(0),
+lastRasterUpdate(0),
+fullUpdate(true)
+{
+	levels.push_back(0);
+}
+
+void LandMask::setup(int swidth, int sheight)
+{
+	width = swidth;
+	height = sheight;
+	masks.assign(levels.size(), std::vector<unsigned char>(width * height, 0));
+	fullUpdate = true;
+}
+
+void LandMask::setLevels(const std::vector<float>& extraLevels)
+{
+	levels.resize(1);
+	levels.insert(levels.end(), extraLevels.begin(), extraLevels.end());
+	masks.assign(levels.size(), std::vector<unsigned char>(width * height, 0));
+	fullUpdate = true;
+}
+
+void LandMask::clear()
+{
+	for (auto & mask : masks)
+		std::fill(mask.begin(), mask.end(), 0);
+}
+
+int LandMask::update(const ElevationRaster& raster, const ofRectangle& ROI)
+{
+	if (raster.getWidth() != width || raster.getHeight() != height || !raster.isReady())
+		return 0;
+
+	int rx0 = ofClamp(static_cast<int>(ROI.getMinX()), 0, width);
+	int rx1 = ofClamp(static_cast<int>(ROI.getMaxX()), 0, width);
+	int ry0 = ofClamp(static_cast<int>(ROI.getMinY()), 0, height);
+	int ry1 = ofClamp(static_cast<int>(ROI.getMaxY()), 0, height);
+	if (rx0 != minX || rx1 != maxX || ry0 != minY || ry1 != maxY)
+	{
+		minX = rx0;
+		maxX = rx1;
+		minY = ry0;
+		maxY = ry1;
+		fullUpdate = true;
+	}
+	if (fullUpdate)
+		clear();
+
+	int tileSize = raster.getTileSize();
+	const float* elevation = raster.getData();
+	int updated = 0;
+	for (int ty = minY / tileSize; ty < raster.getTilesY() && ty * tileSize < maxY; ty++)
+	{
+		int y0 = std::max(ty * tileSize, minY);
+		int y1 = std::min((ty + 1) * tileSize, maxY);
+		for (int tx = minX / tileSize; tx < raster.getTilesX() && tx * tileSize < maxX; tx++)
+		{
+			if (!fullUpdate && raster.getTileUpdate(tx, ty) <= lastRasterUpdate)
+				continue;
+
+			int x0 = std::max(tx * tileSize, minX);
+			int x1 = std::min((tx + 1) * tileSize, maxX);
+			for (size_t l = 0; l < levels.size(); l++)
+			{
+				for (int y = y0; y < y1; y++)
+				{
+					int idx = y * width + x0;
+					thresholdRow(elevation + idx, x1 - x0, levels[l], &masks[l][idx]);
+				}
+			}
+			updated++;
+		}
+	}
+	lastRasterUpdate = raster.getUpdateCount();
+	fullUpdate = false;
+	return updated;
+}
@@ -0,0 +1,67 @@
+/***********************************************************************
+LandMask - Binary land/water masks thresholded from the elevation raster.
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#pragma once
+#include "ofMain.h"
+#include "ElevationRaster.h"
+
+// Masks are 255 where the elevation is above the level and 0 elsewhere.
+// Level 0 is the sea level and is always present. Only the kinect ROI is
+// computed, pixels outside are 0. The masks are kept between frames and
+// only the raster tiles changed since the last update are thresholded again.
+class LandMask {
+public:
+	LandMask();
+
+	void setup(int width, int height);
+
+	// Additional elevation levels (in mm) - the sea level is always the first level
+	void setLevels(const std::vector<float>& extraLevels);
+
+	// Threshold the raster tiles changed since the last update. Returns the number of updated tiles
+	int update(const ElevationRaster& raster, const ofRectangle& ROI);
+
+	int getWidth() const {
+		return width;
+	}
+	int getHeight() const {
+		return height;
+	}
+	int getNumLevels() const {
+		return levels.size();
+	}
+	float getLevel(int i) const {
+		return levels[i];
+	}
+	const unsigned char* getMask(int level = 0) const {
+		return masks[level].data();
+	}
+
+private:
+	void clear();
+
+	int width, height;
+	std::vector<float> levels;
+	std::vector<std::vector<unsigned char> > masks;
+
+	int minX, maxX, minY, maxY; // ROI used for the current masks
+	uint64_t lastRasterUpdate; // Last raster update included in the masks
+	bool fullUpdate;
+};
@@ -0,0 +1,253 @@
+/***********************************************************************
+PlaneEstimator - Robust estimation of the sea level plane and background
+monitoring of its drift.
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "PlaneEstimator.h"
+
+PlaneEstimator::PlaneEstimator()
+: iterations(200),
+inlierDistance(5),
+inlierRatio(0),
+rngState(12345)
+{
+}
+
+void PlaneEstimator::clear()
+{
+	// clear() keeps the capacity of the vectors
+	px.clear();
+	py.clear();
+	pz.clear();
+	pw.clear();
+}
+
+void PlaneEstimator::addPoint(float x, float y, float z, float weight)
+{
+	px.push_back(x);
+	py.push_back(y);
+	pz.push_back(z);
+	pw.push_back(weight);
+}
+
+unsigned int PlaneEstimator::random(unsigned int n)
+{
+	// xorshift32 - deterministic and allocation free
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return rngState % n;
+}
+
+int PlaneEstimator::countInliers(const ofVec4f& planeEq, bool mark, double& weightSum)
+{
+	int n = px.size();
+	// Hypotheses are scored on a subset of the points, the final inliers on all points
+	int stride = mark ? 1 : std::max(1, n / 2000);
+	int count = 0;
+	weightSum = 0;
+	for (int i = 0; i < n; i += stride)
+	{
+		float d = planeEq.x * px[i] + planeEq.y * py[i] + planeEq.z * pz[i] + planeEq.w;
+		bool in = d < inlierDistance && d > -inlierDistance;
+		if (mark)
+			inlier[i] = in;
+		if (in)
+		{
+			count++;
+			weightSum += pw[i];
+		}
+	}
+	return count;
+}
+
+bool PlaneEstimator::fitLeastSquares(bool inliersOnly, ofVec4f& planeEq)
+{
+	int n = px.size();
+
+	// Weighted centroid
+	double sw = 0, sx = 0, sy = 0, sz = 0;
+	for (int i = 0; i < n; i++)
+	{
+		if (inliersOnly && !inlier[i])
+			continue;
+		double w = pw[i];
+		sw += w;
+		sx += w * px[i];
+		sy += w * py[i];
+		sz += w * pz[i];
+	}
+	if (sw <= 0)
+		return false;
+	double cx = sx / sw, cy = sy / sw, cz = sz / sw;
+
+	// Weighted covariance matrix, excluding symmetries
+	double xx = 0, xy = 0, xz = 0, yy = 0, yz = 0, zz = 0;
+	for (int i = 0; i < n; i++)
+	{
+		if (inliersOnly && !inlier[i])
+			continue;
+		double w = pw[i];
+		double rx = px[i] - cx, ry = py[i] - cy, rz = pz[i] - cz;
+		xx += w * rx * rx;
+		xy += w * rx * ry;
+		xz += w * rx * rz;
+		yy += w * ry * ry;
+		yz += w * ry * rz;
+		zz += w * rz * rz;
+	}
+
+	double det_x = yy*zz - yz*yz;
+	double det_y = xx*zz - xz*xz;
+	double det_z = xx*yy - xy*xy;
+	double det_max = std::max(det_x, std::max(det_y, det_z));
+	if (det_max <= 0)
+		return false;
+
+	// Pick path with best conditioning (as plane_from_points)
+	double nx, ny, nz;
+	if (det_max == det_x) {
+		nx = 1.0;
+		ny = (xz*yz - xy*zz) / det_x;
+		nz = (xy*yz - xz*yy) / det_x;
+	} else if (det_max == det_y) {
+		nx = (yz*xz - xy*zz) / det_y;
+		ny = 1.0;
+		nz = (xy*xz - yz*xx) / det_y;
+	} else {
+		nx = (yz*xy - xz*yy) / det_z;
+		ny = (xz*xy - yz*xx) / det_z;
+		nz = 1.0;
+	}
+	double len = sqrt(nx*nx + ny*ny + nz*nz);
+	if (nz < 0)
+		len = -len;
+	nx /= len;
+	ny /= len;
+	nz /= len;
+	planeEq = ofVec4f(nx, ny, nz, -(nx*cx + ny*cy + nz*cz));
+	return true;
+}
+
+bool PlaneEstimator::estimate(ofVec4f& planeEq)
+{
+	int n = px.size();
+	inlierRatio = 0;
+	if (n < 3)
+	{
+		ofLogVerbose("PlaneEstimator") << "estimate(): At least three points required";
+		return false;
+	}
+	inlier.resize(n);
+
+	// RANSAC: keep the hypothesis with the largest weighted inlier support
+	ofVec4f best;
+	double bestScore = -1;
+	for (int it = 0; it < iterations; it++)
+	{
+		unsigned int i0 = random(n), i1 = random(n), i2 = random(n);
+		ofVec3f p0(px[i0], py[i0], pz[i0]);
+		ofVec3f normal = (ofVec3f(px[i1], py[i1], pz[i1]) - p0).getCrossed(ofVec3f(px[i2], py[i2], pz[i2]) - p0);
+		float len = normal.length();
+		if (len < 1e-6)
+			continue; // Degenerate sample
+		if (normal.z < 0)
+			len = -len;
+		normal = normal / len;
+		ofVec4f hypothesis(normal.x, normal.y, normal.z, -normal.dot(p0));
+
+		double score;
+		countInliers(hypothesis, false, score);
+		if (score > bestScore)
+		{
+			bestScore = score;
+			best = hypothesis;
+		}
+	}
+	if (bestScore <= 0)
+		return false;
+
+	// Refine on the inliers and once more on the inliers of the refined plane
+	double totalWeight = 0;
+	for (int i = 0; i < n; i++)
+		totalWeight += pw[i];
+
+	double inlierWeight;
+	countInliers(best, true, inlierWeight);
+	if (!fitLeastSquares(true, best))
+		return false;
+	countInliers(best, true, inlierWeight);
+	if (!fitLeastSquares(true, best))
+		return false;
+
+	inlierRatio = totalWeight > 0 ? inlierWeight / totalWeight : 0;
+	planeEq = best;
+	ofLogVerbose("PlaneEstimator") << "estimate(): plane " << planeEq << " inlier ratio " << inlierRatio;
+	return true;
+}
+
+SeaLevelMonitor::SeaLevelMonitor()
+: busy(false)
+{
+	// Sub-sampled points are noisier than a full frame - allow a bit more
+	estimator.setInlierDistance(8);
+}
+
+SeaLevelMonitor::~SeaLevelMonitor()
+{
+	stop();
+}
+
+void SeaLevelMonitor::start()
+{
+	startThread(true);
+}
+
+void SeaLevelMonitor::stop()
+{
+	requests.close();
+	results.close();
+	waitForThread(true);
+}
+
+bool SeaLevelMonitor::requestCheck(std::vector<ofVec4f>& points)
+{
+	if (busy)
+		return false;
+	busy = true;
+	requests.send(std::move(points));
+	return true;
+}
+
+void SeaLevelMonitor::threadedFunction()
+{
+	std::vector<ofVec4f> points;
+	while (requests.receive(points))
+	{
+		estimator.clear();
+		for (auto & p : points)
+			estimator.addPoint(p.x, p.y, p.z, p.w);
+
+		SeaLevelCheck check;
+		check.valid = estimator.estimate(check.planeEq);
+		check.inlierRatio = estimator.getInlierRatio();
+		results.send(check);
+		busy = false;
+	}
+}
@@ -0,0 +1,97 @@
+/***********************************************************************
+PlaneEstimator - Robust estimation of the sea level plane and background
+monitoring of its drift.
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#pragma once
+#include "ofMain.h"
+#include <atomic>
+
+// Robust plane fit: RANSAC on random point triples followed by a weighted
+// least squares refinement on the inliers. Moments are accumulated in double
+// precision. The point buffers are kept between calls so no allocation
+// happens once they have grown to the needed size.
+class PlaneEstimator {
+public:
+	PlaneEstimator();
+
+	void clear();
+	void addPoint(float x, float y, float z, float weight);
+	int getNumPoints() const {
+		return px.size();
+	}
+
+	// Fit the plane. The normal of planeEq is oriented toward +z (away from the kinect) like plane_from_points
+	bool estimate(ofVec4f& planeEq);
+
+	// Weighted fraction of the points that were inliers of the last estimate
+	float getInlierRatio() const {
+		return inlierRatio;
+	}
+
+	void setIterations(int it) {
+		iterations = it;
+	}
+	void setInlierDistance(float d) {
+		inlierDistance = d;
+	}
+
+private:
+	bool fitLeastSquares(bool inliersOnly, ofVec4f& planeEq);
+	int countInliers(const ofVec4f& planeEq, bool mark, double& weightSum);
+	unsigned int random(unsigned int n);
+
+	std::vector<float> px, py, pz, pw;
+	std::vector<unsigned char> inlier;
+
+	int iterations; // Number of RANSAC iterations
+	float inlierDistance; // Max distance to the plane of an inlier (mm)
+	float inlierRatio;
+	unsigned int rngState;
+};
+
+// Result of a background sea level check
+struct SeaLevelCheck {
+	bool valid = false;
+	ofVec4f planeEq;
+	float inlierRatio = 0;
+};
+
+// Runs the plane estimator in a background thread on sub-sampled points
+// (x, y, z, weight) sent by the main thread
+class SeaLevelMonitor: public ofThread {
+public:
+	SeaLevelMonitor();
+	~SeaLevelMonitor();
+
+	void start();
+	void stop();
+
+	// Returns false if a check is already running
+	bool requestCheck(std::vector<ofVec4f>& points);
+
+	ofThreadChannel<SeaLevelCheck> results;
+
+private:
+	void threadedFunction() override;
+
+	ofThreadChannel<std::vector<ofVec4f> > requests;
+	PlaneEstimator estimator;
+	std::atomic<bool> busy;
+};
@@ -0,0 +1,175 @@
+/***********************************************************************
+ProjectorKinectLUT - Lookup table from projector pixels to kinect pixels over the current terrain.
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "ProjectorKinectLUT.h"
+
+ProjectorKinectLUT::ProjectorKinectLUT()
+: projWidth(0),
+projHeight(0),
+step(8),
+nodesX(0),
+nodesY(0),
+kinectWidth(0),
+kinectHeight(0),
+ready(false),
+version(0)
+{
+}
+
+void ProjectorKinectLUT::setup(int sprojWidth, int sprojHeight, int sstep)
+{
+	projWidth = sprojWidth;
+	projHeight = sprojHeight;
+	step = sstep;
+	nodesX = (projWidth + step - 1) / step + 1;
+	nodesY = (projHeight + step - 1) / step + 1;
+	kinectX.assign(nodesX * nodesY, 0);
+	kinectY.assign(nodesX * nodesY, 0);
+	worldZ.assign(nodesX * nodesY, 0);
+	valid.assign(nodesX * nodesY, 0);
+	ready = false;
+}
+
+// Same system as KinectProjector::projCoordAndWorldZToWorldCoord
+bool ProjectorKinectLUT::projRayAtZ(const ofMatrix4x4& P, float x, float y, float z, ofVec3f& world) const
+{
+	float a = P(0, 0) - P(2, 0) * x;
+	float b = P(0, 1) - P(2, 1) * x;
+	float c = (P(2, 2) * z + 1) * x - (P(0, 2) * z + P(0, 3));
+	float d = P(1, 0) - P(2, 0) * y;
+	float e = P(1, 1) - P(2, 1) * y;
+	float f = (P(2, 2) * z + 1) * y - (P(1, 2) * z + P(1, 3));
+
+	float det = a * e - b * d;
+	if (det == 0)
+		return false;
+	world.set((c * e - b * f) / det, (a * f - d * c) / det, z);
+	return true;
+}
+
+bool ProjectorKinectLUT::update(const ofMatrix4x4& kinectProjMatrix, const KinectRayTable& rays,
+	const ElevationRaster& raster, const ofVec4f& basePlaneEq)
+{
+	if (nodesX == 0 || !rays.isReady() || !raster.isReady())
+		return false;
+
+	kinectWidth = rays.getWidth();
+	kinectHeight = rays.getHeight();
+	ofVec3f normal(basePlaneEq);
+
+	// Height of the base plane below the kinect, used when a node has no estimate yet
+	float baseZ = basePlaneEq.z != 0 ? -basePlaneEq.w / basePlaneEq.z : 0;
+
+	bool ok = true;
+	for (int ny = 0; ny < nodesY; ny++)
+	{
+		for (int nx = 0; nx < nodesX; nx++)
+		{
+			int i = ny * nodesX + nx;
+			float px = min(nx * step, projWidth);
+			float py = min(ny * step, projHeight);
+			float z = (ready && valid[i]) ? worldZ[i] : baseZ;
+			ofVec2f k(-1, -1);
+			bool inside = false;
+
+			// A few fixed point iterations are enough unless the terrain is very steep
+			for (int it = 0; it < 4; it++)
+			{
+				ofVec3f world;
+				if (!projRayAtZ(kinectProjMatrix, px, py, z, world))
+				{
+					ok = false;
+					break;
+				}
+				k = rays.worldToKinect(world);
+				inside = k.x >= 0 && k.y >= 0 && k.x <= kinectWidth - 1 && k.y <= kinectHeight - 1;
+				if (!inside)
+					break;
+
+				// Point of the kinect ray at the terrain elevation
+				ofVec3f ray = rays.getRay(k.x, k.y);
+				float denom = normal.dot(ray);
+				if (denom == 0)
+					break;
+				float t = -(raster.sample(k.x, k.y) + basePlaneEq.w) / denom;
+				float newZ = ray.z * t;
+				bool converged = fabs(newZ - z) < 1;
+				z = newZ;
+				if (converged)
+					break;
+			}
+			kinectX[i] = k.x;
+			kinectY[i] = k.y;
+			worldZ[i] = z;
+			valid[i] = inside;
+		}
+	}
+	ready = ok;
+	version++;
+	return ok;
+}
+
+bool ProjectorKinectLUT::projToKinect(float x, float y, ofVec2f& kinect) const
+{
+	if (!ready)
+		return false;
+	float fx = ofClamp(x / step, 0, nodesX - 1);
+	float fy = ofClamp(y / step, 0, nodesY - 1);
+	int x0 = min(static_cast<int>(fx), nodesX - 2);
+	int y0 = min(static_cast<int>(fy), nodesY - 2);
+	float ax = fx - x0;
+	float ay = fy - y0;
+	int i = y0 * nodesX + x0;
+	if (!valid[i] || !valid[i + 1] || !valid[i + nodesX] || !valid[i + nodesX + 1])
+		return false;
+
+	float top = kinectX[i] * (1 - ax) + kinectX[i + 1] * ax;
+	float bottom = kinectX[i + nodesX] * (1 - ax) + kinectX[i + nodesX + 1] * ax;
+	kinect.x = top * (1 - ay) + bottom * ay;
+	top = kinectY[i] * (1 - ax) + kinectY[i + 1] * ax;
+	bottom = kinectY[i + nodesX] * (1 - ax) + kinectY[i + nodesX + 1] * ax;
+	kinect.y = top * (1 - ay) + bottom * ay;
+	return true;
+}
+
+ofRectangle ProjectorKinectLUT::getProjectorROI(const ofRectangle& kinectROI) const
+{
+	float minX = projWidth, minY = projHeight, maxX = 0, maxY = 0;
+	bool found = false;
+	for (int ny = 0; ny < nodesY; ny++)
+	{
+		for (int nx = 0; nx < nodesX; nx++)
+		{
+			int i = ny * nodesX + nx;
+			if (!valid[i] || !kinectROI.inside(kinectX[i], kinectY[i]))
+				continue;
+			float px = min(nx * step, projWidth);
+			float py = min(ny * step, projHeight);
+			minX = min(minX, px);
+			minY = min(minY, py);
+			maxX = max(maxX, px);
+			maxY = max(maxY, py);
+			found = true;
+		}
+	}
+	if (!ready || !found)
+		return ofRectangle(0, 0, projWidth, projHeight);
+	return ofRectangle(ofPoint(minX, minY), ofPoint(maxX, maxY));
+}
@@ -0,0 +1,76 @@
+/***********************************************************************
+ProjectorKinectLUT - Lookup table from projector pixels to kinect pixels over the current terrain.
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#pragma once
+#include "ofMain.h"
+#include "KinectRayTable.h"
+#include "ElevationRaster.h"
+
+// Kinect pixel coordinates seen at every node of a regular grid over the projector
+// window, taking the terrain height into account. The kinect position of a node is
+// found by walking along the projector ray: the world point at the current height
+// estimate gives a kinect pixel, whose elevation in the raster gives the next height.
+// Positions between the nodes are interpolated bilinearly.
+class ProjectorKinectLUT {
+public:
+	ProjectorKinectLUT();
+
+	void setup(int projWidth, int projHeight, int step = 8);
+
+	// Recompute all nodes. Returns false if the projection matrix can not be inverted
+	bool update(const ofMatrix4x4& kinectProjMatrix, const KinectRayTable& rays,
+		const ElevationRaster& raster, const ofVec4f& basePlaneEq);
+
+	bool isReady() const {
+		return ready;
+	}
+	// Incremented every time the table is recomputed
+	unsigned int getVersion() const {
+		return version;
+	}
+	int getStep() const {
+		return step;
+	}
+	int getNodesX() const {
+		return nodesX;
+	}
+	int getNodesY() const {
+		return nodesY;
+	}
+
+	// Kinect coordinates seen at projector position (x, y). Returns false outside the kinect frame
+	bool projToKinect(float x, float y, ofVec2f& kinect) const;
+
+	// Bounding box of the projector pixels that see the given kinect area
+	ofRectangle getProjectorROI(const ofRectangle& kinectROI) const;
+
+private:
+	// World point on the projector ray through (x, y) with world z coordinate z
+	bool projRayAtZ(const ofMatrix4x4& P, float x, float y, float z, ofVec3f& world) const;
+
+	int projWidth, projHeight;
+	int step, nodesX, nodesY;
+	int kinectWidth, kinectHeight;
+	bool ready;
+	unsigned int version;
+
+	std::vector<float> kinectX, kinectY, worldZ;
+	std::vector<unsigned char> valid;
+};
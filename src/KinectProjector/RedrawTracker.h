@@ -0,0 +1,76 @@
+/***********************************************************************
+RedrawTracker - Skips framebuffer redraws whose inputs did not change
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#pragma once
+#include "ofMain.h"
+
+// Remembers the inputs used for the last redraw of a framebuffer. The inputs of each
+// frame are collected with add() and compared byte for byte to the remembered ones:
+//     if (tracker.begin().add(depthVersion).add(basePlaneEq).changed()) redraw();
+// Inputs are plain values (numbers, vectors, matrices) or version counters of larger data
+class RedrawTracker {
+public:
+	RedrawTracker()
+	: valid(false) {
+	}
+
+	// Start collecting the inputs of this frame
+	RedrawTracker& begin() {
+		current.clear();
+		return *this;
+	}
+
+	template <typename T>
+	RedrawTracker& add(const T& value) {
+		static_assert(std::is_trivially_copyable<T>::value, "RedrawTracker inputs must be plain values");
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&value);
+		current.insert(current.end(), bytes, bytes + sizeof(T));
+		return *this;
+	}
+	// ofRectangle keeps references to its coordinates, only the values are compared
+	RedrawTracker& add(const ofRectangle& rect) {
+		return add(rect.x).add(rect.y).add(rect.width).add(rect.height);
+	}
+	RedrawTracker& add(const ofMatrix4x4& matrix) {
+		const float* values = matrix.getPtr();
+		for (int i = 0; i < 16; i++)
+			add(values[i]);
+		return *this;
+	}
+
+	// True when the inputs differ from the last redraw, or after invalidate(). The
+	// inputs are then remembered, so the caller has to redraw
+	bool changed() {
+		if (valid && current == last)
+			return false;
+		std::swap(current, last);
+		valid = true;
+		return true;
+	}
+
+	// Force the next redraw, for changes that are not tracked as inputs
+	void invalidate() {
+		valid = false;
+	}
+
+private:
+	std::vector<unsigned char> current, last;
+	bool valid;
+};
@@ -0,0 +1,168 @@
+/***********************************************************************
+SandboxWallDetector - Single pass detection of the sandbox walls in the depth image.
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "SandboxWallDetector.h"
+#include "ofxOpenCv.h"
+
+void SandboxWallDetector::quantise(const float* depth, int size, float scaleMin, float scaleMax, unsigned char* out)
+{
+	float scale = (scaleMax != scaleMin) ? 1.0f / (scaleMax - scaleMin) : 0;
+	for (int i = 0; i < size; i++)
+	{
+		float v = ofClamp((depth[i] - scaleMin) * scale, 0, 1);
+		out[i] = static_cast<unsigned char>(v * 255);
+	}
+}
+
+int SandboxWallDetector::find(std::vector<int>& parent, int i)
+{
+	while (parent[i] != i)
+	{
+		parent[i] = parent[parent[i]]; // Path halving
+		i = parent[i];
+	}
+	return i;
+}
+
+SandboxWalls SandboxWallDetector::detect(const std::vector<unsigned char>& levels, int width, int height, ofVec2f seed, int minArea)
+{
+	SandboxWalls walls;
+	walls.found = false;
+	walls.level = -1;
+	walls.area = 0;
+
+	int size = width * height;
+	int sx = ofClamp(seed.x, 0, width - 1);
+	int sy = ofClamp(seed.y, 0, height - 1);
+	int s = sx + sy * width;
+	if (size == 0 || static_cast<int>(levels.size()) < size)
+		return walls;
+
+	// Bucket the pixels by key, no data pixels first (key 256) then by decreasing level
+	std::vector<int> start(258, 0);
+	for (int i = 0; i < size; i++)
+	{
+		int key = levels[i] == 0 ? 256 : levels[i];
+		start[key + 1]++;
+	}
+	for (int k = 0; k < 257; k++)
+		start[k + 1] += start[k];
+	std::vector<int> order(size);
+	std::vector<int> pos(start.begin(), start.end() - 1);
+	for (int i = 0; i < size; i++)
+	{
+		int key = levels[i] == 0 ? 256 : levels[i];
+		order[pos[key]++] = i;
+	}
+
+	std::vector<int> parent(size, -1); // -1: not yet added
+	std::vector<int> area(size, 0);
+	std::vector<unsigned char> border(size, 0);
+	std::vector<ofRectangle> boxes(size);
+
+	for (int k = 256; k >= 1; k--)
+	{
+		for (int j = start[k]; j < start[k + 1]; j++)
+		{
+			int i = order[j];
+			int x = i % width;
+			int y = i / width;
+			parent[i] = i;
+			area[i] = 1;
+			border[i] = (x == 0 || y == 0 || x == width - 1 || y == height - 1);
+			boxes[i].set(x, y, 1, 1);
+
+			// Holes in the 8-connected wall blobs are 4-connected
+			const int neighbours[4] = { x > 0 ? i - 1 : -1, x < width - 1 ? i + 1 : -1, y > 0 ? i - width : -1, y < height - 1 ? i + width : -1 };
+			for (int n : neighbours)
+			{
+				if (n < 0 || parent[n] < 0)
+					continue;
+				int a = find(parent, i);
+				int b = find(parent, n);
+				if (a == b)
+					continue;
+				if (area[a] < area[b])
+					std::swap(a, b);
+				parent[b] = a;
+				area[a] += area[b];
+				border[a] |= border[b];
+				boxes[a].growToInclude(boxes[b]);
+			}
+		}
+
+		// Pixels with a key above k form the area below the threshold level k - 1
+		if (k > 255 || parent[s] < 0)
+			continue;
+		int r = find(parent, s);
+		if (border[r]) // The seed area is not enclosed anymore and only grows from here
+			break;
+		if (area[r] >= minArea && area[r] > walls.area)
+		{
+			walls.found = true;
+			walls.level = k - 1;
+			walls.area = area[r];
+			walls.boundingBox = boxes[r];
+			// The hole contours of the threshold sweep ran along the wall pixels
+			walls.boundingBox.x -= 1;
+			walls.boundingBox.y -= 1;
+			walls.boundingBox.width += 2;
+			walls.boundingBox.height += 2;
+		}
+	}
+	if (!walls.found)
+		return walls;
+
+	// Contour of the seed component at the selected level
+	cv::Mat mask(height, width, CV_8UC1, cv::Scalar(0));
+	std::vector<int> stack(1, s);
+	mask.data[s] = 255;
+	while (!stack.empty())
+	{
+		int i = stack.back();
+		stack.pop_back();
+		int x = i % width;
+		int y = i / width;
+		const int neighbours[4] = { x > 0 ? i - 1 : -1, x < width - 1 ? i + 1 : -1, y > 0 ? i - width : -1, y < height - 1 ? i + width : -1 };
+		for (int n : neighbours)
+		{
+			if (n < 0 || mask.data[n])
+				continue;
+			if (levels[n] != 0 && levels[n] <= walls.level)
+				continue;
+			mask.data[n] = 255;
+			stack.push_back(n);
+		}
+	}
+
+	std::vector<std::vector<cv::Point> > contours;
+	cv::findContours(mask, contours, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_NONE);
+	for (auto & c : contours)
+	{
+		if (c.size() > walls.contour.size())
+		{
+			walls.contour.clear();
+			for (auto & p : c)
+				walls.contour.addVertex(p.x, p.y);
+			walls.contour.close();
+		}
+	}
+	return walls;
+}
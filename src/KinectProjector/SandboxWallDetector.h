@@ -0,0 +1,47 @@
+/***********************************************************************
+SandboxWallDetector - Single pass detection of the sandbox walls in the depth image.
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#pragma once
+#include "ofMain.h"
+
+struct SandboxWalls {
+	bool found;
+	ofPolyline contour;      // Contour of the area enclosed by the walls
+	ofRectangle boundingBox;
+	int level;               // Quantised depth level at which the area is enclosed
+	int area;                // Number of pixels in the area
+};
+
+// Finds the largest area around a seed point that is enclosed by the sandbox walls.
+// This is the area given by the hole contour around the seed found when thresholding
+// the quantised depth image at every level from the bottom up, computed in a single
+// pass: the pixels are added by decreasing level to a union-find forest and the
+// component of the seed is followed until it leaks through the walls to the image border.
+class SandboxWallDetector {
+public:
+	// Quantise a depth image to 0-255 like ofxCvFloatImage::convertToRange(0, 1) followed by the 8 bits conversion
+	static void quantise(const float* depth, int size, float scaleMin, float scaleMax, unsigned char* out);
+
+	// Pixels with a level of 0 (no data) are never part of the walls
+	static SandboxWalls detect(const std::vector<unsigned char>& levels, int width, int height, ofVec2f seed, int minArea = 12);
+
+private:
+	static int find(std::vector<int>& parent, int i);
+};
@@ -0,0 +1,192 @@
+/***********************************************************************
+StructuredLightCoder - Gray code and phase shift patterns for dense projector calibration.
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "StructuredLightCoder.h"
+
+StructuredLightCoder::StructuredLightCoder()
+{
+	setup(1024, 768);
+}
+
+void StructuredLightCoder::setup(int sprojWidth, int sprojHeight, int speriod, int sphaseSteps)
+{
+	projWidth = sprojWidth;
+	projHeight = sprojHeight;
+	period = speriod;
+	phaseSteps = sphaseSteps;
+	bitsX = grayBits(projWidth);
+	bitsY = grayBits(projHeight);
+}
+
+// Number of bits needed to index the half periods along an axis
+int StructuredLightCoder::grayBits(int size) const
+{
+	int halfPeriods = (size + period / 2 - 1) / (period / 2);
+	int bits = 1;
+	while ((1 << bits) < halfPeriods)
+		bits++;
+	return bits;
+}
+
+int StructuredLightCoder::getNumPatterns() const
+{
+	return 2 + bitsX + bitsY + 2 * phaseSteps;
+}
+
+unsigned char StructuredLightCoder::patternValue(int index, int coord, bool& columns) const
+{
+	columns = true;
+	if (index == 0)
+		return 255;
+	if (index == 1)
+		return 0;
+	index -= 2;
+	if (index < bitsX + bitsY)
+	{
+		int bits = bitsX;
+		if (index >= bitsX)
+		{
+			index -= bitsX;
+			bits = bitsY;
+			columns = false;
+		}
+		int halfPeriod = coord / (period / 2);
+		int gray = halfPeriod ^ (halfPeriod >> 1);
+		return ((gray >> (bits - 1 - index)) & 1) ? 255 : 0;
+	}
+	index -= bitsX + bitsY;
+	if (index >= phaseSteps)
+	{
+		index -= phaseSteps;
+		columns = false;
+	}
+	// I_k = A + B cos(phi - 2 pi k / N), sampled at the pixel centers
+	float phi = TWO_PI * (coord + 0.5f) / period;
+	float v = 127.5f + 127.5f * cos(phi - TWO_PI * index / phaseSteps);
+	return static_cast<unsigned char>(ofClamp(v + 0.5f, 0, 255));
+}
+
+void StructuredLightCoder::getPattern(int index, ofPixels& pattern) const
+{
+	bool columns;
+	patternValue(index, 0, columns);
+	int size = columns ? projWidth : projHeight;
+	if (columns)
+		pattern.allocate(projWidth, 1, OF_PIXELS_GRAY);
+	else
+		pattern.allocate(1, projHeight, OF_PIXELS_GRAY);
+	unsigned char* data = pattern.getData();
+	for (int i = 0; i < size; i++)
+		data[i] = patternValue(index, i, columns);
+}
+
+// Reads the Gray code bits of an axis and converts them to the binary half period index
+void StructuredLightCoder::decodeGray(const std::vector<cv::Mat>& captures, int first, int bits, const cv::Mat& threshold, cv::Mat& index) const
+{
+	cv::Mat bit, binary;
+	index = cv::Mat::zeros(threshold.size(), CV_32S);
+	binary = cv::Mat::zeros(threshold.size(), CV_8U);
+	for (int b = 0; b < bits; b++)
+	{
+		cv::Mat capture;
+		captures[first + b].convertTo(capture, CV_32F);
+		cv::compare(capture, threshold, bit, cv::CMP_GT);
+		// Binary bit b = binary bit b-1 XOR gray bit b
+		cv::bitwise_xor(binary, bit, binary);
+		cv::add(index, cv::Scalar(1 << (bits - 1 - b)), index, binary);
+	}
+}
+
+// Phase of the sinusoid in [0, 2 pi) and its amplitude
+void StructuredLightCoder::decodePhase(const std::vector<cv::Mat>& captures, int first, cv::Mat& phase, cv::Mat& modulation) const
+{
+	cv::Size size = captures[first].size();
+	cv::Mat s = cv::Mat::zeros(size, CV_32F);
+	cv::Mat c = cv::Mat::zeros(size, CV_32F);
+	for (int k = 0; k < phaseSteps; k++)
+	{
+		cv::Mat capture;
+		captures[first + k].convertTo(capture, CV_32F);
+		float delta = TWO_PI * k / phaseSteps;
+		cv::scaleAdd(capture, sin(delta), s, s);
+		cv::scaleAdd(capture, cos(delta), c, c);
+	}
+	cv::phase(c, s, phase);
+	cv::magnitude(c, s, modulation);
+	modulation *= 2.0 / phaseSteps;
+}
+
+void StructuredLightCoder::combine(const cv::Mat& index, const cv::Mat& phase, int size, cv::Mat& coord, cv::Mat& valid) const
+{
+	coord.create(index.size(), CV_32F);
+	float quarter = period / 4.0f;
+	float scale = period / TWO_PI;
+	for (int y = 0; y < index.rows; y++)
+	{
+		const int* idx = index.ptr<int>(y);
+		const float* ph = phase.ptr<float>(y);
+		float* out = coord.ptr<float>(y);
+		unsigned char* ok = valid.ptr<unsigned char>(y);
+		for (int x = 0; x < index.cols; x++)
+		{
+			float f = ph[x] * scale;
+			int half = idx[x] & 1;
+			// A misread Gray code at the edge of a period is off by one half period
+			int k = (idx[x] >> 1) + (half & (f < quarter)) - ((1 - half) & (f > 3 * quarter));
+			float c = k * period + f;
+			out[x] = c;
+			ok[x] &= (c >= 0 && c < size) ? 255 : 0;
+		}
+	}
+}
+
+StructuredLightDecoding StructuredLightCoder::decode(const std::vector<cv::Mat>& captures, float minContrast) const
+{
+	StructuredLightDecoding decoding;
+	decoding.numValid = 0;
+	if (captures.size() != static_cast<size_t>(getNumPatterns()))
+	{
+		ofLogVerbose("StructuredLightCoder") << "decode(): Expected " << getNumPatterns() << " captures, got " << captures.size();
+		return decoding;
+	}
+
+	// The mean of the white and black images separates the lit and unlit pixels
+	cv::Mat white, black, threshold, contrast;
+	captures[0].convertTo(white, CV_32F);
+	captures[1].convertTo(black, CV_32F);
+	cv::addWeighted(white, 0.5, black, 0.5, 0, threshold);
+	contrast = white - black;
+	cv::compare(contrast, minContrast, decoding.valid, cv::CMP_GT);
+
+	cv::Mat indexX, indexY, phaseX, phaseY, modulationX, modulationY, sinusoidOk;
+	decodeGray(captures, 2, bitsX, threshold, indexX);
+	decodeGray(captures, 2 + bitsX, bitsY, threshold, indexY);
+	decodePhase(captures, 2 + bitsX + bitsY, phaseX, modulationX);
+	decodePhase(captures, 2 + bitsX + bitsY + phaseSteps, phaseY, modulationY);
+
+	// The sinusoids have half the amplitude of the white - black contrast
+	cv::compare(cv::min(modulationX, modulationY), minContrast / 4, sinusoidOk, cv::CMP_GT);
+	cv::bitwise_and(decoding.valid, sinusoidOk, decoding.valid);
+
+	combine(indexX, phaseX, projWidth, decoding.projX, decoding.valid);
+	combine(indexY, phaseY, projHeight, decoding.projY, decoding.valid);
+	decoding.numValid = cv::countNonZero(decoding.valid);
+	return decoding;
+}
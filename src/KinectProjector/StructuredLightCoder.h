@@ -0,0 +1,64 @@
+/***********************************************************************
+StructuredLightCoder - Gray code and phase shift patterns for dense projector calibration.
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#pragma once
+#include "ofMain.h"
+#include "ofxCv.h"
+
+// Projector coordinates seen by every pixel of the camera image
+struct StructuredLightDecoding {
+	cv::Mat projX;	// CV_32F
+	cv::Mat projY;	// CV_32F
+	cv::Mat valid;	// CV_8U, 255 where both coordinates were decoded
+	int numValid;
+};
+
+// Temporal coding of the projector columns and rows.
+// The Gray code gives the index of each half period of a sinusoid and the phase shift
+// patterns give the sub pixel position inside the period. The finest Gray code bit is
+// used to correct the period index where the Gray code is misread at the stripe edges.
+// Pattern order: white, black, column Gray code bits (MSB first), row Gray code bits,
+// column phase shifts and row phase shifts.
+class StructuredLightCoder {
+public:
+	StructuredLightCoder();
+
+	void setup(int projWidth, int projHeight, int period = 16, int phaseSteps = 4);
+	int getNumPatterns() const;
+
+	// The patterns only vary along one axis: a projWidth x 1 line for the column patterns
+	// and a 1 x projHeight line for the row patterns, to be stretched over the projector
+	void getPattern(int index, ofPixels& pattern) const;
+
+	// The captures are the gray camera images of every pattern, in order
+	StructuredLightDecoding decode(const std::vector<cv::Mat>& captures, float minContrast = 20) const;
+
+private:
+	int grayBits(int size) const;
+	unsigned char patternValue(int index, int coord, bool& columns) const;
+	void decodeGray(const std::vector<cv::Mat>& captures, int first, int bits, const cv::Mat& threshold, cv::Mat& index) const;
+	void decodePhase(const std::vector<cv::Mat>& captures, int first, cv::Mat& phase, cv::Mat& modulation) const;
+	void combine(const cv::Mat& index, const cv::Mat& phase, int size, cv::Mat& coord, cv::Mat& valid) const;
+
+	int projWidth, projHeight;
+	int period;
+	int phaseSteps;
+	int bitsX, bitsY;
+};
@@ -30,7 +30,10 @@ CTemporalFrameFilter::CTemporalFrameFilter()
 {
 	medianImg = nullptr;
 	imgDataBuffer = nullptr;
-	imgDataBufferCol = nullptr;
+	medianHistogram = nullptr;
+	medianUpToDate = false;
+	colSumBuffer = nullptr;
+	colRunningSum = nullptr;
 	currentFrame = 0;
 	validBuffer = false;
 	sizeX = 0;
@@ -49,9 +52,25 @@ void CTemporalFrameFilter::Init(int sx, int sy, int frames)
 	sizeX = sx;
 	sizeY = sy;
 	nFrames = frames;
-	imgDataBuffer = new unsigned char[sx * sy * frames];
 	medianImg = new unsigned char[sx * sy];
-	imgDataBufferCol = new unsigned char[sx * sy * 3 * frames];
+	validBuffer = false;
+	currentFrame = 0;
+}
+
+// The frame buffers are only allocated for the type of filtering that is used
+void CTemporalFrameFilter::AllocateMedianBuffers()
+{
+	imgDataBuffer = new unsigned char[sizeX * sizeY * nFrames];
+	medianHistogram = new unsigned short[sizeX * sizeY * MEDIAN_BINS]();
+	medianUpToDate = false;
+	validBuffer = false;
+	currentFrame = 0;
+}
+
+void CTemporalFrameFilter::AllocateAverageBuffers()
+{
+	colSumBuffer = new unsigned short[sizeX * sizeY * nFrames];
+	colRunningSum = new unsigned int[sizeX * sizeY]();
 	validBuffer = false;
 	currentFrame = 0;
 }
@@ -61,17 +80,26 @@ void CTemporalFrameFilter::NewFrame(unsigned char* imgData, int sx, int sy, int
 	if (!imgDataBuffer)
 	{
 		ofLogVerbose("CTemporalFrameFilter") << "NewFrame(): No buffer allocated: allocating";
-		Init(sx, sy, nFrames);
+		if (!medianImg)
+			Init(sx, sy, nFrames);
+		AllocateMedianBuffers();
 	}
-	int offset = currentFrame * sizeX * sizeY;
-	for (int i = 0; i < sizeX *sizeY; i++)
+	// The buffer is pixel major so the values of one pixel are contiguous. The coarse
+	// histograms of the values in the buffer are updated with the frame that leaves it
+	unsigned char *frameValue = imgDataBuffer + currentFrame;
+	unsigned short *hist = medianHistogram;
+	for (int i = 0; i < sizeX *sizeY; i++, frameValue += this->nFrames, hist += MEDIAN_BINS)
 	{
 		unsigned char R = imgData[3*i];
 		unsigned char G = imgData[3 * i+1];
 		unsigned char B = imgData[3 * i+2];
-		double IV = (R + G + B) / 3;
-		imgDataBuffer[offset + i] = (unsigned char)IV;
+		unsigned char IV = (unsigned char)((R + G + B) / 3);
+		if (validBuffer)
+			hist[*frameValue >> MEDIAN_BIN_SHIFT]--;
+		hist[IV >> MEDIAN_BIN_SHIFT]++;
+		*frameValue = IV;
 	}
+	medianUpToDate = false;
 
 	currentFrame++;
 	if (currentFrame >= nFrames)
@@ -84,20 +112,23 @@ void CTemporalFrameFilter::NewFrame(unsigned char* imgData, int sx, int sy, int
 
 void CTemporalFrameFilter::NewColFrame(unsigned char* imgData, int sx, int sy, int nFrames /*= 15*/)
 {
-	if (!imgDataBufferCol)
+	if (!colSumBuffer)
 	{
-		std::cerr << "CTemporalFrameFilter::NewFrame: No color buffer allocated: allocating" << std::endl;
-		Init(sx, sy, nFrames);
+		ofLogVerbose("CTemporalFrameFilter") << "NewColFrame(): No color buffer allocated: allocating";
+		if (!medianImg)
+			Init(sx, sy, nFrames);
+		AllocateAverageBuffers();
 	}
-	int offset = currentFrame * sizeX * sizeY * 3;
+	// Only R + G + B is needed for the average intensity. The running sums are
+	// updated with the sum of the frame that leaves the buffer
+	unsigned short *frameSum = colSumBuffer + currentFrame * sizeX * sizeY;
 	for (int i = 0; i < sizeX *sizeY; i++)
 	{
-		unsigned char R = imgData[3 * i];
-		unsigned char G = imgData[3 * i + 1];
-		unsigned char B = imgData[3 * i + 2];
-		imgDataBufferCol[offset + 3 * i + 0] = R;
-		imgDataBufferCol[offset + 3 * i + 1] = G;
-		imgDataBufferCol[offset + 3 * i + 2] = B;
+		unsigned short sum = imgData[3 * i] + imgData[3 * i + 1] + imgData[3 * i + 2];
+		if (validBuffer)
+			colRunningSum[i] -= frameSum[i];
+		colRunningSum[i] += sum;
+		frameSum[i] = sum;
 	}
 	currentFrame++;
 	if (currentFrame >= nFrames)
@@ -125,37 +156,50 @@ void CTemporalFrameFilter::ClearData()
 		delete[] imgDataBuffer;
 		imgDataBuffer = nullptr;
 	}
+	if (medianHistogram)
+	{
+		delete[] medianHistogram;
+		medianHistogram = nullptr;
+	}
 	if (medianImg)
 	{
 		delete[] medianImg;
 		medianImg = nullptr;
 	}
-	if (imgDataBufferCol)
+	if (colSumBuffer)
+	{
+		delete[] colSumBuffer;
+		colSumBuffer = nullptr;
+	}
+	if (colRunningSum)
 	{
-		delete[] imgDataBufferCol;
-		imgDataBufferCol = nullptr;
+		delete[] colRunningSum;
+		colRunningSum = nullptr;
 	}
 
 	currentFrame = 0;
 	validBuffer = false;
 }
 
-// https://stackoverflow.com/questions/1719070/what-is-the-right-approach-when-using-stl-container-for-median-calculation
-template <typename T = double, typename C>
-inline const T median(const C &the_container)
+// k-th smallest (from 0) of the buffered values of a pixel. The coarse histogram gives
+// the bin of the value and only the values falling in that bin are looked at again
+inline int CTemporalFrameFilter::selectValue(const unsigned char* values, const unsigned short* hist, int k) const
 {
-	std::vector<T> tmp_array(std::begin(the_container),
-		std::end(the_container));
-	size_t n = tmp_array.size() / 2;
-	std::nth_element(tmp_array.begin(), tmp_array.begin() + n, tmp_array.end());
+	int bin = 0;
+	while (k >= hist[bin])
+		k -= hist[bin++];
 
-	if (tmp_array.size() % 2) { return tmp_array[n]; }
-	else
+	unsigned short fine[1 << MEDIAN_BIN_SHIFT] = { 0 };
+	for (int f = 0; f < nFrames; f++)
 	{
-		// even sized vector -> average the two middle values
-		auto max_it = std::max_element(tmp_array.begin(), tmp_array.begin() + n);
-		return (*max_it + tmp_array[n]) / 2.0;
+		if ((values[f] >> MEDIAN_BIN_SHIFT) == bin)
+			fine[values[f] & ((1 << MEDIAN_BIN_SHIFT) - 1)]++;
 	}
+	int v = 0;
+	while (k >= fine[v])
+		k -= fine[v++];
+
+	return (bin << MEDIAN_BIN_SHIFT) + v;
 }
 
 unsigned char* CTemporalFrameFilter::getMedianFilteredImage()
@@ -170,6 +214,7 @@ unsigned char* CTemporalFrameFilter::getAverageFilteredColImage()
 {
 	if (!ComputeAverageImageCol())
 		return nullptr;
+	medianUpToDate = false; // The image buffer is shared
 
 	return medianImg;
 
@@ -179,24 +224,23 @@ bool CTemporalFrameFilter::ComputeMedianImage()
 {
 	if (!validBuffer)
 		return false;
+	if (medianUpToDate)
+		return true;
 
-	std::vector<unsigned char> tvals(nFrames);
-	
-	for (int y = 0; y < sizeY; y++)
+	int n = nFrames / 2;
+	const unsigned char *values = imgDataBuffer;
+	const unsigned short *hist = medianHistogram;
+	for (int i = 0; i < sizeX * sizeY; i++, values += nFrames, hist += MEDIAN_BINS)
 	{
-		for (int x = 0; x < sizeX; x++)
+		int med = selectValue(values, hist, n);
+		if (nFrames % 2 == 0)
 		{
-			for (int f = 0; f < nFrames; f++)
-			{
-				int offset = f * sizeX * sizeY;
-				int idx = offset + y*sizeX + x;
-				tvals[f] = imgDataBuffer[idx];
-			}
-			unsigned char med = (unsigned char)median(tvals);
-			int idx2 = y*sizeX + x;	
-			medianImg[idx2] = med;
+			// even sized buffer -> average the two middle values
+			med = (selectValue(values, hist, n - 1) + med) / 2;
 		}
+		medianImg[i] = (unsigned char)med;
 	}
+	medianUpToDate = true;
 
 	return true;
 }
@@ -206,34 +250,9 @@ bool CTemporalFrameFilter::ComputeAverageImageCol()
 	if (!validBuffer && nFrames > 0)
 		return false;
 
-	for (int y = 0; y < sizeY; y++)
-	{
-		for (int x = 0; x < sizeX; x++)
-		{
-			double RSum = 0;
-			double GSum = 0;
-			double BSum = 0;
-			for (int f = 0; f < nFrames; f++)
-			{
-				int offset = f * sizeX * sizeY * 3;
-				int idx = offset + (y*sizeX + x) * 3;
-				unsigned char R = imgDataBufferCol[idx + 0];
-				unsigned char G = imgDataBufferCol[idx + 1];
-				unsigned char B = imgDataBufferCol[idx + 2];
-
-				RSum += R;				
-				GSum += G;				
-				BSum += B;
-			}
-			RSum /= nFrames;
-			GSum /= nFrames;
-			BSum /= nFrames;
-
-			unsigned char val = (unsigned char)((RSum + GSum + BSum) / 3.0);
-			int idx2 = y*sizeX + x;
-			medianImg[idx2] = val;
-		}
-	}
+	unsigned int count = 3 * nFrames;
+	for (int i = 0; i < sizeX * sizeY; i++)
+		medianImg[i] = (unsigned char)(colRunningSum[i] / count);
 
 	return true;
 }
@@ -47,20 +47,37 @@ class CTemporalFrameFilter
 		unsigned char* getAverageFilteredColImage();
 
 	private:
+		// Buffered intensities, pixel major: the nFrames values of a pixel are contiguous
 		unsigned char *imgDataBuffer;
 
+		// Per pixel running histograms of the buffered values with MEDIAN_BINS coarse bins.
+		// A bin can hold all the frames of the buffer, which can be more than 255
+		static const int MEDIAN_BIN_SHIFT = 4;
+		static const int MEDIAN_BINS = 256 >> MEDIAN_BIN_SHIFT;
+		unsigned short *medianHistogram;
+
+		bool medianUpToDate;
+
 		unsigned char *medianImg;
 
-		unsigned char *imgDataBufferCol;
+		// R + G + B of the buffered color frames and their running sum per pixel
+		unsigned short *colSumBuffer;
+		unsigned int *colRunningSum;
 
 		int currentFrame;
 
 		bool validBuffer;
 
 		void ClearData();
+
+		void AllocateMedianBuffers();
+
+		void AllocateAverageBuffers();
 		
 		bool ComputeMedianImage();
 
+		int selectValue(const unsigned char* values, const unsigned short* hist, int k) const;
+
 		bool ComputeAverageImageCol();
 
 		int sizeX;
@@ -0,0 +1,163 @@
+/***********************************************************************
+ThumbnailService - Encodes downscaled kinect color frames for the websocket clients
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "ThumbnailService.h"
+
+ThumbnailService::ThumbnailService()
+	: factor(2), format(OF_IMAGE_FORMAT_PNG), cachedSequence(0), latestSequence(0), encodingSequence(0), waiting(0)
+{
+}
+
+ThumbnailService::~ThumbnailService()
+{
+	stop();
+}
+
+void ThumbnailService::setup(int downscale, ofImageFormat sformat)
+{
+	factor = std::max(downscale, 1);
+	format = sformat;
+}
+
+void ThumbnailService::start()
+{
+	startThread(true);
+}
+
+void ThumbnailService::stop()
+{
+	jobs.close();
+	waitForThread(true);
+	cacheChanged.notify_all();
+}
+
+void ThumbnailService::update(const ofPixels& frame, uint64_t sequence)
+{
+	{
+		std::lock_guard<std::mutex> lock(cacheMutex);
+		latestSequence = sequence;
+		if (waiting == 0 || sequence <= cachedSequence || sequence <= encodingSequence || !frame.isAllocated())
+			return;
+		encodingSequence = sequence;
+	}
+
+	Job job;
+	job.frame = frame;
+	job.sequence = sequence;
+	jobs.send(std::move(job));
+}
+
+std::string ThumbnailService::getThumbnail(uint64_t timeoutMs)
+{
+	std::unique_lock<std::mutex> lock(cacheMutex);
+	if (!cached.empty() && cachedSequence >= latestSequence)
+		return cached;
+
+	uint64_t known = cachedSequence;
+	waiting++;
+	cacheChanged.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this, known] {
+		return cachedSequence > known || !isThreadRunning();
+	});
+	waiting--;
+	return cached;
+}
+
+void ThumbnailService::threadedFunction()
+{
+	Job job;
+	while (jobs.receive(job))
+	{
+		uint64_t start = ofGetElapsedTimeMillis();
+		ofPixels thumbnail;
+		downscale(job.frame, thumbnail);
+		ofBuffer buffer;
+		ofSaveImage(thumbnail, buffer, format, OF_IMAGE_QUALITY_MEDIUM);
+		std::string encoded = base64(buffer);
+		ofLogVerbose("ThumbnailService") << "threadedFunction(): Frame " << job.sequence << " encoded in "
+			<< ofGetElapsedTimeMillis() - start << " ms, " << encoded.size() << " bytes";
+
+		std::lock_guard<std::mutex> lock(cacheMutex);
+		if (job.sequence > cachedSequence)
+		{
+			cached = std::move(encoded);
+			cachedSequence = job.sequence;
+		}
+		cacheChanged.notify_all();
+	}
+}
+
+// Box filter over factor x factor blocks
+void ThumbnailService::downscale(const ofPixels& frame, ofPixels& thumbnail) const
+{
+	int channels = frame.getNumChannels();
+	int w = frame.getWidth() / factor;
+	int h = frame.getHeight() / factor;
+	int srcW = frame.getWidth();
+	thumbnail.allocate(w, h, channels);
+
+	const unsigned char* src = frame.getData();
+	unsigned char* dst = thumbnail.getData();
+	int area = factor * factor;
+	std::vector<int> sum(w * channels);
+	for (int y = 0; y < h; y++)
+	{
+		std::fill(sum.begin(), sum.end(), 0);
+		for (int dy = 0; dy < factor; dy++)
+		{
+			const unsigned char* row = src + (y * factor + dy) * srcW * channels;
+			for (int x = 0; x < w * factor; x++)
+				for (int c = 0; c < channels; c++)
+					sum[(x / factor) * channels + c] += row[x * channels + c];
+		}
+		for (int i = 0; i < w * channels; i++)
+			dst[y * w * channels + i] = (sum[i] + area / 2) / area;
+	}
+}
+
+// Without line breaks, as the clients expect it
+std::string ThumbnailService::base64(const ofBuffer& buffer)
+{
+	static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	const unsigned char* data = reinterpret_cast<const unsigned char*>(buffer.getData());
+	size_t size = buffer.size();
+
+	std::string out;
+	out.reserve((size + 2) / 3 * 4);
+	size_t i = 0;
+	for (; i + 2 < size; i += 3)
+	{
+		uint32_t v = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+		out += table[v >> 18];
+		out += table[(v >> 12) & 63];
+		out += table[(v >> 6) & 63];
+		out += table[v & 63];
+	}
+	if (i < size)
+	{
+		uint32_t v = data[i] << 16;
+		if (i + 1 < size)
+			v |= data[i + 1] << 8;
+		out += table[v >> 18];
+		out += table[(v >> 12) & 63];
+		out += i + 1 < size ? table[(v >> 6) & 63] : '=';
+		out += '=';
+	}
+	return out;
+}
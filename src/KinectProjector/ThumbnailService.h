@@ -0,0 +1,65 @@
+/***********************************************************************
+ThumbnailService - Encodes downscaled kinect color frames for the websocket clients
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#pragma once
+#include "ofMain.h"
+
+// Base64 encoded, downscaled images of the kinect color frames. Frames are only
+// encoded when a client asks for one, in a worker thread, and the result is cached
+// until a newer frame arrives. Clients asking for the same frame share one encode
+class ThumbnailService: public ofThread {
+public:
+	ThumbnailService();
+	~ThumbnailService();
+
+	void setup(int downscale = 2, ofImageFormat format = OF_IMAGE_FORMAT_PNG);
+	void start();
+	void stop();
+
+	// Main thread, every update. The frame is only copied when a client is waiting for it
+	void update(const ofPixels& frame, uint64_t sequence);
+
+	// Any thread. Waits for the encoding of a frame newer than the cached one,
+	// returns the cached image (possibly empty) when none arrives before the timeout
+	std::string getThumbnail(uint64_t timeoutMs = 500);
+
+private:
+	struct Job {
+		ofPixels frame;
+		uint64_t sequence;
+	};
+
+	void threadedFunction() override;
+	void downscale(const ofPixels& frame, ofPixels& thumbnail) const;
+	static std::string base64(const ofBuffer& buffer);
+
+	int factor;
+	ofImageFormat format;
+
+	std::mutex cacheMutex;
+	std::condition_variable cacheChanged;
+	std::string cached;        // Encoded image of frame cachedSequence
+	uint64_t cachedSequence;
+	uint64_t latestSequence;   // Last frame seen by update()
+	uint64_t encodingSequence; // Last frame handed to the worker
+	int waiting;               // Clients waiting for a new image
+
+	ofThreadChannel<Job> jobs;
+};
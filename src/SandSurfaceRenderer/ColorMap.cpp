@@ -23,7 +23,93 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 
 #include "ColorMap.h"
 
+ColorLookupTable::ColorLookupTable()
+:minHeight(0),
+step(1),
+invStep(1),
+count(0),
+data(nullptr){
+    allocate(1);
+}
+
+ColorLookupTable::ColorLookupTable(const ColorLookupTable& other)
+:minHeight(other.minHeight),
+step(other.step),
+invStep(other.invStep),
+count(0),
+data(nullptr){
+    allocate(other.count);
+    std::copy(other.data, other.data + count, data);
+}
+
+ColorLookupTable& ColorLookupTable::operator=(const ColorLookupTable& other){
+    if (this != &other){
+        minHeight = other.minHeight;
+        step = other.step;
+        invStep = other.invStep;
+        allocate(other.count);
+        std::copy(other.data, other.data + count, data);
+    }
+    return *this;
+}
+
+void ColorLookupTable::allocate(int scount){
+    count = std::max(scount, 1);
+    // 15 spare elements to move the start to a 64 byte boundary
+    storage.assign(count + 15, 0);
+    uintptr_t start = reinterpret_cast<uintptr_t>(storage.data());
+    data = storage.data() + ((64 - start % 64) % 64) / sizeof(uint32_t);
+}
+
+void ColorLookupTable::setup(float sminHeight, float maxHeight, float sstep){
+    minHeight = sminHeight;
+    step = sstep > 0 ? sstep : 1;
+    invStep = 1.0f / step;
+    allocate((int)std::ceil((maxHeight - minHeight) * invStep - 1e-4f) + 1);
+}
+
+uint32_t ColorLookupTable::pack(const ofColor& color){
+    unsigned char rgba[4] = { color.r, color.g, color.b, color.a };
+    uint32_t packed;
+    memcpy(&packed, rgba, 4);
+    return packed;
+}
+
+ofColor ColorLookupTable::getColor(float height) const{
+    uint32_t packed = lookup(height);
+    unsigned char rgba[4];
+    memcpy(rgba, &packed, 4);
+    return ofColor(rgba[0], rgba[1], rgba[2], rgba[3]);
+}
+
+void ColorLookupTable::colorize(const float* heights, int n, uint32_t* rgba) const{
+    for (int i = 0; i < n; i++)
+        rgba[i] = data[getIndex(heights[i])];
+}
+
+void ColorLookupTable::crossFade(const ColorLookupTable& a, const ColorLookupTable& b, float amount){
+    ColorLookupTable result;
+    result.setup(std::min(a.getMinHeight(), b.getMinHeight()), std::max(a.getMaxHeight(), b.getMaxHeight()), a.getStep());
+    // 8 bit fixed point weight, two channels at a time (r and b, g and a)
+    uint32_t t = ofClamp(amount, 0, 1) * 256 + 0.5f;
+    for (int i = 0; i < result.count; i++){
+        float height = result.getHeight(i);
+        uint32_t ca = a.lookup(height);
+        uint32_t cb = b.lookup(height);
+        uint32_t rb = (((ca & 0x00ff00ff) * (256 - t) + (cb & 0x00ff00ff) * t + 0x00800080) >> 8) & 0x00ff00ff;
+        uint32_t ga = ((((ca >> 8) & 0x00ff00ff) * (256 - t) + ((cb >> 8) & 0x00ff00ff) * t + 0x00800080) >> 8) & 0x00ff00ff;
+        result.data[i] = rb | (ga << 8);
+    }
+    *this = result;
+}
+
 bool ColorMap::updateColormap() {
+    updateTexture();
+    updateLookupTable();
+    return true;
+}
+
+void ColorMap::updateTexture() {
     if (entries.isAllocated())
         entries.clear();
     entries.allocate(numEntries, 1, 3);
@@ -66,7 +152,66 @@ bool ColorMap::updateColormap() {
         }
     }
     tex.setFromPixels(entries);
-    return true;
+    version++;
+}
+
+void ColorMap::setLookupStep(float step){
+    lookupStep = step;
+    updateLookupTable();
+}
+
+void ColorMap::updateLookupTable(){
+    if (heightMapKeys.empty())
+        return;
+    lookupTable.setup(min, max, lookupStep);
+    updateLookupTable(min, max);
+}
+
+// The keys are walked along with the increasing entry heights, no search per entry
+void ColorMap::updateLookupTable(float fromHeight, float toHeight){
+    if (heightMapKeys.empty())
+        return;
+    // A new range or step needs a new table
+    int expectedSize = (int)std::ceil((max - min) / lookupStep - 1e-4f) + 1;
+    if (lookupTable.getMinHeight() != (float)min || lookupTable.getStep() != lookupStep || lookupTable.size() != expectedSize){
+        lookupTable.setup(min, max, lookupStep);
+        fromHeight = min;
+        toHeight = max;
+    }
+
+    int first = std::max(0, (int)std::floor((fromHeight - lookupTable.getMinHeight()) / lookupTable.getStep()));
+    int last = std::min(lookupTable.size() - 1, (int)std::ceil((toHeight - lookupTable.getMinHeight()) / lookupTable.getStep()));
+    uint32_t* table = lookupTable.getData();
+    int numKeys = heightMapKeys.size();
+    int r = 0;
+    for (int i = first; i <= last; i++){
+        float height = lookupTable.getHeight(i);
+        while (r < numKeys && heightMapKeys[r].height <= height)
+            r++;
+        if (r == 0){
+            table[i] = ColorLookupTable::pack(heightMapKeys.front().color);
+            continue;
+        }
+        if (r == numKeys){
+            table[i] = ColorLookupTable::pack(heightMapKeys.back().color);
+            continue;
+        }
+
+        // 16 bit fixed point interpolation between keys l and r
+        const HeightMapKey& kl = heightMapKeys[r - 1];
+        const HeightMapKey& kr = heightMapKeys[r];
+        uint32_t w = ofClamp((height - kl.height) / (kr.height - kl.height), 0, 1) * 65536 + 0.5f;
+        ofColor c;
+        c.r = (kl.color.r * (65536 - w) + kr.color.r * w + 32768) >> 16;
+        c.g = (kl.color.g * (65536 - w) + kr.color.g * w + 32768) >> 16;
+        c.b = (kl.color.b * (65536 - w) + kr.color.b * w + 32768) >> 16;
+        table[i] = ColorLookupTable::pack(c);
+    }
+}
+
+void ColorMap::getKeyRange(int key, float& fromHeight, float& toHeight) const{
+    fromHeight = heightMapKeys[std::max(key - 1, 0)].height;
+    toHeight = heightMapKeys[std::min(key + 1, (int)heightMapKeys.size() - 1)].height;
 }
 
 bool ColorMap::scaleRange(float factor)
@@ -78,19 +223,41 @@ bool ColorMap::scaleRange(float factor)
     return true;
 }
 
+// Changing a key only changes the lookup table between its neighbours. A new key
+// range is handled by updateLookupTable which then rebuilds the whole table
 bool ColorMap::setColorKey(int key, ofColor color){
     heightMapKeys[key].color = color;
-    return updateColormap();
+    float from, to;
+    getKeyRange(key, from, to);
+    updateTexture();
+    updateLookupTable(from, to);
+    return true;
 }
 
 bool ColorMap::setHeightKey(int key, float height){
+    float from, to;
+    getKeyRange(key, from, to);
     heightMapKeys[key].height = height;
+    HeightMapKey moved = heightMapKeys[key];
     
     std::sort(heightMapKeys.begin(), heightMapKeys.end());
     
     min = heightMapKeys.front().height;
     max = heightMapKeys.back().height;
-    return updateColormap();
+
+    // The neighbours at the new position are influenced too
+    for (int i = 0; i < (int)heightMapKeys.size(); i++){
+        if (heightMapKeys[i].height == moved.height && heightMapKeys[i].color == moved.color){
+            float newFrom, newTo;
+            getKeyRange(i, newFrom, newTo);
+            from = std::min(from, newFrom);
+            to = std::max(to, newTo);
+            break;
+        }
+    }
+    updateTexture();
+    updateLookupTable(from, to);
+    return true;
 }
 
 bool ColorMap::addKey(ofColor color, float height){
@@ -100,21 +267,40 @@ bool ColorMap::addKey(ofColor color, float height){
     
     min = heightMapKeys.front().height;
     max = heightMapKeys.back().height;
-    return updateColormap();
+
+    float from = min, to = max;
+    for (int i = 0; i < (int)heightMapKeys.size(); i++){
+        if (heightMapKeys[i].height == height && heightMapKeys[i].color == color){
+            getKeyRange(i, from, to);
+            break;
+        }
+    }
+    updateTexture();
+    updateLookupTable(from, to);
+    return true;
 }
 
 bool ColorMap::removeKey(int key){
+    float from, to;
+    getKeyRange(key, from, to);
     heightMapKeys.erase(heightMapKeys.begin()+key);
     min = heightMapKeys.front().height;
     max = heightMapKeys.back().height;
-    return updateColormap();
+    updateTexture();
+    updateLookupTable(from, to);
+    return true;
 }
 
 bool ColorMap::swapKeys(int k1, int k2){
     ofColor tmp = heightMapKeys[k1].color;
     heightMapKeys[k1].color = heightMapKeys[k2].color;
     heightMapKeys[k2].color = tmp;
-    return updateColormap();
+    float from1, to1, from2, to2;
+    getKeyRange(k1, from1, to1);
+    getKeyRange(k2, from2, to2);
+    updateTexture();
+    updateLookupTable(std::min(from1, from2), std::max(to1, to2));
+    return true;
 }
 
 ColorMap::HeightMapKey ColorMap::operator[](int scalar) const
@@ -26,6 +26,76 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include "ofMain.h"
 #include "ofxXmlSettings.h"
 
+// Packed RGBA colours (bytes r, g, b, a in memory) of a colour map sampled at evenly spaced
+// heights. The colour of a height is one gather: table[round((height - min) / step)].
+// The table starts on a cache line and can be written directly into RGBA ofPixels
+class ColorLookupTable
+{
+public:
+    ColorLookupTable();
+    ColorLookupTable(const ColorLookupTable& other);
+    ColorLookupTable& operator=(const ColorLookupTable& other);
+
+    void setup(float minHeight, float maxHeight, float step);
+
+    int size() const
+    {
+        return count;
+    }
+    float getMinHeight() const
+    {
+        return minHeight;
+    }
+    float getMaxHeight() const
+    {
+        return minHeight + (count - 1) * step;
+    }
+    float getStep() const
+    {
+        return step;
+    }
+    float getHeight(int index) const
+    {
+        return minHeight + index * step;
+    }
+    const uint32_t* getData() const
+    {
+        return data;
+    }
+    uint32_t* getData()
+    {
+        return data;
+    }
+
+    // Index of the nearest entry, heights outside the table are clamped (NaN gives 0)
+    int getIndex(float height) const
+    {
+        float i = (height - minHeight) * invStep + 0.5f;
+        return i > 0 ? (i < count - 1 ? (int)i : count - 1) : 0;
+    }
+    uint32_t lookup(float height) const
+    {
+        return data[getIndex(height)];
+    }
+    ofColor getColor(float height) const;
+
+    // Colourise n heights into n packed RGBA pixels
+    void colorize(const float* heights, int n, uint32_t* rgba) const;
+
+    // Table over both ranges (with the step of a), blending a (amount 0) into b (amount 1)
+    void crossFade(const ColorLookupTable& a, const ColorLookupTable& b, float amount);
+
+    static uint32_t pack(const ofColor& color);
+
+private:
+    void allocate(int count);
+
+    float minHeight, step, invStep;
+    int count;
+    std::vector<uint32_t> storage;
+    uint32_t* data; // First cache line aligned element of storage
+};
+
 class ColorMap
 {
 public:
@@ -43,7 +113,9 @@ public:
     };
     
     ColorMap(void)
-    :numEntries(512){
+    :numEntries(512),
+    lookupStep(0.25f),
+    version(0){
     }
     
     bool setKeys(std::vector<ofColor> colorkeys, std::vector<double> heightkeys); // Set keys
@@ -74,6 +146,21 @@ public:
     {
         return numEntries;
     }
+    const ofPixels& getEntries(void) const // Returns the RGB entries of the map
+    {
+        return entries;
+    }
+    // Colours of the key function every lookupStep mm over the key range,
+    // kept up to date when keys are changed
+    const ColorLookupTable& getLookupTable(void) const
+    {
+        return lookupTable;
+    }
+    void setLookupStep(float step);
+    unsigned int getVersion(void) const // Incremented every time the colors change
+    {
+        return version;
+    }
     int getNumKeys(void) const // Returns the number of colorkeys in the map
     {
         return heightMapKeys.size();
@@ -84,6 +171,11 @@ public:
     }
     
 private:
+    void updateTexture(void);
+    void updateLookupTable(void);
+    void updateLookupTable(float fromHeight, float toHeight); // Only the entries between the two heights
+    void getKeyRange(int key, float& fromHeight, float& toHeight) const; // Heights influenced by a key
+
     // Colorkeys
     std::vector<HeightMapKey> heightMapKeys;
     
@@ -92,4 +184,8 @@ private:
     ofPixels entries; // Array of RGBA entries
     ofImage tex;
     double min, max; // The scalar value range
+
+    ColorLookupTable lookupTable;
+    float lookupStep; // Height step of the lookup table in mm
+    unsigned int version;
 };
@@ -29,7 +29,14 @@ using namespace ofxCSG;
 
 SandSurfaceRenderer::SandSurfaceRenderer(std::shared_ptr<KinectProjector> const& k, std::shared_ptr<ofAppBaseWindow> const& p)
 :settingsLoaded(false),
-editColorMap(false){
+editColorMap(false),
+softwareRendering(false),
+meshLOD(1),
+drawHillshade(false),
+hillshadeStrength(0.5),
+hillshadeTextureUpdate(0),
+colorMapFadeStart(-1),
+colorMapFadeDuration(1){
     kinectProjector = k;
     projWindow = p;
     forceGuiUpdate = false;
@@ -101,6 +108,8 @@ void SandSurfaceRenderer::setup(bool sdisplayGui){
 	contourLineFboScale = elevationMin-elevationMax;
 	contourLineFboOffset = elevationMax;
     contourLineFactor = contourLineFboScale/contourLineDistance;
+    kinectProjector->setContourLevels(contourLineDistance);
+    kinectProjector->setHillshading(drawHillshade);
     
 	kinectROI = kinectProjector->getKinectROI();
 
@@ -128,8 +137,10 @@ void SandSurfaceRenderer::setup(bool sdisplayGui){
 #endif
     if (!loaded)
     {
-        ofLogError("GreatSand") << "setup(): shader not loaded" ;
+        ofLogError("GreatSand") << "setup(): shader not loaded, using the software renderer" ;
+        softwareRendering = true;
     }
+    softwareRenderer.setup(projResX, projResY);
     
     //Prepare fbo
     fboProjWindow.allocate(projResX, projResY, GL_RGBA);
@@ -166,6 +177,8 @@ void SandSurfaceRenderer::updateGuiValue()
 {
     if (forceLoadColorMapFile){
         forceLoadColorMapFile = false;
+        colorMapFadeFrom = heightMap.getLookupTable();
+        colorMapFadeStart = ofGetElapsedTimef();
         heightMap.loadFile(colorMapPath + colorMapFile);
         int pos = find(colorMapFilesList.begin(), colorMapFilesList.end(), colorMapFile) - colorMapFilesList.begin();
         if (pos < colorMapFilesList.size()){
@@ -177,6 +190,7 @@ void SandSurfaceRenderer::updateGuiValue()
         populateColorList();
         gui2->getToggle(CMP_DRAW_DISTANCE)->setChecked(GetDrawContourLines());
         gui2->getSlider(CMP_CONTOUR_LINE_DISTANCE)->setValue(GetContourLineDistance());
+        gui2->getToggle(CMP_HILLSHADE)->setChecked(getDrawHillshade());
         setForceGuiUpdate(false);
     }
 }
@@ -208,30 +222,24 @@ void SandSurfaceRenderer::setupMesh(){
     // Initialise mesh
     kinectROI = kinectProjector->getKinectROI();
   //  ofVec2f kinectRes = kinectProjector->getKinectRes();
-	ofLogVerbose("SandSurfaceRenderer") << "setupMesh. KinectROI: " << kinectROI;
+	ofLogVerbose("SandSurfaceRenderer") << "setupMesh. KinectROI: " << kinectROI << " LOD: " << meshLOD;
 
-    meshwidth = kinectROI.width;
-    meshheight = kinectROI.height;
-    mesh.clear();
+    // Primitive restart needs OpenGL 3.1, the GL2 and ES renderers get degenerate triangles
+#ifdef TARGET_OPENGLES
+    bool primitiveRestart = false;
+#else
+    bool primitiveRestart = ofIsGLProgrammableRenderer();
+#endif
+    mesh.build(kinectROI, meshLOD, primitiveRestart);
+    mesh.upload();
+}
 
-	for (unsigned int y = 0; y < meshheight; y++)
-        for(unsigned int x=0;x<meshwidth;x++)
-        {
-            ofPoint pt = ofPoint(x+kinectROI.x,y+kinectROI.y,0.0f)-ofPoint(0.5,0.5,0); // We move of a half pixel to center the color pixel (more beautiful)
-            mesh.addVertex(pt); // make a new vertex
-            mesh.addTexCoord(pt);
-        }
-    for(unsigned int y=0;y<meshheight-1;y++)
-        for(unsigned int x=0;x<meshwidth-1;x++)
-        {
-            mesh.addIndex(x+y*meshwidth);         // 0
-            mesh.addIndex((x+1)+y*meshwidth);     // 1
-            mesh.addIndex(x+(y+1)*meshwidth);     // 10
-            
-            mesh.addIndex((x+1)+y*meshwidth);     // 1
-            mesh.addIndex((x+1)+(y+1)*meshwidth); // 11
-            mesh.addIndex(x+(y+1)*meshwidth);     // 10
-        }
+void SandSurfaceRenderer::setMeshLOD(int lod){
+    lod = (lod >= 4) ? 4 : ((lod >= 2) ? 2 : 1);
+    if (lod == meshLOD)
+        return;
+    meshLOD = lod;
+    setupMesh();
 }
 
 void SandSurfaceRenderer::update(){
@@ -244,10 +252,38 @@ void SandSurfaceRenderer::update(){
     if (kinectProjector->isCalibrationUpdated())
         updateConversionMatrices();
     
-    // Draw sandbox
-    if (drawContourLines)
-        prepareContourLinesFbo();
-    drawSandbox();
+    // Draw sandbox, only when one of the inputs of the image changed
+    if (drawHillshade && !softwareRendering)
+        updateHillshadeTexture();
+    uint64_t depthVersion = kinectProjector->getDepthTextureVersion();
+    float colorMapFade = getColorMapFade();
+    sandboxRedraw.begin()
+        .add(softwareRendering)
+        .add(depthVersion)
+        .add(transposedKinectProjMatrix).add(transposedKinectWorldMatrix)
+        .add(basePlaneEq).add(FilteredDepthScale).add(FilteredDepthOffset)
+        .add(kinectROI).add(meshLOD)
+        .add(heightMap.getVersion()).add(heightMapScale).add(heightMapOffset).add(colorMapFade)
+        .add(drawContourLines).add(contourLineFactor)
+        .add(drawHillshade).add(hillshadeStrength).add(hillshadeTextureUpdate);
+    if (sandboxRedraw.changed())
+    {
+        if (softwareRendering)
+        {
+            drawSandboxSoftware();
+        }
+        else
+        {
+            if (drawContourLines && contourLinesRedraw.begin()
+                .add(depthVersion)
+                .add(transposedKinectProjMatrix).add(transposedKinectWorldMatrix)
+                .add(basePlaneEq).add(FilteredDepthScale).add(FilteredDepthOffset)
+                .add(contourLineFboScale).add(contourLineFboOffset)
+                .add(kinectROI).add(meshLOD).changed())
+                prepareContourLinesFbo();
+            drawSandbox();
+        }
+    }
     
     // GUI
 	if (displayGui) {
@@ -293,12 +329,61 @@ void SandSurfaceRenderer::drawSandbox() {
     heightMapShader.setUniformTexture("pixelCornerElevationSampler", contourLineFramebufferObject.getTexture(), 3);
     heightMapShader.setUniform1f("contourLineFactor", contourLineFactor);
     heightMapShader.setUniform1i("drawContourLines", drawContourLines);
+    bool hillshade = drawHillshade && hillshadeTexture.isAllocated();
+    if (hillshade)
+        heightMapShader.setUniformTexture("hillshadeSampler", hillshadeTexture, 4);
+    heightMapShader.setUniform1i("drawHillshade", hillshade);
+    heightMapShader.setUniform1f("hillshadeStrength", hillshadeStrength);
     mesh.draw();
     heightMapShader.end();
     kinectProjector->unbind();
     fboProjWindow.end();
 }
 
+void SandSurfaceRenderer::updateHillshadeTexture() {
+    const HillshadeRaster& hillshade = kinectProjector->getHillshade();
+    if (hillshade.getUpdateCount() == hillshadeTextureUpdate)
+        return;
+    int w = hillshade.getWidth();
+    int h = hillshade.getHeight();
+    if (!hillshadeTexture.isAllocated() || hillshadeTexture.getWidth() != w || hillshadeTexture.getHeight() != h)
+        hillshadeTexture.allocate(w, h, GL_LUMINANCE);
+    hillshadeTexture.loadData(hillshade.getShading(), w, h, GL_LUMINANCE);
+    hillshadeTextureUpdate = hillshade.getUpdateCount();
+}
+
+void SandSurfaceRenderer::renderSandboxSoftware(ofPixels& output) {
+    softwareRenderer.setMatrices(kinectProjector->getKinectWorldMatrix(), kinectProjector->getKinectProjMatrix());
+    softwareRenderer.setBasePlane(basePlaneEq);
+    float colorMapFade = getColorMapFade();
+    if (colorMapFade < 1){
+        colorMapFaded.crossFade(colorMapFadeFrom, heightMap.getLookupTable(), colorMapFade);
+        softwareRenderer.setColorMap(colorMapFaded);
+    } else {
+        softwareRenderer.setColorMap(heightMap.getLookupTable());
+    }
+    softwareRenderer.setContourLines(drawContourLines, contourLineFboScale, contourLineFboOffset, contourLineFactor);
+    softwareRenderer.render(kinectProjector->getFilteredDepthPixels(), mesh, output);
+}
+
+float SandSurfaceRenderer::getColorMapFade() {
+    if (!softwareRendering || colorMapFadeStart < 0)
+        return 1;
+    float fade = (ofGetElapsedTimef() - colorMapFadeStart) / colorMapFadeDuration;
+    if (fade >= 1)
+        colorMapFadeStart = -1;
+    return ofClamp(fade, 0, 1);
+}
+
+void SandSurfaceRenderer::drawSandboxSoftware() {
+    renderSandboxSoftware(softwarePixels);
+    softwareTexture.loadData(softwarePixels);
+    fboProjWindow.begin();
+    ofBackground(0);
+    softwareTexture.draw(0, 0);
+    fboProjWindow.end();
+}
+
 void SandSurfaceRenderer::prepareContourLinesFbo()
 {
     contourLineFramebufferObject.begin();
@@ -329,6 +414,12 @@ void SandSurfaceRenderer::setupGui(){
     gui2->getSlider(CMP_CONTOUR_LINE_DISTANCE)->setStripeColor(ofColor::blue);
     gui2->addDropdown(CMP_LOAD_COLOR_MAP, colorMapFilesList)->setName(CMP_LOAD_COLOR_MAP);
     gui2->getDropdown(CMP_LOAD_COLOR_MAP)->setStripeColor(ofColor::yellow);
+    gui2->addDropdown(CMP_MESH_LOD, {"1 pixel", "2 pixels", "4 pixels"})->setName(CMP_MESH_LOD);
+    gui2->getDropdown(CMP_MESH_LOD)->setStripeColor(ofColor::yellow);
+    gui2->getDropdown(CMP_MESH_LOD)->select(meshLOD == 4 ? 2 : meshLOD - 1);
+    gui2->addToggle(CMP_HILLSHADE, drawHillshade)->setStripeColor(ofColor::blue);
+    gui2->addSlider("Relief strength", 0, 1, hillshadeStrength)->setName(CMP_HILLSHADE_STRENGTH);
+    gui2->getSlider(CMP_HILLSHADE_STRENGTH)->setStripeColor(ofColor::blue);
     gui2->addHeader(":: Display ::", false);
 
     gui = new ofxDatGui( ofxDatGuiAnchor::NO_ANCHOR );
@@ -476,10 +567,17 @@ void  SandSurfaceRenderer::setDrawContourLines(bool newValue) {
 
 }
 
+void SandSurfaceRenderer::setDrawHillshade(bool newValue) {
+    drawHillshade = newValue;
+    kinectProjector->setHillshading(drawHillshade);
+}
+
 void SandSurfaceRenderer::onToggleEvent(ofxDatGuiToggleEvent e){
     if (e.target->is(CMP_DRAW_DISTANCE)) {
         setDrawContourLines(e.checked);
         // drawContourLines = e.checked;
+    } else if (e.target->is(CMP_HILLSHADE)) {
+        setDrawHillshade(e.checked);
     } else if (e.target->is("Edit")) {
         editColorMap = e.checked;
     }
@@ -499,6 +597,7 @@ void SandSurfaceRenderer::setContourLineDistance(float newValue) {
     auto oldValue = contourLineDistance;
     contourLineDistance = newValue;
     contourLineFactor = contourLineFboScale / contourLineDistance;
+    kinectProjector->setContourLevels(contourLineDistance);
     if (newValue != oldValue) {
         updateStateEvent();
     }
@@ -513,6 +612,8 @@ void SandSurfaceRenderer::onSliderEvent(ofxDatGuiSliderEvent e){
     if (e.target->is(CMP_CONTOUR_LINE_DISTANCE)) {
         setContourLineDistance(e.value);
         
+    } else if (e.target->is(CMP_HILLSHADE_STRENGTH)) {
+        setHillshadeStrength(e.value);
     } else if (e.target->is("Height")) {
         int i = selectedColor;
         int j = heightMap.size()-1-i;
@@ -536,7 +637,10 @@ void SandSurfaceRenderer::selectColorMap(string fileName) {
 }
 
 void SandSurfaceRenderer::onDropdownEvent(ofxDatGuiDropdownEvent e){
-    selectColorMap(e.target->getLabel());
+    if (e.target->is(CMP_MESH_LOD))
+        setMeshLOD(1 << e.child);
+    else
+        selectColorMap(e.target->getLabel());
 }
 
 void SandSurfaceRenderer::onScrollViewEvent(ofxDatGuiScrollViewEvent e){
@@ -596,6 +700,10 @@ bool SandSurfaceRenderer::loadSettings(){
     colorMapFile = xml.getValue<string>("colorMapFile");
     drawContourLines = xml.getValue<bool>("drawContourLines");
     contourLineDistance = xml.getValue<float>("contourLineDistance");
+    int lod = xml.getValue<int>("meshLOD");
+    meshLOD = (lod >= 4) ? 4 : ((lod >= 2) ? 2 : 1);
+    drawHillshade = xml.getValue<bool>("drawHillshade", false);
+    hillshadeStrength = ofClamp(xml.getValue<float>("hillshadeStrength", 0.5), 0, 1);
     
     return true;
 }
@@ -609,6 +717,9 @@ bool SandSurfaceRenderer::saveSettings(){
     xml.addValue("colorMapFile", colorMapFile);
     xml.addValue("drawContourLines", drawContourLines);
     xml.addValue("contourLineDistance", contourLineDistance);
+    xml.addValue("meshLOD", meshLOD);
+    xml.addValue("drawHillshade", drawHillshade);
+    xml.addValue("hillshadeStrength", hillshadeStrength);
     xml.setToParent();
     return xml.save(settingsFile);
 }
@@ -30,11 +30,17 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
 #include "ofMain.h"
 #include "../KinectProjector/KinectProjector.h"
 #include "ColorMap.h"
+#include "SoftwareSandRenderer.h"
+#include "SandboxMesh.h"
+#include "../KinectProjector/RedrawTracker.h"
 
 
 constexpr auto CMP_DRAW_DISTANCE = "Contour lines";
 constexpr auto CMP_CONTOUR_LINE_DISTANCE = "Contour lines distance";
 constexpr auto CMP_LOAD_COLOR_MAP = "Load Color Map";
+constexpr auto CMP_MESH_LOD = "Mesh detail";
+constexpr auto CMP_HILLSHADE = "Relief shading";
+constexpr auto CMP_HILLSHADE_STRENGTH = "Relief shading strength";
 
 
 class SaveModal : public ofxModalWindow
@@ -113,15 +119,43 @@ public:
     string GetColorMapFile() {
         return colorMapFile;
     }
+
+    // Multiply the colors by the relief shading computed by the kinect projector
+    void setDrawHillshade(bool value);
+    bool getDrawHillshade() {
+        return drawHillshade;
+    }
+    void setHillshadeStrength(float value) {
+        hillshadeStrength = ofClamp(value, 0, 1);
+    }
+
+    // Vertex spacing of the sandbox mesh in kinect pixels: 1, 2 or 4
+    void setMeshLOD(int lod);
+    int getMeshLOD() {
+        return meshLOD;
+    }
     bool forceLoadColorMapFile;
 
+    // Render the sandbox on the CPU into a projector sized RGBA image, no OpenGL needed
+    void renderSandboxSoftware(ofPixels& output);
+    // Use the CPU renderer instead of the shaders, automatically enabled when the shaders could not be loaded
+    void setSoftwareRendering(bool value) {
+        softwareRendering = value;
+    }
+    bool getSoftwareRendering() {
+        return softwareRendering;
+    }
+
 private:
     // Private methods
     void setupMesh();
     void updateConversionMatrices();
     void updateRangesAndBasePlane();
     void drawSandbox();
+    void drawSandboxSoftware();
     void prepareContourLinesFbo();
+    void updateHillshadeTexture();
+    float getColorMapFade(); // 0: previous colour map, 1: fade done
     void updateColorListColor(int i, int j);
     void populateColorList();
     bool loadSettings();
@@ -141,9 +175,8 @@ private:
     ofMatrix4x4                 transposedKinectWorldMatrix;
 
     // Mesh
-    ofMesh mesh;
-    int meshwidth;          //Mesh size
-    int meshheight;
+    SandboxMesh mesh;
+    int meshLOD;            // Vertex spacing in kinect pixels
     
     // Shaders
     ofShader elevationShader;
@@ -152,6 +185,14 @@ private:
     // FBos
     ofFbo   fboProjWindow;    
     ofFbo   contourLineFramebufferObject;
+    RedrawTracker sandboxRedraw;      // Inputs of fboProjWindow
+    RedrawTracker contourLinesRedraw; // Inputs of contourLineFramebufferObject
+
+    // CPU fallback
+    SoftwareSandRenderer softwareRenderer;
+    bool softwareRendering;
+    ofPixels softwarePixels;
+    ofTexture softwareTexture;
 
     // Base plane
     ofVec3f basePlaneNormal, basePlaneNormalBack;
@@ -164,6 +205,11 @@ private:
 
     std::vector<string> colorMapFilesList;
     ColorMap    heightMap;
+    // The software renderer fades from the previous map when another file is selected
+    ColorLookupTable colorMapFadeFrom;
+    ColorLookupTable colorMapFaded;
+    float colorMapFadeStart; // s, negative when not fading
+    float colorMapFadeDuration; // s
     std::vector<ColorMap::HeightMapKey> heightMapKeys;
     
 	float heightMapScale,heightMapOffset; // Scale and offset values to convert from elevation to height color map texture coordinates
@@ -174,6 +220,12 @@ private:
     // Contourlines
     float contourLineDistance, contourLineFactor;
     bool drawContourLines; // Flag if topographic contour lines are enabled
+
+    // Relief shading
+    bool drawHillshade;
+    float hillshadeStrength; // 0: colors only, 1: full shading
+    ofTexture hillshadeTexture;
+    uint64_t hillshadeTextureUpdate; // Shading update uploaded to the texture
     
     // GUI Main interface and Modal
     bool displayGui;
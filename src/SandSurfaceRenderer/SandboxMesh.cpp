@@ -0,0 +1,115 @@
+/***********************************************************************
+SandboxMesh - Grid mesh of the kinect ROI drawn by the sandbox shaders
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "SandboxMesh.h"
+
+const ofIndexType SandboxMesh::restartIndex;
+
+SandboxMesh::SandboxMesh()
+:lod(1),
+primitiveRestart(false),
+columns(0),
+rows(0),
+numVertices(0),
+numIndices(0),
+uploaded(false){
+}
+
+// Offsets 0, lod, 2 lod, ... and always the last pixel so the mesh covers the whole ROI
+static void gridOffsets(int size, int lod, std::vector<int>& offsets){
+    offsets.clear();
+    for (int i = 0; i < size - 1; i += lod)
+        offsets.push_back(i);
+    offsets.push_back(std::max(size - 1, 0));
+}
+
+void SandboxMesh::build(const ofRectangle& roi, int slod, bool sprimitiveRestart){
+    lod = std::max(slod, 1);
+    primitiveRestart = sprimitiveRestart;
+    uploaded = false;
+
+    gridOffsets(roi.width, lod, gridX);
+    gridOffsets(roi.height, lod, gridY);
+    columns = gridX.size();
+    rows = gridY.size();
+    if (columns < 2 || rows < 2){
+        numVertices = numIndices = 0;
+        return;
+    }
+
+    numVertices = columns * rows;
+    if ((int)vertices.size() < numVertices)
+        vertices.resize(numVertices);
+    ofVec2f* v = vertices.data();
+    for (int y = 0; y < rows; y++)
+        for (int x = 0; x < columns; x++)
+            *v++ = ofVec2f(roi.x + gridX[x], roi.y + gridY[y]) - ofVec2f(0.5, 0.5); // We move of a half pixel to center the color pixel (more beautiful)
+
+    // Two indices per column and strip, and between two strips a restart index or
+    // the last index of the strip and the first of the next one
+    int strips = rows - 1;
+    numIndices = strips * 2 * columns + (strips - 1) * (primitiveRestart ? 1 : 2);
+    if ((int)indices.size() < numIndices)
+        indices.resize(numIndices);
+    ofIndexType* i = indices.data();
+    for (int y = 0; y < strips; y++){
+        if (y > 0){
+            if (primitiveRestart){
+                *i++ = restartIndex;
+            } else {
+                *i = i[-1];
+                i++;
+                *i++ = y * columns;
+            }
+        }
+        for (int x = 0; x < columns; x++){
+            *i++ = x + y * columns;
+            *i++ = x + (y + 1) * columns;
+        }
+    }
+    ofLogVerbose("SandboxMesh") << "build(): " << columns << " x " << rows << " vertices, " << numIndices << " indices";
+}
+
+void SandboxMesh::upload(){
+    if (numVertices == 0)
+        return;
+    vbo.setVertexData(vertices.data(), numVertices, GL_STATIC_DRAW);
+    vbo.setTexCoordData(vertices.data(), numVertices, GL_STATIC_DRAW);
+    vbo.setIndexData(indices.data(), numIndices, GL_STATIC_DRAW);
+    uploaded = true;
+}
+
+void SandboxMesh::draw(){
+    if (!uploaded)
+        upload();
+    if (!uploaded)
+        return;
+#ifndef TARGET_OPENGLES
+    if (primitiveRestart){
+        glEnable(GL_PRIMITIVE_RESTART);
+        glPrimitiveRestartIndex(restartIndex);
+    }
+#endif
+    vbo.drawElements(GL_TRIANGLE_STRIP, numIndices);
+#ifndef TARGET_OPENGLES
+    if (primitiveRestart)
+        glDisable(GL_PRIMITIVE_RESTART);
+#endif
+}
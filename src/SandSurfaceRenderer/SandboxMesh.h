@@ -0,0 +1,68 @@
+/***********************************************************************
+SandboxMesh - Grid mesh of the kinect ROI drawn by the sandbox shaders
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#pragma once
+
+#include "ofMain.h"
+
+// One vertex every lod kinect pixels of the ROI, placed on the pixel corners, with
+// the kinect position as texture coordinate. Each row of quads is a triangle strip,
+// strips are separated by a restart index (or by degenerate triangles when primitive
+// restart is not available). The buffers are only reallocated when they have to grow
+// and the vertex data stays in a VBO until the mesh is rebuilt.
+// build() does not need a GL context, upload() and draw() do
+class SandboxMesh {
+public:
+    static const ofIndexType restartIndex = std::numeric_limits<ofIndexType>::max();
+
+    SandboxMesh();
+
+    // lod is the vertex spacing in kinect pixels (1, 2 or 4)
+    void build(const ofRectangle& roi, int lod, bool primitiveRestart);
+    void upload();
+    void draw();
+
+    int getLOD() const {
+        return lod;
+    }
+    int getNumVertices() const {
+        return numVertices;
+    }
+    int getNumIndices() const {
+        return numIndices;
+    }
+    const ofVec2f* getVertices() const {
+        return vertices.data();
+    }
+    const ofIndexType* getIndices() const {
+        return indices.data();
+    }
+
+private:
+    int lod;
+    bool primitiveRestart;
+    int columns, rows;
+    int numVertices, numIndices;
+    std::vector<ofVec2f> vertices; // Also used as texture coordinates
+    std::vector<ofIndexType> indices;
+    std::vector<int> gridX, gridY;  // ROI offsets of the vertex columns and rows
+    ofVbo vbo;
+    bool uploaded;
+};
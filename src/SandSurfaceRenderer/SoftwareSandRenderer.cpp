@@ -0,0 +1,306 @@
+/***********************************************************************
+SoftwareSandRenderer - CPU implementation of the height map and contour line shaders
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#include "SoftwareSandRenderer.h"
+#include "../KinectProjector/KinectRayTable.h"
+#include <future>
+
+SoftwareSandRenderer::SoftwareSandRenderer()
+:projWidth(0),
+projHeight(0),
+numThreads(1),
+drawContourLines(false),
+contourLineFboScale(1),
+contourLineFboOffset(0),
+contourLineFactor(0){
+}
+
+void SoftwareSandRenderer::setup(int sprojWidth, int sprojHeight, int snumThreads){
+    projWidth = sprojWidth;
+    projHeight = sprojHeight;
+    numThreads = snumThreads > 0 ? snumThreads : std::max(1, (int)std::thread::hardware_concurrency());
+
+    size_t gridSize = (projWidth + 1) * (projHeight + 1);
+    fragmentHeight.resize(gridSize);
+    fragmentContour.resize(gridSize);
+    ofLogVerbose("SoftwareSandRenderer") << "setup(): " << projWidth << " x " << projHeight << " with " << numThreads << " threads";
+}
+
+void SoftwareSandRenderer::setMatrices(const ofMatrix4x4& skinectWorldMatrix, const ofMatrix4x4& skinectProjMatrix){
+    kinectWorldMatrix = skinectWorldMatrix;
+    kinectProjMatrix = skinectProjMatrix;
+}
+
+void SoftwareSandRenderer::setBasePlane(const ofVec4f& sbasePlaneEq){
+    basePlaneEq = sbasePlaneEq;
+}
+
+void SoftwareSandRenderer::setColorMap(const ColorLookupTable& lookupTable){
+    colorMap = lookupTable;
+}
+
+void SoftwareSandRenderer::setContourLines(bool draw, float scontourLineFboScale, float scontourLineFboOffset, float scontourLineFactor){
+    drawContourLines = draw;
+    contourLineFboScale = scontourLineFboScale;
+    contourLineFboOffset = scontourLineFboOffset;
+    contourLineFactor = scontourLineFactor;
+}
+
+int SoftwareSandRenderer::getNumBands(int size) const{
+    return std::min(numThreads, std::max(size, 1));
+}
+
+// Split [0, size) in getNumBands(size) bands and run task(band, begin, end) on each, in parallel
+template<class Task>
+void SoftwareSandRenderer::parallelBands(int size, Task task){
+    int bands = getNumBands(size);
+    std::vector<std::future<void> > futures;
+    for (int i = 1; i < bands; i++)
+        futures.push_back(std::async(std::launch::async, task, i, size * i / bands, size * (i + 1) / bands));
+    task(0, 0, size / bands);
+    for (auto& f : futures)
+        f.get();
+}
+
+void SoftwareSandRenderer::render(const ofFloatPixels& depth, const SandboxMesh& mesh, ofPixels& output){
+    output.allocate(projWidth, projHeight, 4);
+    int numVertices = mesh.getNumVertices();
+    if (projWidth <= 0 || projHeight <= 0 || numVertices == 0){
+        output.set(0);
+        return;
+    }
+
+    vertexX.resize(numVertices);
+    vertexY.resize(numVertices);
+    vertexHeight.resize(numVertices);
+    vertexContour.resize(numVertices);
+
+    const ofVec2f* vertices = mesh.getVertices();
+    parallelBands(numVertices, [this, &depth, vertices](int, int first, int last) { transformVertices(depth, vertices, first, last); });
+    binTriangles(mesh, projHeight + 1);
+    parallelBands(projHeight + 1, [this](int band, int y0, int y1) { rasterizeBand(band, y0, y1); });
+    parallelBands(projHeight, [this, &output](int, int y0, int y1) { shadeBand(y0, y1, output); });
+}
+
+// Vertex shaders. The vertices sit on the pixel corners (x - 0.5, y - 0.5), which the linear
+// filter of the rectangle depth texture reads as the centre of the pixel above left
+void SoftwareSandRenderer::transformVertices(const ofFloatPixels& depth, const ofVec2f* vertices, int first, int last){
+    int depthWidth = depth.getWidth();
+    int depthHeight = depth.getHeight();
+    const float* depthData = depth.getData();
+    const ofMatrix4x4& m = kinectWorldMatrix;
+
+    int n = last - first;
+    std::vector<float> wx(n), wy(n), wz(n);
+    for (int i = 0; i < n; i++){
+        float kx = vertices[first + i].x;
+        float ky = vertices[first + i].y;
+        int col = ofClamp((int)std::floor(kx), 0, depthWidth - 1);
+        int row = ofClamp((int)std::floor(ky), 0, depthHeight - 1);
+        float d = depthData[row * depthWidth + col];
+
+        // kinectWorldMatrix * (x, y, depth, 1) * depth
+        wx[i] = (m(0, 0) * kx + m(0, 1) * ky + m(0, 2) * d + m(0, 3)) * d;
+        wy[i] = (m(1, 0) * kx + m(1, 1) * ky + m(1, 2) * d + m(1, 3)) * d;
+        wz[i] = (m(2, 0) * kx + m(2, 1) * ky + m(2, 2) * d + m(2, 3)) * d;
+
+        // The colour map keys are the opposite of the elevation (see SandSurfaceRenderer::setup)
+        float elevation = basePlaneEq.x * wx[i] + basePlaneEq.y * wy[i] + basePlaneEq.z * wz[i] + basePlaneEq.w;
+        vertexHeight[first + i] = -elevation;
+        vertexContour[first + i] = (elevation - contourLineFboOffset) / contourLineFboScale;
+    }
+    KinectRayTable::worldToProj(kinectProjMatrix, wx.data(), wy.data(), wz.data(), n,
+        &vertexX[first], &vertexY[first]);
+}
+
+// Triangles of the strips, in drawing order. Each triangle goes to the bands of
+// the grid rows its pixel centres can cover; triangles off the grid are dropped
+void SoftwareSandRenderer::binTriangles(const SandboxMesh& mesh, int gridHeight){
+    int bands = getNumBands(gridHeight);
+    bandTriangles.resize(bands);
+    for (auto& band : bandTriangles)
+        band.clear();
+    triangles.clear();
+
+    const ofIndexType* indices = mesh.getIndices();
+    int numIndices = mesh.getNumIndices();
+    for (int k = 2; k < numIndices; k++){
+        ofIndexType a = indices[k - 2], b = indices[k - 1], c = indices[k];
+        // Restart indices and the degenerate triangles joining two strips
+        if (a == SandboxMesh::restartIndex || b == SandboxMesh::restartIndex || c == SandboxMesh::restartIndex || a == b || b == c || a == c)
+            continue;
+        float minY = std::min(vertexY[a], std::min(vertexY[b], vertexY[c]));
+        float maxY = std::max(vertexY[a], std::max(vertexY[b], vertexY[c]));
+        // Also rejects vertices that could not be projected (NaN)
+        if (!(maxY >= -0.5f && minY < gridHeight - 0.5f))
+            continue;
+        int firstRow = std::max((int)std::ceil(minY - 0.5f), 0);
+        int lastRow = std::min((int)std::floor(maxY - 0.5f), gridHeight - 1);
+        if (firstRow > lastRow)
+            continue;
+
+        int t = triangles.size() / 3;
+        triangles.push_back(a);
+        triangles.push_back(b);
+        triangles.push_back(c);
+        // Band i covers rows [gridHeight * i / bands, gridHeight * (i + 1) / bands)
+        for (int i = (int)((int64_t)firstRow * bands / gridHeight); i < bands && gridHeight * i / bands <= lastRow; i++)
+            if (gridHeight * (i + 1) / bands > firstRow)
+                bandTriangles[i].push_back(t);
+    }
+}
+
+// Draw the triangles of a band, in the order of the mesh indices, clipped to rows [y0, y1) of the grid.
+// There is no depth test so later triangles overwrite earlier ones as on the GPU
+void SoftwareSandRenderer::rasterizeBand(int band, int y0, int y1){
+    std::fill(fragmentHeight.begin() + y0 * (projWidth + 1), fragmentHeight.begin() + y1 * (projWidth + 1), std::numeric_limits<float>::quiet_NaN());
+    // The contour line fbo is cleared to white
+    std::fill(fragmentContour.begin() + y0 * (projWidth + 1), fragmentContour.begin() + y1 * (projWidth + 1), 1.0f);
+
+    for (int t : bandTriangles[band])
+        rasterizeTriangle(triangles[3 * t], triangles[3 * t + 1], triangles[3 * t + 2], y0, y1);
+}
+
+// Pixels whose centre is inside the triangle, with a top-left rule for centres on an edge
+void SoftwareSandRenderer::rasterizeTriangle(int a, int b, int c, int y0, int y1){
+    float ax = vertexX[a], ay = vertexY[a];
+    float bx = vertexX[b], by = vertexY[b];
+    float cx = vertexX[c], cy = vertexY[c];
+
+    float minY = std::min(ay, std::min(by, cy));
+    float maxY = std::max(ay, std::max(by, cy));
+    // Also rejects vertices that could not be projected (NaN)
+    if (!(maxY >= y0 - 0.5f && minY < y1 + 0.5f))
+        return;
+    float minX = std::min(ax, std::min(bx, cx));
+    float maxX = std::max(ax, std::max(bx, cx));
+    if (!(maxX >= -0.5f && minX < projWidth + 1 + 0.5f))
+        return;
+
+    float area = (bx - ax) * (cy - ay) - (by - ay) * (cx - ax);
+    if (area == 0 || !std::isfinite(area))
+        return;
+    // Make the edge functions positive inside
+    if (area < 0){
+        std::swap(b, c);
+        std::swap(bx, cx);
+        std::swap(by, cy);
+        area = -area;
+    }
+
+    // Edge from p to q, the inside is on its left. Centres exactly on the edge belong
+    // to one of the two triangles sharing it
+    auto topLeft = [](float px, float py, float qx, float qy) {
+        float dx = qx - px, dy = qy - py;
+        return dy < 0 || (dy == 0 && dx > 0);
+    };
+    bool tlA = topLeft(bx, by, cx, cy); // Edge opposite a
+    bool tlB = topLeft(cx, cy, ax, ay);
+    bool tlC = topLeft(ax, ay, bx, by);
+
+    int gridWidth = projWidth + 1;
+    int startX = ofClamp(std::ceil(minX - 0.5f), 0, gridWidth);
+    int endX = ofClamp(std::floor(maxX - 0.5f), -1, gridWidth - 1);
+    int startY = ofClamp(std::ceil(minY - 0.5f), y0, y1);
+    int endY = ofClamp(std::floor(maxY - 0.5f), y0 - 1, y1 - 1);
+
+    float invArea = 1.0f / area;
+    float heightA = vertexHeight[a], heightB = vertexHeight[b], heightC = vertexHeight[c];
+    float contourA = vertexContour[a], contourB = vertexContour[b], contourC = vertexContour[c];
+
+    for (int py = startY; py <= endY; py++){
+        float sy = py + 0.5f;
+        for (int px = startX; px <= endX; px++){
+            float sx = px + 0.5f;
+            float wA = (cx - bx) * (sy - by) - (cy - by) * (sx - bx);
+            float wB = (ax - cx) * (sy - cy) - (ay - cy) * (sx - cx);
+            float wC = (bx - ax) * (sy - ay) - (by - ay) * (sx - ax);
+            if (wA < 0 || wB < 0 || wC < 0)
+                continue;
+            if ((wA == 0 && !tlA) || (wB == 0 && !tlB) || (wC == 0 && !tlC))
+                continue;
+
+            wA *= invArea;
+            wB *= invArea;
+            wC *= invArea;
+            int idx = py * gridWidth + px;
+            fragmentHeight[idx] = wA * heightA + wB * heightB + wC * heightC;
+            fragmentContour[idx] = wA * contourA + wB * contourB + wC * contourC;
+        }
+    }
+}
+
+// Fragment shader: height color map lookup and contour line rule
+void SoftwareSandRenderer::shadeBand(int y0, int y1, ofPixels& output){
+    int gridWidth = projWidth + 1;
+    unsigned char* out = output.getData();
+
+    // The contour line fbo has 8 bit channels
+    auto cornerLevel = [this](float v) {
+        return std::floor(std::round(ofClamp(v, 0, 1) * 255) / 255 * contourLineFactor);
+    };
+
+    std::vector<uint32_t> colors(projWidth);
+    for (int y = y0; y < y1; y++){
+        const float* heights = &fragmentHeight[y * gridWidth];
+        colorMap.colorize(heights, projWidth, colors.data());
+        memcpy(out + y * projWidth * 4, colors.data(), projWidth * 4);
+        for (int x = 0; x < projWidth; x++){
+            unsigned char* pixel = out + (y * projWidth + x) * 4;
+            pixel[3] = 255;
+            if (std::isnan(heights[x])){
+                pixel[0] = pixel[1] = pixel[2] = 0;
+                continue;
+            }
+
+            if (!drawContourLines)
+                continue;
+
+            // gl_FragCoord and the contour line texture have their origin at the bottom left,
+            // so the shader's corners 0 and 1 are the grid row below this pixel
+            float corner0 = cornerLevel(fragmentContour[(y + 1) * gridWidth + x]);
+            float corner1 = cornerLevel(fragmentContour[(y + 1) * gridWidth + x + 1]);
+            float corner2 = cornerLevel(fragmentContour[y * gridWidth + x]);
+            float corner3 = cornerLevel(fragmentContour[y * gridWidth + x + 1]);
+
+            int edgeMask = 0;
+            int numEdges = 0;
+            if (corner0 != corner1){
+                edgeMask += 1;
+                ++numEdges;
+            }
+            if (corner2 != corner3){
+                edgeMask += 2;
+                ++numEdges;
+            }
+            if (corner0 != corner2){
+                edgeMask += 4;
+                ++numEdges;
+            }
+            if (corner1 != corner3){
+                edgeMask += 8;
+                ++numEdges;
+            }
+            int fragY = projHeight - 1 - y;
+            if (numEdges > 2 || edgeMask == 3 || edgeMask == 12 || (numEdges == 2 && (x + fragY) % 2 == 0))
+                pixel[0] = pixel[1] = pixel[2] = 0;
+        }
+    }
+}
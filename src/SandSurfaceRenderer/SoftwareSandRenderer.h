@@ -0,0 +1,81 @@
+/***********************************************************************
+SoftwareSandRenderer - CPU implementation of the height map and contour line shaders
+
+This file is part of the Magic Sand.
+
+The Magic Sand is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 2 of the
+License, or (at your option) any later version.
+
+The Magic Sand is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with the Magic Sand; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+***********************************************************************/
+
+#pragma once
+
+#include "ofMain.h"
+#include "ColorMap.h"
+#include "SandboxMesh.h"
+
+// Renders the sandbox like SandSurfaceRenderer::drawSandbox() does with heightMapShader and
+// elevationShader, without an OpenGL context. The triangle strips of the GPU mesh (same grid
+// and LOD) are used, every vertex goes through the vertex shader math and the triangles are
+// rasterised into a projector sized RGBA image. The work is split in horizontal bands
+// rendered in parallel, each band only walks the triangles binned to its rows. The colours
+// come from the lookup table of the colour map instead of its 512 texels, so they can differ
+// by the rounding of either. Used as a reference for the shaders and as a fallback renderer
+class SoftwareSandRenderer {
+public:
+    SoftwareSandRenderer();
+
+    void setup(int projWidth, int projHeight, int numThreads = 0); // 0: one thread per core
+
+    // Same values as the shader uniforms, but the matrices are not transposed
+    void setMatrices(const ofMatrix4x4& kinectWorldMatrix, const ofMatrix4x4& kinectProjMatrix);
+    void setBasePlane(const ofVec4f& basePlaneEq);
+    void setColorMap(const ColorLookupTable& lookupTable);
+    void setContourLines(bool draw, float contourLineFboScale, float contourLineFboOffset, float contourLineFactor);
+
+    // Render a filtered depth frame (in mm) with the mesh drawn by SandSurfaceRenderer.
+    // output is allocated as projWidth x projHeight RGBA
+    void render(const ofFloatPixels& depth, const SandboxMesh& mesh, ofPixels& output);
+
+private:
+    void transformVertices(const ofFloatPixels& depth, const ofVec2f* vertices, int first, int last);
+    void binTriangles(const SandboxMesh& mesh, int gridHeight);
+    void rasterizeBand(int band, int y0, int y1);
+    void rasterizeTriangle(int a, int b, int c, int y0, int y1);
+    void shadeBand(int y0, int y1, ofPixels& output);
+    int getNumBands(int size) const;
+    template<class Task> void parallelBands(int size, Task task);
+
+    int projWidth, projHeight;
+    int numThreads;
+
+    ofMatrix4x4 kinectWorldMatrix, kinectProjMatrix;
+    ofVec4f basePlaneEq;
+    ColorLookupTable colorMap;
+    bool drawContourLines;
+    float contourLineFboScale, contourLineFboOffset, contourLineFactor;
+
+    // Vertices of the last render
+    std::vector<float> vertexX, vertexY;   // Projector coordinates
+    std::vector<float> vertexHeight;       // Colour map height (opposite of the elevation)
+    std::vector<float> vertexContour;      // Normalised elevation (elevationShader depthfrag)
+
+    // Vertex indices of the triangles, in drawing order, and the triangles touching the rows of each band
+    std::vector<int> triangles;
+    std::vector<std::vector<int> > bandTriangles;
+
+    // Interpolated fragment values on a (projWidth + 1) x (projHeight + 1) grid, the size of the
+    // contour line fbo. The colour image is the top left projWidth x projHeight part
+    std::vector<float> fragmentHeight;     // NaN where no triangle was drawn
+    std::vector<float> fragmentContour;
+};
@@ -229,6 +229,29 @@ void WebsocketServer::resolveGetValue(ofxLibwebsockets::Event& args) {
 		int result = (image.empty()) ? 0 : 1;
 		resolveResponseValue<string>(args, image, error);
 	}
+	if (field == FL_CONTOUR_LINES) {
+		// Polylines in kinect coordinates: [{level, major, closed, points: [x0, y0, x1, y1, ...]}, ...]
+		Json::Value lines(Json::arrayValue);
+		if (!kp->getContourExtraction()) {
+			error = "Contour extraction is disabled";
+		} else {
+			auto contourLines = kp->getContourLines();
+			for (const auto& line : *contourLines) {
+				Json::Value jsonLine;
+				jsonLine["level"] = line.level;
+				jsonLine["major"] = line.major;
+				jsonLine["closed"] = line.closed;
+				Json::Value points(Json::arrayValue);
+				for (const auto& p : line.points) {
+					points.append(p.x);
+					points.append(p.y);
+				}
+				jsonLine["points"] = points;
+				lines.append(jsonLine);
+			}
+		}
+		resolveResponseValue<Json::Value>(args, lines, error);
+	}
 }
 
 
@@ -281,6 +304,7 @@ void WebsocketServer::resolveSetValue(ofxLibwebsockets::Event& args) {
 	(field == FL_SHOW_MOTHER_FISH) ? resolveToggleValue(args, CMP_MOTHER_FISH, [this](bool val) { this->boidGameController->setShowMotherFish(val); }) :
 	(field == FL_SHOW_MOTHER_RABBIT) ? resolveToggleValue(args, CMP_MOTHER_RABBIT, [this](bool val) { this->boidGameController->setShowMotherRabbit(val); }) :
 
+	(field == FL_CONTOUR_LINES) ? resolveToggleValue(args, "", [kp](bool val) { kp->setContourExtraction(val); }) :
 	(field == FL_DRAW_CONTOUR_LINES) ? resolveToggleValue(args, CMP_FULL_FRAME_FILTERING, [ssr](bool val) { ssr->setDrawContourLines(val); }) :
 	(field == FL_CONTOUR_LINE_DISTANCE) ? resolveFloatValue(args, [this](float val) { this->sandSurfaceRenderer->setContourLineDistance(val); }, CMP_CONTOUR_LINE_DISTANCE, getSSRGui()) :
 	(field == FL_COLOR_MAP_FILE) ? resolveStringValue(args, [this](string val) { this->sandSurfaceRenderer->selectColorMap(val); }, CMP_CONTOUR_LINE_DISTANCE, getSSRGui()) :
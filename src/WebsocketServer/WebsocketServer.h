@@ -47,6 +47,7 @@ constexpr auto FL_ERROR = "error";
 constexpr auto FL_MESSAGE = "message";
 
 constexpr auto FL_KINECT_COLOR_IMAGE = "kinectColorImage";
+constexpr auto FL_CONTOUR_LINES = "contourLines";
 
 // commands
 constexpr auto CM_GET_STATE = "getState";
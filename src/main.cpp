@@ -63,7 +63,12 @@ bool setWindowDimensions(ofGLFWWindowSettings& settings, int windowsNum) {
 }
 
 //========================================================================
-int main() {
+int main(int argc, char *argv[]) {
+	// --simulate runs the calibration on a simulated kinect and projector
+	bool simulate = false;
+	for (int i = 1; i < argc; i++)
+		simulate |= std::string(argv[i]) == "--simulate";
+
 	ofGLFWWindowSettings settings;
 //	setFirstWindowDimensions(settings);
 	//settings.width = 1200;
@@ -90,6 +95,7 @@ int main() {
 	shared_ptr<ofApp> mainApp(new ofApp);
 	ofAddListener(secondWindow->events().draw, mainApp.get(), &ofApp::drawProjWindow);
 	mainApp->projWindow = secondWindow;
+	mainApp->simulateKinect = simulate;
 		
 	ofRunApp(mainWindow, mainApp);
 	ofRunMainLoop();
@@ -37,6 +37,8 @@ void ofApp::setup() {
 
 	// Setup kinectProjector
 	kinectProjector = std::make_shared<KinectProjector>(projWindow);
+	if (simulateKinect)
+		kinectProjector->enableSimulation();
 	kinectProjector->setup(true);
 	
 	// Setup sandSurfaceRenderer
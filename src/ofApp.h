@@ -54,6 +54,7 @@ public:
 	void gotMessage(ofMessage msg);
 
 	std::shared_ptr<ofAppBaseWindow> projWindow;
+	bool simulateKinect = false;
 
 
 